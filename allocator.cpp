@@ -1,22 +1,189 @@
 #include "allocator.h"
-#include <cstdlib>   // for size_t
+#include <cstdlib>   // for size_t, getenv
 #include <cstring>   // for memset, memcpy
-#include <iostream>  // for debugging
+#include <cstdio>    // for vsnprintf
+#include <cstdarg>   // for va_list
+#include <cerrno>    // for EINVAL, ENOMEM
+#include <iostream>  // for reports the caller asks for (never on the malloc path)
 #include <unistd.h>  // for sbrk, mmap (Unix systems)
 #include <sys/mman.h> // for mmap, munmap
+#include <pthread.h>  // for thread-exit cache flushing
+#include <fcntl.h>    // for open (trace files)
+#include <time.h>     // for clock_gettime
+#include <cmath>      // for log (sample intervals)
+#include <execinfo.h> // for backtrace (heap profile stacks)
+#include <sys/syscall.h>      // for SYS_getcpu, SYS_mbind
+#include <linux/mempolicy.h>  // for MPOL_PREFERRED
+#include <linux/rseq.h>       // for struct rseq (per-CPU caches)
+#include <atomic>     // for std::atomic
+#include <mutex>      // for std::mutex, std::lock_guard
 
 // ============================================================================
 // GLOBAL STATE
 // ============================================================================
 
-// Memory pools for different size classes
-static MemoryPool small_pool;
-static MemoryPool medium_pool;
-static MemoryPool large_pool;
-static MemoryPool xlarge_pool;  // For blocks > LARGE_BLOCK_MAX
+// Memory pools for different size classes, one set per NUMA node
+static NodePools nodes[MAX_NUMA_NODES];
+static int numa_node_count = 1;
 
 // Track if allocator is initialized
-static bool allocator_initialized = false;
+static std::atomic<bool> allocator_initialized(false);
+static std::mutex init_lock;
+static std::atomic<bool> first_init_finished(false);
+
+// Progress messages stay off unless asked for (MYALLOC_VERBOSE=1 or
+// allocator_set_verbose), so a preloaded allocator is silent
+static bool verbose_logging = false;
+
+// Size class lookup (filled in by init_size_classes; the per-node class
+// state lives in NodePools)
+static uint8_t class_lookup[LARGE_BLOCK_MAX / ALIGNMENT + 1];
+
+// Thread caches: each thread points at its own cache, and caches of exited
+// threads are recycled through cache_free_list. initial-exec keeps TLS access
+// from calling __tls_get_addr (which can allocate) when built as a preload .so
+static thread_local ThreadCache* tcache __attribute__((tls_model("initial-exec"))) = nullptr;
+
+// NUMA node the calling thread last ran on (-1 until first asked)
+static thread_local int thread_node __attribute__((tls_model("initial-exec"))) = -1;
+static ThreadCache* cache_free_list = nullptr;
+static std::mutex cache_list_lock;
+static pthread_key_t tcache_key;
+static bool tcache_key_created = false;
+
+// Statistics: slab allocations are counted per thread. Every ThreadStats
+// stays on stats_list for snapshots to add up; those of exited threads
+// wait on stats_free_list for the next new thread.
+static thread_local ThreadStats* thread_stats __attribute__((tls_model("initial-exec"))) = nullptr;
+static ThreadStats* stats_list = nullptr;
+static ThreadStats* stats_free_list = nullptr;
+static std::mutex stats_lock;
+static pthread_key_t stats_key;
+static bool stats_key_created = false;
+
+// Page map: two-level radix table from page number to PageMapEntry.
+// Leaves are mapped on first use and read without locking.
+#define PAGE_MAP_LEAF_BITS 18
+#define PAGE_MAP_ROOT_BITS (47 - PAGE_MAP_SHIFT - PAGE_MAP_LEAF_BITS)  // 47-bit user space
+
+struct PageMapLeaf {
+    PageMapEntry entries[1 << PAGE_MAP_LEAF_BITS];
+};
+
+static std::atomic<PageMapLeaf*> page_map[1 << PAGE_MAP_ROOT_BITS];
+static std::mutex page_map_lock;
+
+// Metadata (arena and slab descriptors) lives outside the arenas in a small
+// bump region; freed descriptors are recycled through per-type free lists
+static void* arena_descriptor_free_list = nullptr;
+static void* slab_descriptor_free_list = nullptr;
+static char* meta_cursor = nullptr;
+static char* meta_end = nullptr;
+static std::mutex meta_lock;
+
+// Huge allocations: open-addressing table keyed by mapping address
+static HugeAllocation* huge_table = nullptr;
+static size_t huge_capacity = 0;  // Power of two (0 until first use)
+static size_t huge_count = 0;
+static size_t huge_bytes = 0;  // Mapped by live huge allocations
+static uint64_t huge_alloc_calls = 0;
+static uint64_t huge_free_calls = 0;
+static std::mutex huge_lock;
+
+// Freed huge mappings munmap refused to release (ENOMEM: splitting a VMA
+// would pass vm.max_map_count). Their pages are dropped, each links the
+// next from its own first bytes, and later frees retry the unmap.
+struct PendingUnmap {
+    PendingUnmap* next;
+    size_t size;
+};
+static PendingUnmap* huge_pending = nullptr;
+static std::atomic<size_t> huge_pending_bytes(0);
+
+// Tracing: records are buffered under trace_lock and written out in bulk
+static std::atomic<bool> tracing_enabled(false);
+static std::mutex trace_lock;
+static int trace_fd = -1;
+static TraceRecord* trace_buffer = nullptr;
+static size_t trace_count = 0;
+static uint64_t trace_start_ns = 0;
+static std::atomic<uint32_t> trace_thread_count(0);
+static thread_local uint32_t trace_thread __attribute__((tls_model("initial-exec"))) = 0;
+
+// Heap profiling: each thread counts down the bytes to its next sample.
+// Samples and their stacks are kept under profile_lock; my_free only takes
+// it when profile_filter says the pointer may have been sampled.
+static std::atomic<bool> profiling_enabled(false);
+static std::atomic<size_t> profile_interval(PROFILE_SAMPLE_INTERVAL);
+static std::atomic<size_t> profile_live(0);  // Entries in profile_samples
+static std::atomic<uint16_t> profile_filter[1 << PROFILE_FILTER_BITS];
+static std::mutex profile_lock;
+static ProfileBucket* profile_buckets[PROFILE_BUCKET_SLOTS];
+static ProfileSample* profile_samples = nullptr;
+static size_t profile_capacity = 0;  // Power of two (0 until first sample)
+static const char* profile_exit_path = nullptr;
+static thread_local int64_t sample_countdown __attribute__((tls_model("initial-exec"))) = 0;
+static thread_local uint64_t sample_rng __attribute__((tls_model("initial-exec"))) = 0;
+static thread_local bool in_profiler __attribute__((tls_model("initial-exec"))) = false;
+
+// Scavenger: a pass runs at most once per decay period, from the free path
+// or the optional background thread
+static std::atomic<long> scavenge_decay_ms(SCAVENGE_DECAY_MS);
+static std::atomic<uint64_t> next_scavenge_ns(0);
+static std::atomic<bool> scavenger_running(false);
+static pthread_t scavenger_thread;
+
+// Huge pages for slab arenas mapped from now on
+static std::atomic<int> huge_page_mode(HUGE_PAGES_OFF);
+
+// Fit policy given to variable-size pools when they are set up
+static std::atomic<int> default_fit_policy(FIT_GOOD);
+
+// Tunables of the control interface (my_allocctl, MYALLOC_CONF): magazine
+// limits, the first arena of each pool, and per-CPU mode asked for before
+// init
+static std::atomic<uint32_t> tcache_max(TCACHE_MAGAZINE_SIZE);
+static std::atomic<uint32_t> tcache_batch(TCACHE_BATCH_SIZE);
+static size_t initial_arena_size[STATS_POOL_HUGE] = {SMALL_POOL_SIZE, MEDIUM_POOL_SIZE,
+                                                     LARGE_POOL_SIZE, LARGE_POOL_SIZE};
+static bool percpu_requested = false;
+
+// Per-CPU caches: one PerCpuCache per possible CPU, mapped the first time
+// the mode is turned on and never unmapped. Each thread finds its rseq
+// area once (rseq_unavailable marks threads without one).
+static std::atomic<bool> percpu_enabled(false);
+static PerCpuCache* percpu_caches = nullptr;
+static int percpu_cpu_count = 0;
+static struct rseq rseq_unavailable;
+static thread_local struct rseq* thread_rseq __attribute__((tls_model("initial-exec"))) = nullptr;
+
+static void init_size_classes(NodePools* node);
+static int highest_listed_id(const char* path);
+static int detect_numa_nodes();
+static int current_node(bool refresh);
+static void bind_to_node(void* memory, size_t size, int node);
+static int collect_pools(MemoryPool** pools);
+static void tcache_thread_exit(void* arg);
+static void stats_thread_exit(void* arg);
+static void thread_cache_release(ThreadCache* cache);
+static void log_message(bool always, const char* format, ...);
+static void finish_first_init();
+static bool page_map_set(void* start, size_t size, const PageMapEntry& entry);
+static void* meta_alloc(void** free_list, size_t size);
+static void meta_free(void** free_list, void* ptr);
+static size_t block_size(const BlockHeader* header);
+static bool block_is_free(const BlockHeader* header);
+static BlockHeader* first_block(Arena* arena);
+static void free_lists_reset(MemoryPool* pool);
+static BlockHeader* find_fit(MemoryPool* pool, size_t size);
+static uint64_t monotonic_ns();
+static void scavenge_tick();
+static bool percpu_setup();
+static void percpu_release_all();
+static void ctl_apply_config(const char* config);
+static void huge_retry_unmaps();
+static void profile_warm_up();
+static void profile_clear_samples();
 
 // ============================================================================
 // INITIALIZATION & CLEANUP
@@ -26,18 +193,118 @@ void allocator_init() {
     // Initialize all memory pools
     // This sets up separate pools for different size classes
     
-    if (allocator_initialized) {
+    if (allocator_initialized.load(std::memory_order_acquire)) {
         return;  // Already initialized
     }
     
-    // Initialize each pool with its size and max block size
-    init_pool(&small_pool, SMALL_POOL_SIZE, SMALL_BLOCK_MAX);
-    init_pool(&medium_pool, MEDIUM_POOL_SIZE, MEDIUM_BLOCK_MAX);
-    init_pool(&large_pool, LARGE_POOL_SIZE, LARGE_BLOCK_MAX);
-    init_pool(&xlarge_pool, LARGE_POOL_SIZE, SIZE_MAX);  // No max for xlarge
+    // Several threads may race to the first my_malloc(). Nothing in here may
+    // allocate: under LD_PRELOAD that would re-enter my_malloc.
+    std::unique_lock<std::mutex> guard(init_lock);
+    if (allocator_initialized.load(std::memory_order_relaxed)) {
+        return;
+    }
+    
+    const char* verbose_env = getenv("MYALLOC_VERBOSE");
+    if (verbose_env != nullptr && verbose_env[0] == '1') {
+        verbose_logging = true;
+    }
+    
+    const char* huge_env = getenv("MYALLOC_HUGEPAGES");
+    if (huge_env != nullptr && strcmp(huge_env, "thp") == 0) {
+        huge_page_mode.store(HUGE_PAGES_THP, std::memory_order_relaxed);
+    } else if (huge_env != nullptr && strcmp(huge_env, "hugetlb") == 0) {
+        huge_page_mode.store(HUGE_PAGES_HUGETLB, std::memory_order_relaxed);
+    }
+    
+    const char* decay_env = getenv("MYALLOC_DECAY_MS");
+    if (decay_env != nullptr && decay_env[0] != '\0') {
+        scavenge_decay_ms.store(strtol(decay_env, nullptr, 10), std::memory_order_relaxed);
+    }
+    
+    const char* fit_env = getenv("MYALLOC_FIT");
+    if (fit_env != nullptr && strcmp(fit_env, "good") == 0) {
+        default_fit_policy.store(FIT_GOOD, std::memory_order_relaxed);
+    } else if (fit_env != nullptr && strcmp(fit_env, "best") == 0) {
+        default_fit_policy.store(FIT_BEST, std::memory_order_relaxed);
+    } else if (fit_env != nullptr && strcmp(fit_env, "address") == 0) {
+        default_fit_policy.store(FIT_ADDRESS, std::memory_order_relaxed);
+    }
+    
+    const char* percpu_env = getenv("MYALLOC_PERCPU");
+    if (percpu_env != nullptr && percpu_env[0] == '1') {
+        percpu_requested = true;
+    }
+    
+    // MYALLOC_CONF comes last, so its keys win over the variables above
+    ctl_apply_config(getenv("MYALLOC_CONF"));
+    
+    // Thread caches are flushed back to the pools when their thread exits
+    if (!tcache_key_created) {
+        pthread_key_create(&tcache_key, tcache_thread_exit);
+        tcache_key_created = true;
+    }
+    if (!stats_key_created) {
+        pthread_key_create(&stats_key, stats_thread_exit);
+        stats_key_created = true;
+    }
+    
+    // Initialize each node's pools with their size and max block size
+    // Small, medium and large requests are carved from slabs; only xlarge
+    // keeps variable-size blocks with headers
+    numa_node_count = detect_numa_nodes();
+    for (int n = 0; n < numa_node_count; n++) {
+        NodePools* node = &nodes[n];
+        node->small_pool.node = node->medium_pool.node = n;
+        node->large_pool.node = node->xlarge_pool.node = n;
+        
+        init_slab_pool(&node->small_pool, initial_arena_size[STATS_POOL_SMALL],
+                       SMALL_BLOCK_MAX, SMALL_SLAB_SIZE);
+        init_slab_pool(&node->medium_pool, initial_arena_size[STATS_POOL_MEDIUM],
+                       MEDIUM_BLOCK_MAX, MEDIUM_SLAB_SIZE);
+        init_slab_pool(&node->large_pool, initial_arena_size[STATS_POOL_LARGE],
+                       LARGE_BLOCK_MAX, LARGE_SLAB_SIZE);
+        init_pool(&node->xlarge_pool, initial_arena_size[STATS_POOL_XLARGE],
+                  SIZE_MAX);  // No max for xlarge
+        
+        init_size_classes(node);
+    }
+    
+    if (percpu_requested) {
+        percpu_setup();
+    }
+    
+    allocator_initialized.store(true, std::memory_order_release);
+    log_message(false, "Allocator initialized\n");
     
-    allocator_initialized = true;
-    std::cout << "Allocator initialized\n";
+    // Setup that may itself allocate happens outside init_lock
+    guard.unlock();
+    finish_first_init();
+}
+
+void allocator_set_verbose(bool verbose) {
+    verbose_logging = verbose;
+}
+
+void allocator_set_decay_ms(long decay_ms) {
+    scavenge_decay_ms.store(decay_ms, std::memory_order_relaxed);
+}
+
+void allocator_set_huge_pages(HugePageMode mode) {
+    huge_page_mode.store(mode, std::memory_order_relaxed);
+}
+
+void allocator_set_fit_policy(FitPolicy policy) {
+    default_fit_policy.store(policy, std::memory_order_relaxed);
+}
+
+bool allocator_set_percpu_cache(bool enable) {
+    allocator_init();
+    if (!enable) {
+        percpu_enabled.store(false, std::memory_order_relaxed);
+        return false;
+    }
+    std::lock_guard<std::mutex> guard(init_lock);
+    return percpu_setup();
 }
 
 void allocator_cleanup() {
@@ -48,41 +315,86 @@ void allocator_cleanup() {
         return;
     }
     
+    // The background scavenger must not walk pools we are about to unmap
+    if (scavenger_running.exchange(false)) {
+        pthread_join(scavenger_thread, nullptr);
+    }
+    
+    // Give cached blocks back first so they are not reported as leaks:
+    // per-CPU caches, then the calling thread's. Other threads must have
+    // exited (and flushed) by now, but blocks freed into their caches'
+    // remote lists since then still need returning.
+    // Draining one cache can forward a block to another whose slab changed
+    // hands, so repeat until every remote list stays empty.
+    percpu_release_all();
+    thread_cache_flush();
+    {
+        std::lock_guard<std::mutex> guard(cache_list_lock);
+        bool pending = true;
+        while (pending) {
+            pending = false;
+            for (ThreadCache* cache = cache_free_list; cache != nullptr; cache = cache->next_free) {
+                thread_cache_release(cache);
+            }
+            for (ThreadCache* cache = cache_free_list; cache != nullptr; cache = cache->next_free) {
+                for (int i = 0; i < NUM_SIZE_CLASSES; i++) {
+                    pending |= cache->remote_free[i].load(std::memory_order_relaxed) != nullptr;
+                }
+            }
+        }
+    }
+    
     // Step 1: Check for memory leaks (unfreed blocks)
     // Walk through all pools and count allocated blocks
     size_t total_allocated = 0;
     size_t leak_count = 0;
     
-    MemoryPool* pools[] = {&small_pool, &medium_pool, &large_pool, &xlarge_pool};
+    MemoryPool* pools[MAX_NUMA_NODES * 4];
+    int pool_count = collect_pools(pools);
     
-    for (int i = 0; i < 4; i++) {
+    for (int i = 0; i < pool_count; i++) {
         MemoryPool* pool = pools[i];
         
-        if (pool->pool_start == nullptr) {
-            continue;  // Pool not initialized
-        }
-        
-        // Walk through the entire pool looking for allocated blocks
-        uintptr_t pool_start = (uintptr_t)pool->pool_start;
-        uintptr_t pool_end = pool_start + pool->pool_size;
-        uintptr_t current = pool_start;
-        
-        while (current < pool_end) {
-            BlockHeader* header = (BlockHeader*)current;
-            
-            // Check if this is a valid block (not past pool end)
-            if (current + header->size > pool_end) {
-                break;  // Invalid block, stop scanning
+        for (Arena* arena = pool->arenas; arena != nullptr; arena = arena->next) {
+            // Slab pools: every used slot of every carved slab is a leak.
+            // Only the newest arena can be partially carved.
+            if (pool->slab_size != 0) {
+                char* carved_end = (arena == pool->arenas) ? pool->slab_cursor
+                                                           : arena->start + arena->size;
+                for (char* slab_addr = arena->start; slab_addr < carved_end;
+                     slab_addr += pool->slab_size) {
+                    SlabHeader* slab = get_slab(slab_addr);
+                    if (slab->used > 0) {
+                        total_allocated += slab->used * size_class_size(slab->class_index);
+                        leak_count += slab->used;
+                    }
+                }
+                continue;
             }
             
-            // Check if block is allocated (not free)
-            if (!header->is_free) {
-                total_allocated += header->size;
+            // Walk through the arena looking for allocated blocks; the
+            // zero-size fence block marks its end
+            BlockHeader* header = first_block(arena);
+            while (block_size(header) != 0) {
+                // Check if block is allocated (not free)
+                if (!block_is_free(header)) {
+                    total_allocated += block_size(header);
+                    leak_count++;
+                }
+                
+                // Move to next block
+                header = (BlockHeader*)((char*)header + block_size(header));
+            }
+        }
+    }
+    
+    {
+        std::lock_guard<std::mutex> guard(huge_lock);
+        for (size_t i = 0; i < huge_capacity; i++) {
+            if (huge_table[i].ptr != nullptr) {
+                total_allocated += huge_table[i].size;
                 leak_count++;
             }
-            
-            // Move to next block
-            current += header->size;
         }
     }
     
@@ -95,25 +407,78 @@ void allocator_cleanup() {
         std::cout << "✓ No memory leaks detected\n";
     }
     
-    // Step 2: Unmap/deallocate all pools using munmap()
-    if (small_pool.pool_start != nullptr && small_pool.pool_start != MAP_FAILED) {
-        munmap(small_pool.pool_start, small_pool.pool_size);
-        small_pool.pool_start = nullptr;
+    // Step 2: Unmap/deallocate every arena of every pool using munmap()
+    for (int i = 0; i < pool_count; i++) {
+        MemoryPool* pool = pools[i];
+        Arena* arena = pool->arenas;
+        
+        while (arena != nullptr) {
+            Arena* next = arena->next;
+            
+            // Recycle the descriptors of every slab carved from this arena
+            if (pool->slab_size != 0) {
+                char* carved_end = (arena == pool->arenas) ? pool->slab_cursor
+                                                           : arena->start + arena->size;
+                for (char* slab_addr = arena->start; slab_addr < carved_end;
+                     slab_addr += pool->slab_size) {
+                    meta_free(&slab_descriptor_free_list, get_slab(slab_addr));
+                }
+            }
+            
+            page_map_set(arena->start, arena->size, PageMapEntry());
+            munmap(arena->start, arena->size);
+            meta_free(&arena_descriptor_free_list, arena);
+            arena = next;
+        }
+        
+        pool->arenas = nullptr;
+        pool->pool_size = 0;
+    }
+    
+    // Huge allocations still mapped are leaks too; unmap them
+    {
+        std::lock_guard<std::mutex> guard(huge_lock);
+        for (size_t i = 0; i < huge_capacity; i++) {
+            if (huge_table[i].ptr != nullptr) {
+                page_map_set(huge_table[i].ptr, 1, PageMapEntry());
+                munmap(huge_table[i].ptr, huge_table[i].size);
+                huge_table[i].ptr = nullptr;
+            }
+        }
+        huge_count = 0;
+        huge_bytes = 0;
+        huge_alloc_calls = 0;
+        huge_free_calls = 0;
     }
+    huge_retry_unmaps();
     
-    if (medium_pool.pool_start != nullptr && medium_pool.pool_start != MAP_FAILED) {
-        munmap(medium_pool.pool_start, medium_pool.pool_size);
-        medium_pool.pool_start = nullptr;
+    // Sampled objects went with the pools
+    {
+        std::lock_guard<std::mutex> guard(profile_lock);
+        profile_clear_samples();
     }
     
-    if (large_pool.pool_start != nullptr && large_pool.pool_start != MAP_FAILED) {
-        munmap(large_pool.pool_start, large_pool.pool_size);
-        large_pool.pool_start = nullptr;
+    // Counts start over with the pools
+    {
+        std::lock_guard<std::mutex> guard(stats_lock);
+        for (ThreadStats* stats = stats_list; stats != nullptr; stats = stats->next) {
+            for (int i = 0; i < NUM_SIZE_CLASSES; i++) {
+                stats->allocs[i].store(0, std::memory_order_relaxed);
+                stats->frees[i].store(0, std::memory_order_relaxed);
+            }
+        }
     }
     
-    if (xlarge_pool.pool_start != nullptr && xlarge_pool.pool_start != MAP_FAILED) {
-        munmap(xlarge_pool.pool_start, xlarge_pool.pool_size);
-        xlarge_pool.pool_start = nullptr;
+    // Size classes and pools point at slabs that no longer exist
+    for (int n = 0; n < numa_node_count; n++) {
+        for (int i = 0; i < NUM_SIZE_CLASSES; i++) {
+            nodes[n].size_classes[i].partial = nullptr;
+            nodes[n].size_classes[i].slab_count = 0;
+        }
+    }
+    for (int i = 0; i < pool_count; i++) {
+        pools[i]->free_slabs = nullptr;
+        pools[i]->free_slab_count = 0;
     }
     
     // Step 3: Mark allocator as uninitialized
@@ -121,6 +486,123 @@ void allocator_cleanup() {
     std::cout << "Allocator cleaned up\n";
 }
 
+static void log_message(bool always, const char* format, ...) {
+    // Format into a stack buffer and write(2) it: iostreams and stdio may
+    // allocate, and this runs while the allocator itself is initializing
+    if (!always && !verbose_logging) {
+        return;
+    }
+    
+    char buffer[256];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (length <= 0) {
+        return;
+    }
+    
+    size_t remaining = (size_t)length < sizeof(buffer) ? (size_t)length : sizeof(buffer) - 1;
+    const char* cursor = buffer;
+    while (remaining > 0) {
+        ssize_t written = write(STDERR_FILENO, cursor, remaining);
+        if (written <= 0) {
+            return;
+        }
+        cursor += written;
+        remaining -= written;
+    }
+}
+
+// Fork handlers: hold every allocator lock across fork() so the child never
+// inherits a lock owned by a thread that does not exist there. The order
+// matches the nesting used elsewhere (pool -> stats -> huge -> page map ->
+// metadata).
+static void fork_prepare() {
+    trace_lock.lock();
+    profile_lock.lock();
+    init_lock.lock();
+    cache_list_lock.lock();
+    for (int n = 0; n < numa_node_count; n++) {
+        nodes[n].small_pool.lock.lock();
+        nodes[n].medium_pool.lock.lock();
+        nodes[n].large_pool.lock.lock();
+        nodes[n].xlarge_pool.lock.lock();
+    }
+    stats_lock.lock();
+    huge_lock.lock();
+    page_map_lock.lock();
+    meta_lock.lock();
+}
+
+static void fork_release() {
+    meta_lock.unlock();
+    page_map_lock.unlock();
+    huge_lock.unlock();
+    stats_lock.unlock();
+    for (int n = numa_node_count - 1; n >= 0; n--) {
+        nodes[n].xlarge_pool.lock.unlock();
+        nodes[n].large_pool.lock.unlock();
+        nodes[n].medium_pool.lock.unlock();
+        nodes[n].small_pool.lock.unlock();
+    }
+    cache_list_lock.unlock();
+    init_lock.unlock();
+    profile_lock.unlock();
+    trace_lock.unlock();
+}
+
+static void fork_child() {
+    // Only the forking thread survives; a new scavenger can be started
+    scavenger_running.store(false, std::memory_order_relaxed);
+    
+    // The child must not append to the parent's trace file
+    if (trace_fd >= 0) {
+        close(trace_fd);
+        trace_fd = -1;
+        trace_count = 0;
+        tracing_enabled.store(false, std::memory_order_relaxed);
+    }
+    
+    // Nor overwrite the parent's profile when it exits
+    profile_exit_path = nullptr;
+    fork_release();
+}
+
+static void trace_stop_at_exit() {
+    allocator_trace_stop();
+}
+
+static void profile_dump_at_exit() {
+    if (profile_exit_path != nullptr) {
+        allocator_profile_dump(profile_exit_path);
+    }
+}
+
+static void finish_first_init() {
+    // Runs once, after the first allocator_init releases init_lock
+    bool expected = false;
+    if (!first_init_finished.compare_exchange_strong(expected, true)) {
+        return;
+    }
+    
+    pthread_atfork(fork_prepare, fork_release, fork_child);
+    
+    const char* trace_path = getenv("MYALLOC_TRACE");
+    if (trace_path != nullptr && trace_path[0] != '\0' && allocator_trace_start(trace_path)) {
+        atexit(trace_stop_at_exit);
+    }
+    
+    const char* profile_path = getenv("MYALLOC_PROFILE");
+    if (profile_path != nullptr && profile_path[0] != '\0') {
+        allocator_profile_start(0);
+        profile_exit_path = profile_path;
+        atexit(profile_dump_at_exit);
+    } else if (profiling_enabled.load(std::memory_order_relaxed)) {
+        profile_warm_up();  // Started by MYALLOC_CONF
+    }
+}
+
 // ============================================================================
 // UTILITY FUNCTIONS
 // ============================================================================
@@ -129,8 +611,8 @@ size_t align_size(size_t size) {
     // Round up size to nearest multiple of ALIGNMENT
     // Formula: (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1)
     // This adds (ALIGNMENT - 1) to size, then clears the lower bits
-    // Example: if ALIGNMENT is 8, then:
-    //   7 -> 8,  8 -> 8,  9 -> 16,  15 -> 16
+    // Example: if ALIGNMENT is 16, then:
+    //   15 -> 16,  16 -> 16,  17 -> 32,  31 -> 32
     
     if (size == 0) {
         return ALIGNMENT;  // Minimum aligned size
@@ -139,6 +621,35 @@ size_t align_size(size_t size) {
     return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
 }
 
+static int highest_listed_id(const char* path) {
+    // Highest number in a sysfs id list ("0", "0-1", "0-3,8"...), or -1 if
+    // it cannot be read. Read with open/read rather than stdio, which
+    // would allocate.
+    
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    char buffer[256];
+    ssize_t length = read(fd, buffer, sizeof(buffer) - 1);
+    close(fd);
+    if (length <= 0) {
+        return -1;
+    }
+    
+    int highest = 0;
+    int number = 0;
+    for (ssize_t i = 0; i < length; i++) {
+        if (buffer[i] >= '0' && buffer[i] <= '9') {
+            number = number * 10 + (buffer[i] - '0');
+        } else {
+            highest = number > highest ? number : highest;
+            number = 0;
+        }
+    }
+    return number > highest ? number : highest;
+}
+
 BlockHeader* get_header(void* ptr) {
     // Given a user pointer, return the block header
     // The header is stored BEFORE the user pointer
@@ -163,496 +674,4415 @@ void* get_user_ptr(BlockHeader* header) {
     return (void*)((char*)header + sizeof(BlockHeader));
 }
 
-MemoryPool* select_pool(size_t size) {
-    // TODO: Implement pool selection
-    // Return the appropriate pool based on size
-    
+static MemoryPool* select_node_pool(NodePools* node, size_t size) {
     if (size <= SMALL_BLOCK_MAX) {
-        return &small_pool;
+        return &node->small_pool;
     } else if (size <= MEDIUM_BLOCK_MAX) {
-        return &medium_pool;
+        return &node->medium_pool;
     } else if (size <= LARGE_BLOCK_MAX) {
-        return &large_pool;
+        return &node->large_pool;
     } else {
-        return &xlarge_pool;
+        return &node->xlarge_pool;
+    }
+}
+
+MemoryPool* select_pool(size_t size) {
+    // Return the appropriate pool based on size, on the local node
+    return select_node_pool(&nodes[current_node(false)], size);
+}
+
+// Header word accessors: the low ALIGNMENT bits of the size are flags
+
+static size_t block_size(const BlockHeader* header) {
+    return header->size_and_flags & ~BLOCK_FLAG_MASK;
+}
+
+static bool block_is_free(const BlockHeader* header) {
+    return (header->size_and_flags & BLOCK_FREE) != 0;
+}
+
+static void set_block_size(BlockHeader* header, size_t size) {
+    header->size_and_flags = size | (header->size_and_flags & BLOCK_FLAG_MASK);
+}
+
+static FreeBlockLinks* block_links(BlockHeader* header) {
+    return (FreeBlockLinks*)((char*)header + sizeof(BlockHeader));
+}
+
+static size_t block_total_size(size_t size) {
+    // Block size for a user request: header plus payload, aligned, and big
+    // enough to hold the links and footer once it is freed
+    size_t total = align_size(size + sizeof(BlockHeader));
+    return total < MIN_BLOCK_SIZE ? MIN_BLOCK_SIZE : total;
+}
+
+static BlockHeader* first_block(Arena* arena) {
+    // Blocks start one header short of an ALIGNMENT boundary so that every
+    // user pointer (header + 8) lands on one
+    return (BlockHeader*)(arena->start + ALIGNMENT - sizeof(BlockHeader));
+}
+
+static BlockHeader* get_next_block(MemoryPool* /* pool */, BlockHeader* header) {
+    // Physically next block, or NULL if the next one is the arena's fence
+    BlockHeader* next = (BlockHeader*)((char*)header + block_size(header));
+    if (block_size(next) == 0) {
+        return nullptr;
+    }
+    return next;
+}
+
+static BlockHeader* get_prev_free_block(MemoryPool* /* pool */, BlockHeader* header) {
+    // Physically previous block via its footer, or NULL if it is allocated
+    // (allocated blocks keep no footer) or there is none
+    if ((header->size_and_flags & BLOCK_PREV_FREE) == 0) {
+        return nullptr;
     }
+    size_t prev_size = *(size_t*)((char*)header - sizeof(size_t));
+    return (BlockHeader*)((char*)header - prev_size);
+}
+
+static void mark_block_free(BlockHeader* header) {
+    // Set the free bit, write the footer and tell the next block (possibly
+    // the fence) that its predecessor is free
+    size_t size = block_size(header);
+    header->size_and_flags |= BLOCK_FREE;
+    *(size_t*)((char*)header + size - sizeof(size_t)) = size;
+    BlockHeader* next = (BlockHeader*)((char*)header + size);
+    next->size_and_flags |= BLOCK_PREV_FREE;
+}
+
+static void mark_block_allocated(BlockHeader* header) {
+    header->size_and_flags &= ~(BLOCK_FREE | BLOCK_AGED | BLOCK_PURGED);
+    BlockHeader* next = (BlockHeader*)((char*)header + block_size(header));
+    next->size_and_flags &= ~BLOCK_PREV_FREE;
 }
 
 // ============================================================================
 // POOL MANAGEMENT
 // ============================================================================
 
-void init_pool(MemoryPool* pool, size_t pool_size, size_t /* max_block_size */) {
-    // Initialize a memory pool by allocating memory and creating initial free block
+void init_pool(MemoryPool* pool, size_t pool_size, size_t max_block_size) {
+    // Initialize a memory pool by mapping its first arena
     
     if (pool == nullptr) {
         return;
     }
     
-    // Step 1: Allocate memory from the operating system using mmap()
-    // mmap() asks the OS for a chunk of memory
-    pool->pool_start = mmap(NULL, pool_size, PROT_READ | PROT_WRITE, 
-                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    // Step 1: Store the pool parameters
+    pool->arenas = nullptr;
+    pool->pool_size = 0;
+    pool->next_arena_size = pool_size;
+    pool->max_block_size = max_block_size;
+    pool->fit_policy = (uint8_t)default_fit_policy.load(std::memory_order_relaxed);
+    free_lists_reset(pool);
+    pool->slab_size = 0;  // Variable-size blocks, not slabs
+    pool->slab_cursor = nullptr;
+    pool->slab_end = nullptr;
+    pool->free_slabs = nullptr;
+    pool->huge_pages = false;
+    
+    // Step 2: Initialize statistics
+    pool->allocated_bytes = 0;
+    pool->free_bytes = 0;
+    pool->released_bytes = 0;
+    pool->free_slab_count = 0;
+    pool->free_block_count = 0;
+    pool->allocated_blocks = 0;
+    pool->alloc_calls = 0;
+    pool->free_calls = 0;
     
-    // Check if allocation failed
-    if (pool->pool_start == MAP_FAILED) {
-        std::cerr << "Failed to allocate pool memory\n";
+    // Step 3: Map the first arena; it becomes one big free block
+    if (grow_pool(pool, 0) == nullptr) {
+        log_message(true, "Failed to allocate pool memory\n");
         return;
     }
     
-    // Step 2: Store the pool size
-    pool->pool_size = pool_size;
-    
-    // Step 3: Create initial free block covering the entire pool
-    // The first block header goes at the start of the pool
-    BlockHeader* initial_block = (BlockHeader*)pool->pool_start;
-    
-    // Set up the initial block:
-    // - Size is the entire pool (we'll use it all as one big free block)
-    // - It's free (available for allocation)
-    // - No next free block yet (it's the only one)
-    initial_block->size = pool_size;
-    initial_block->is_free = true;
-    initial_block->next_free = nullptr;
-    
-    // Step 4: Initialize free list - point to this initial block
-    pool->free_list = initial_block;
-    
-    // Step 5: Initialize statistics
-    pool->allocated_bytes = 0;
-    pool->free_bytes = pool_size;
-    
-    std::cout << "Pool initialized: size=" << pool_size << "\n";
+    log_message(false, "Pool initialized: size=%zu\n", pool_size);
 }
 
-void* allocate_from_pool(MemoryPool* pool, size_t size) {
-    // Allocate memory from a specific pool
-    // This is the core allocation function
+static void* map_aligned(size_t size, size_t alignment) {
+    // mmap() only guarantees page alignment, so over-map by one alignment
+    // unit and trim the misaligned head and the unused tail
     
-    if (pool == nullptr) {
-        return nullptr;
+    size_t map_size = size + alignment;
+    void* memory = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        return MAP_FAILED;
     }
     
-    // Step 1: Align the requested size to 8-byte boundary
-    size_t aligned_size = align_size(size);
-    
-    // Calculate total size needed: user data + header, then align
-    size_t total_size_needed = aligned_size + sizeof(BlockHeader);
-    total_size_needed = align_size(total_size_needed);  // Align the total
+    uintptr_t start = (uintptr_t)memory;
+    uintptr_t aligned = (start + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    size_t head = aligned - start;
+    size_t tail = map_size - head - size;
     
-    // Step 2: Find a suitable free block using first-fit strategy
-    BlockHeader* block = find_first_fit(pool, total_size_needed);
-    
-    if (block == nullptr) {
-        // No suitable block found
-        return nullptr;
+    // A trim the kernel refuses (ENOMEM at vm.max_map_count) fails the
+    // whole mapping rather than leaving an untracked piece behind
+    if (head > 0 && munmap(memory, head) != 0) {
+        if (munmap(memory, map_size) != 0) {
+            log_message(true, "Warning: could not unmap %zu bytes\n", map_size);
+        }
+        return MAP_FAILED;
+    }
+    if (tail > 0 && munmap((void*)(aligned + size), tail) != 0) {
+        if (munmap((void*)aligned, size + tail) != 0) {
+            log_message(true, "Warning: could not unmap %zu bytes\n", size + tail);
+        }
+        return MAP_FAILED;
     }
     
-    // Step 3: Remove the block from the free list (we're about to use it)
-    remove_from_free_list(pool, block);
+    return (void*)aligned;
+}
+
+static void* map_huge_arena(size_t* size) {
+    // Try reserved huge pages, then transparent ones; *size grows to a
+    // whole number of huge pages. Returns MAP_FAILED only if even a
+    // regular mapping failed.
     
-    // Step 4: Check if we can split the block (if it's much larger than needed)
-    size_t original_size = block->size;
-    size_t min_split_size = total_size_needed + sizeof(BlockHeader) + ALIGNMENT;
+    size_t huge_size = (*size + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
     
-    if (original_size >= min_split_size) {
-        // Block is large enough to split - create a remainder block
-        // Update current block to use only what we need
-        block->size = total_size_needed;
-        
-        // Create a new free block from the remainder
-        BlockHeader* remainder = (BlockHeader*)((char*)block + total_size_needed);
-        remainder->size = original_size - total_size_needed;
-        remainder->is_free = true;
-        remainder->next_free = nullptr;
-        
-        // Add remainder to free list
-        add_to_free_list(pool, remainder);
-        
-        // Update statistics for the remainder
-        pool->free_bytes += remainder->size;
-    } else {
-        // Use the whole block (too small to split efficiently)
-        // block->size stays as original_size
+    if (huge_page_mode.load(std::memory_order_relaxed) == HUGE_PAGES_HUGETLB) {
+        void* memory = mmap(NULL, huge_size, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (memory != MAP_FAILED) {
+            *size = huge_size;
+            return memory;
+        }
+        log_message(false, "MAP_HUGETLB failed (no reserved huge pages); using THP\n");
     }
     
-    // Step 5: Mark the block as allocated
-    block->is_free = false;
-    block->next_free = nullptr;  // Not in free list anymore
-    
-    // Step 6: Update statistics
-    pool->allocated_bytes += block->size;
-    pool->free_bytes -= block->size;
-    
-    // Step 7: Return the user pointer (after the header)
-    return get_user_ptr(block);
+    // THP needs the range to be huge-page aligned to be backed by them
+    void* memory = map_aligned(huge_size, HUGE_PAGE_SIZE);
+    if (memory == MAP_FAILED) {
+        return map_aligned(*size, ARENA_CHUNK_SIZE);
+    }
+    if (madvise(memory, huge_size, MADV_HUGEPAGE) != 0) {
+        log_message(false, "MADV_HUGEPAGE failed (THP disabled); using regular pages\n");
+    }
+    *size = huge_size;
+    return memory;
 }
 
-void free_to_pool(MemoryPool* pool, BlockHeader* header) {
-    // Free a block back to its pool
-    // This makes the memory available for future allocations
+void init_slab_pool(MemoryPool* pool, size_t pool_size, size_t max_block_size,
+                    size_t slab_size) {
+    // Initialize a pool whose memory is handed out a slab at a time
     
-    if (pool == nullptr || header == nullptr) {
+    if (pool == nullptr) {
         return;
     }
     
-    // Step 1: Update statistics BEFORE marking as free
-    // (We need to know it was allocated to update stats correctly)
-    if (!header->is_free) {  // Only update if it was actually allocated
-        pool->allocated_bytes -= header->size;
-        pool->free_bytes += header->size;
-    }
+    // Step 1: Store the pool parameters
+    pool->arenas = nullptr;
+    pool->pool_size = 0;
+    pool->next_arena_size = pool_size;
+    pool->max_block_size = max_block_size;
+    pool->fit_policy = FIT_GOOD;  // Unused: slabs have no free blocks
+    free_lists_reset(pool);
+    pool->slab_size = slab_size;
+    pool->slab_cursor = nullptr;
+    pool->slab_end = nullptr;
+    pool->free_slabs = nullptr;
+    pool->huge_pages = false;
     
-    // Step 2: Mark block as free
-    header->is_free = true;
-    header->next_free = nullptr;  // Will be set when added to free list
+    // Step 2: Initialize statistics
+    pool->allocated_bytes = 0;
+    pool->free_bytes = 0;
+    pool->released_bytes = 0;
+    pool->free_slab_count = 0;
+    pool->free_block_count = 0;
+    pool->allocated_blocks = 0;
+    pool->alloc_calls = 0;
+    pool->free_calls = 0;
     
-    // Step 3: Add to free list (makes it available for allocation)
-    add_to_free_list(pool, header);
+    // Step 3: Map the first arena; slabs are carved lazily from its front
+    if (grow_pool(pool, 0) == nullptr) {
+        log_message(true, "Failed to allocate pool memory\n");
+        return;
+    }
     
-    // Note: Coalescing (merging adjacent free blocks) is optional
-    // and can be added later for better fragmentation reduction
+    log_message(false, "Slab pool initialized: size=%zu slab=%zu\n", pool_size, slab_size);
 }
 
-// ============================================================================
-// FREE LIST MANAGEMENT
-// ============================================================================
-
-void add_to_free_list(MemoryPool* pool, BlockHeader* header) {
-    // Add a block to the front of the free list
-    // This makes it quickly available for the next allocation
+static void* meta_alloc(void** free_list, size_t size) {
+    // Descriptors come from a small bump region so that arenas themselves
+    // stay fully usable and aligned
     
-    if (pool == nullptr || header == nullptr) {
-        return;
-    }
+    std::lock_guard<std::mutex> guard(meta_lock);
     
-    // Make sure the block is marked as free
-    header->is_free = true;
+    // Reuse a recycled descriptor (its first word links the free list)
+    if (*free_list != nullptr) {
+        void* ptr = *free_list;
+        *free_list = *(void**)ptr;
+        return ptr;
+    }
     
-    // Insert at the head of the free list
-    // The new block points to whatever was first
-    header->next_free = pool->free_list;
+    size = align_size(size);
+    if (meta_cursor == nullptr || meta_cursor + size > meta_end) {
+        void* memory = mmap(NULL, ARENA_CHUNK_SIZE, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) {
+            return nullptr;
+        }
+        meta_cursor = (char*)memory;
+        meta_end = meta_cursor + ARENA_CHUNK_SIZE;
+    }
     
-    // Update the pool's free_list to point to this new block
-    pool->free_list = header;
+    void* ptr = meta_cursor;
+    meta_cursor += size;
+    return ptr;
 }
 
-void remove_from_free_list(MemoryPool* pool, BlockHeader* header) {
-    // Remove a block from the free list
-    // This happens when we're about to allocate it
+static void meta_free(void** free_list, void* ptr) {
+    std::lock_guard<std::mutex> guard(meta_lock);
+    *(void**)ptr = *free_list;
+    *free_list = ptr;
+}
+
+Arena* grow_pool(MemoryPool* pool, size_t min_size) {
+    // Map another arena for a pool that ran out of space
     
-    if (pool == nullptr || header == nullptr) {
-        return;
+    // Step 1: Pick the size - the geometric schedule, unless the request
+    // needs more (room for the arena's fence block included)
+    size_t size = pool->next_arena_size;
+    size_t needed = min_size + ALIGNMENT;
+    if (size < needed) {
+        size = (needed + ARENA_CHUNK_SIZE - 1) & ~(size_t)(ARENA_CHUNK_SIZE - 1);
     }
     
-    // Case 1: Block is at the head of the free list
-    if (pool->free_list == header) {
-        // Just move the head to the next block
-        pool->free_list = header->next_free;
-        header->next_free = nullptr;
-        return;
+    // Step 2: Map it, aligned so slabs are aligned too. Slab pools may
+    // use huge pages; the variable-size pool keeps regular pages so the
+    // scavenger can release free pages inside its blocks.
+    void* memory;
+    if (pool->slab_size != 0 && huge_page_mode.load(std::memory_order_relaxed) != HUGE_PAGES_OFF) {
+        memory = map_huge_arena(&size);
+        pool->huge_pages = true;
+    } else {
+        memory = map_aligned(size, ARENA_CHUNK_SIZE);
     }
+    if (memory == MAP_FAILED) {
+        return nullptr;
+    }
+    bind_to_node(memory, size, pool->node);
     
-    // Case 2 & 3: Block is in the middle or at the tail
-    // We need to find the previous block and update its next pointer
-    BlockHeader* current = pool->free_list;
-    
-    // Walk through the list to find the block before 'header'
-    while (current != nullptr && current->next_free != header) {
-        current = current->next_free;
+    Arena* arena = (Arena*)meta_alloc(&arena_descriptor_free_list, sizeof(Arena));
+    if (arena == nullptr) {
+        munmap(memory, size);
+        return nullptr;
     }
     
-    // If we found the previous block, update its next pointer
-    if (current != nullptr) {
-        // Skip over 'header' by pointing to whatever header was pointing to
-        current->next_free = header->next_free;
-        header->next_free = nullptr;  // Clear the link
+    // Step 3: Chain it (newest first)
+    arena->start = (char*)memory;
+    arena->size = size;
+    arena->next = pool->arenas;
+    pool->arenas = arena;
+    pool->pool_size += size;
+    
+    if (pool->next_arena_size < ARENA_MAX_SIZE) {
+        pool->next_arena_size *= 2;
     }
-}
-
-BlockHeader* coalesce_blocks(MemoryPool* pool, BlockHeader* header) {
-    // TODO: Implement block coalescing
-    // 1. Check if previous block is free (if it exists)
-    // 2. Check if next block is free (if it exists)
-    // 3. Merge adjacent free blocks
-    // 4. Update sizes and pointers
     
-    if (pool == nullptr || header == nullptr) {
-        return header;
+    // Step 4a: Slab pools carve slabs from the new arena from now on; each
+    // slab registers its own pages when it is formatted
+    if (pool->slab_size != 0) {
+        pool->slab_cursor = arena->start;
+        pool->slab_end = arena->start + size;
+        pool->free_bytes += size;
+        return arena;
     }
     
-    // TODO: Find previous block (tricky - you need to track this)
-    // TODO: Find next block (easier - header + header->size)
-    // TODO: Merge if adjacent blocks are free
+    // Step 4b: Variable-size pools get one free block covering the arena,
+    // followed by a zero-size allocated fence so coalescing stops at the end.
+    // The first header sits after a pad word (see first_block), so the
+    // arena loses one ALIGNMENT unit to the pad and the fence.
+    PageMapEntry entry = PageMapEntry();
+    entry.pool = pool;
+    entry.kind = PAGE_BLOCK;
+    page_map_set(arena->start, size, entry);
     
-    return header;  // Return coalesced block
+    BlockHeader* block = first_block(arena);
+    block->size_and_flags = size - ALIGNMENT;  // First block: no predecessor
+    
+    BlockHeader* fence = (BlockHeader*)((char*)block + block_size(block));
+    fence->size_and_flags = 0;
+    
+    mark_block_free(block);
+    add_to_free_list(pool, block);
+    pool->free_bytes += block_size(block);
+    return arena;
 }
 
 // ============================================================================
-// ALLOCATION STRATEGIES
+// PAGE MAP
 // ============================================================================
 
-BlockHeader* find_first_fit(MemoryPool* pool, size_t size) {
-    // Search the free list for the first block that's large enough
-    // "First fit" means we take the first block we find that fits
+static bool page_map_set(void* start, size_t size, const PageMapEntry& entry) {
+    // Copy entry into every page of [start, start + size)
     
-    if (pool == nullptr) {
-        return nullptr;
-    }
+    std::lock_guard<std::mutex> guard(page_map_lock);
     
-    // Start at the head of the free list
-    BlockHeader* current = pool->free_list;
+    uintptr_t first = (uintptr_t)start >> PAGE_MAP_SHIFT;
+    uintptr_t last = ((uintptr_t)start + size - 1) >> PAGE_MAP_SHIFT;
     
-    // Walk through the free list
-    while (current != nullptr) {
-        // Check if this block is free and large enough
-        if (current->is_free && current->size >= size) {
-            // Found a suitable block!
-            return current;
+    for (uintptr_t page = first; page <= last; page++) {
+        uintptr_t root_index = page >> PAGE_MAP_LEAF_BITS;
+        uintptr_t leaf_index = page & ((1 << PAGE_MAP_LEAF_BITS) - 1);
+        
+        PageMapLeaf* leaf = page_map[root_index].load(std::memory_order_relaxed);
+        if (leaf == nullptr) {
+            if (entry.kind == PAGE_UNUSED) {
+                continue;  // Nothing registered here
+            }
+            // Fresh anonymous pages are zero, i.e. every entry starts unused.
+            // Only the pages of the leaf we actually write become resident.
+            void* memory = mmap(NULL, sizeof(PageMapLeaf), PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (memory == MAP_FAILED) {
+                return false;
+            }
+            leaf = (PageMapLeaf*)memory;
+            page_map[root_index].store(leaf, std::memory_order_release);
         }
         
-        // Move to the next free block
-        current = current->next_free;
+        leaf->entries[leaf_index] = entry;
     }
     
-    // No suitable block found
-    return nullptr;
+    return true;
 }
 
-BlockHeader* find_best_fit(MemoryPool* pool, size_t /* size */) {
-    // TODO: Implement best-fit strategy
-    // Search free list for smallest block that's large enough
+PageMapEntry* page_map_lookup(void* ptr) {
+    // Two dependent loads: root entry, then leaf entry
     
-    if (pool == nullptr) {
-        return nullptr;
+    uintptr_t page = (uintptr_t)ptr >> PAGE_MAP_SHIFT;
+    uintptr_t root_index = page >> PAGE_MAP_LEAF_BITS;
+    if (root_index >= (1 << PAGE_MAP_ROOT_BITS)) {
+        return nullptr;  // Outside user address space
     }
     
-    // TODO: Iterate through free list
-    // TODO: Track the best (smallest suitable) block
-    // TODO: Return best block
+    PageMapLeaf* leaf = page_map[root_index].load(std::memory_order_acquire);
+    if (leaf == nullptr) {
+        return nullptr;
+    }
     
-    return nullptr;
+    return &leaf->entries[page & ((1 << PAGE_MAP_LEAF_BITS) - 1)];
 }
 
-BlockHeader* split_block(BlockHeader* header, size_t /* size */) {
-    // TODO: Implement block splitting
-    // If block is much larger than needed, split it
-    // Return the block that will be used
-    // Add the remainder to free list
+MemoryPool* lookup_pool(void* ptr) {
+    PageMapEntry* entry = page_map_lookup(ptr);
+    return (entry != nullptr) ? entry->pool : nullptr;
+}
+
+// ============================================================================
+// ALLOCATION FROM POOLS
+// ============================================================================
+
+void* allocate_from_pool(MemoryPool* pool, size_t size) {
+    // Allocate memory from a specific pool
+    // This is the core allocation function
     
-    if (header == nullptr) {
+    if (pool == nullptr) {
         return nullptr;
     }
     
-    // TODO: Check if block is large enough to split
-    // (e.g., if remainder would be >= minimum block size)
-    // TODO: Create new header for remainder
-    // TODO: Update sizes
-    // TODO: Return original header (now with correct size)
+    // Step 1: Calculate total size needed: user data + header, aligned
+    size_t total_size_needed = block_total_size(size);
     
-    return header;
+    // Step 2: Find a suitable free block the way the pool's policy says
+    BlockHeader* block = find_fit(pool, total_size_needed);
+    
+    if (block == nullptr) {
+        // No suitable block found - map another arena and use its block
+        Arena* arena = grow_pool(pool, total_size_needed);
+        if (arena == nullptr) {
+            return nullptr;
+        }
+        block = first_block(arena);  // One free block spans a new arena
+    }
+    
+    // Step 3: Remove the block from the free list (we're about to use it)
+    remove_from_free_list(pool, block);
+    
+    // Step 4: Mark the block as allocated (before splitting, so the
+    // remainder does not merge straight back into it)
+    mark_block_allocated(block);
+    
+    // Step 5: Split the block if it's much larger than needed
+    block = split_block(pool, block, total_size_needed);
+    
+    // Step 6: Update statistics
+    pool->allocated_bytes += block_size(block);
+    pool->free_bytes -= block_size(block);
+    pool->allocated_blocks++;
+    pool->alloc_calls++;
+    
+    // Step 7: Return the user pointer (after the header)
+    return get_user_ptr(block);
+}
+
+void* allocate_aligned_from_pool(MemoryPool* pool, size_t size, size_t alignment) {
+    // Allocate a block whose user pointer is a multiple of alignment (a
+    // power of two above ALIGNMENT) by carving it out of a larger free block
+    
+    if (pool == nullptr) {
+        return nullptr;
+    }
+    
+    // Step 1: Find a block with room for the worst-case distance to an
+    // aligned user pointer that leaves a leading fragment of a usable size
+    size_t total_size_needed = block_total_size(size);
+    size_t search_size = total_size_needed + alignment + MIN_BLOCK_SIZE;
+    BlockHeader* block = find_fit(pool, search_size);
+    
+    if (block == nullptr) {
+        Arena* arena = grow_pool(pool, search_size);
+        if (arena == nullptr) {
+            return nullptr;
+        }
+        block = first_block(arena);
+    }
+    
+    remove_from_free_list(pool, block);
+    
+    // Step 2: Pick the first aligned user pointer in the block that leaves
+    // either no leading fragment or one big enough to be a free block
+    uintptr_t user = (uintptr_t)get_user_ptr(block);
+    uintptr_t aligned = (user + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    while (aligned != user && aligned - user < MIN_BLOCK_SIZE) {
+        aligned += alignment;
+    }
+    
+    // Step 3: Give the leading fragment back to the free lists. Its
+    // predecessor is allocated (free neighbours are always merged), so it
+    // needs no coalescing; it starts over as a fresh, unaged block
+    size_t lead = aligned - user;
+    if (lead > 0) {
+        BlockHeader* rest = (BlockHeader*)((char*)block + lead);
+        rest->size_and_flags = block_size(block) - lead;
+        set_block_size(block, lead);
+        block->size_and_flags &= ~(BLOCK_AGED | BLOCK_PURGED);
+        mark_block_free(block);
+        add_to_free_list(pool, block);
+        block = rest;
+    }
+    
+    // Step 4: Allocate and trim the aligned block as allocate_from_pool does
+    mark_block_allocated(block);
+    block = split_block(pool, block, total_size_needed);
+    
+    pool->allocated_bytes += block_size(block);
+    pool->free_bytes -= block_size(block);
+    pool->allocated_blocks++;
+    pool->alloc_calls++;
+    
+    return get_user_ptr(block);
+}
+
+void free_to_pool(MemoryPool* pool, BlockHeader* header) {
+    // Free a block back to its pool
+    // This makes the memory available for future allocations
+    
+    if (pool == nullptr || header == nullptr) {
+        return;
+    }
+    
+    // Step 1: Update statistics BEFORE marking as free
+    // (We need to know it was allocated to update stats correctly)
+    if (block_is_free(header)) {
+        return;  // Already free (double free)
+    }
+    pool->allocated_bytes -= block_size(header);
+    pool->free_bytes += block_size(header);
+    pool->allocated_blocks--;
+    pool->free_calls++;
+    
+    // Step 2: Merge with free physical neighbours so the pool does not
+    // fragment into blocks too small for larger requests (this also marks
+    // the result free)
+    header = coalesce_blocks(pool, header);
+    
+    // Step 3: Add to free list (makes it available for allocation)
+    add_to_free_list(pool, header);
 }
 
 // ============================================================================
-// PUBLIC API
+// FREE LIST MANAGEMENT
 // ============================================================================
 
-void* my_malloc(size_t size) {
-    // TODO: Implement main allocation function
-    // 1. Initialize allocator if needed
-    // 2. Handle zero-size requests
-    // 3. Select appropriate pool
-    // 4. Allocate from pool
-    // 5. Return pointer
+static void free_list_index(size_t size, int* fl, int* sl) {
+    // The list a block of this size belongs on: below TLSF_SMALL_SIZE one
+    // list per ALIGNMENT step, above it the power of two (fl) and the
+    // top TLSF_SL_LOG2 bits after the leading one (sl)
     
-    if (!allocator_initialized) {
-        allocator_init();
+    if (size < TLSF_SMALL_SIZE) {
+        *fl = 0;
+        *sl = (int)(size / (TLSF_SMALL_SIZE / TLSF_SL_COUNT));
+        return;
+    }
+    int log2 = 63 - __builtin_clzll(size);
+    *fl = log2 - TLSF_FL_SHIFT + 1;
+    *sl = (int)((size >> (log2 - TLSF_SL_LOG2)) & (TLSF_SL_COUNT - 1));
+    if (*fl >= TLSF_FL_COUNT) {
+        *fl = TLSF_FL_COUNT - 1;  // Beyond TLSF_FL_MAX: all share the last list
+        *sl = TLSF_SL_COUNT - 1;
     }
+}
+
+static BlockHeader* tree_insert(MemoryPool* pool, BlockHeader* root, BlockHeader* block);
+static BlockHeader* tree_remove(MemoryPool* pool, BlockHeader* root, BlockHeader* block);
+
+static void free_lists_reset(MemoryPool* pool) {
+    pool->free_tree = nullptr;
+    pool->fl_bitmap = 0;
+    memset(pool->sl_bitmap, 0, sizeof(pool->sl_bitmap));
+    memset(pool->free_lists, 0, sizeof(pool->free_lists));
+}
+
+void add_to_free_list(MemoryPool* pool, BlockHeader* header) {
+    // Add a block to the front of the list for its size
+    // This makes it quickly available for the next allocation
     
-    if (size == 0) {
-        return nullptr;  // or return a valid pointer to 0 bytes
+    if (pool == nullptr || header == nullptr) {
+        return;
     }
     
-    // TODO: Select pool and allocate
-    MemoryPool* pool = select_pool(size);
-    return allocate_from_pool(pool, size);
+    // Make sure the block is marked as free
+    header->size_and_flags |= BLOCK_FREE;
+    pool->free_block_count++;
+    
+    if (pool->fit_policy != FIT_GOOD) {
+        pool->free_tree = tree_insert(pool, pool->free_tree, header);
+        return;
+    }
+    
+    int fl;
+    int sl;
+    free_list_index(block_size(header), &fl, &sl);
+    BlockHeader** head = &pool->free_lists[fl][sl];
+    
+    // Insert at the head of the list
+    // The new block points to whatever was first
+    FreeBlockLinks* links = block_links(header);
+    links->next_free = *head;
+    links->prev_free = nullptr;
+    if (*head != nullptr) {
+        block_links(*head)->prev_free = header;
+    }
+    *head = header;
+    
+    // The list (and its row) are non-empty now
+    pool->fl_bitmap |= 1u << fl;
+    pool->sl_bitmap[fl] |= 1u << sl;
 }
 
-void my_free(void* ptr) {
-    // Main free function - frees memory allocated by my_malloc()
+void remove_from_free_list(MemoryPool* pool, BlockHeader* header) {
+    // Remove a block from its list
+    // This happens when we're about to allocate it or merge it
     
-    if (ptr == nullptr) {
-        return;  // Freeing NULL is safe (like standard free)
+    if (pool == nullptr || header == nullptr) {
+        return;
+    }
+    pool->free_block_count--;
+    
+    if (pool->fit_policy != FIT_GOOD) {
+        pool->free_tree = tree_remove(pool, pool->free_tree, header);
+        return;
     }
     
-    // Step 1: Get the block header from the user pointer
-    BlockHeader* header = get_header(ptr);
+    int fl;
+    int sl;
+    free_list_index(block_size(header), &fl, &sl);
+    BlockHeader** head = &pool->free_lists[fl][sl];
     
-    if (header == nullptr) {
-        return;  // Invalid pointer
+    // Unlink from the predecessor (or the list head)
+    FreeBlockLinks* links = block_links(header);
+    if (links->prev_free != nullptr) {
+        block_links(links->prev_free)->next_free = links->next_free;
+    } else if (*head == header) {
+        *head = links->next_free;
     }
     
-    // Step 2: Find which pool this block belongs to
-    // We check if the block's address is within each pool's range
-    MemoryPool* pool = nullptr;
+    // Unlink from the successor
+    if (links->next_free != nullptr) {
+        block_links(links->next_free)->prev_free = links->prev_free;
+    }
     
-    uintptr_t block_addr = (uintptr_t)header;
+    links->next_free = nullptr;
+    links->prev_free = nullptr;
     
-    // Check small pool
-    if (small_pool.pool_start != nullptr) {
-        uintptr_t pool_start = (uintptr_t)small_pool.pool_start;
-        uintptr_t pool_end = pool_start + small_pool.pool_size;
-        if (block_addr >= pool_start && block_addr < pool_end) {
-            pool = &small_pool;
+    // Clear the bitmap bits of a list (and row) that just emptied
+    if (*head == nullptr) {
+        pool->sl_bitmap[fl] &= ~(1u << sl);
+        if (pool->sl_bitmap[fl] == 0) {
+            pool->fl_bitmap &= ~(1u << fl);
         }
     }
+}
+
+// Free trees (FIT_BEST and FIT_ADDRESS pools): an AVL tree threaded
+// through the free blocks. Each node's height and subtree max_size are
+// recomputed bottom-up on the way back from every insert and remove.
+
+static FreeTreeNode* tree_node(BlockHeader* block) {
+    return (FreeTreeNode*)((char*)block + sizeof(BlockHeader));
+}
+
+static int tree_height(BlockHeader* block) {
+    return (block != nullptr) ? tree_node(block)->height : 0;
+}
+
+static size_t tree_max_size(BlockHeader* block) {
+    return (block != nullptr) ? tree_node(block)->max_size : 0;
+}
+
+static bool tree_less(MemoryPool* pool, BlockHeader* a, BlockHeader* b) {
+    // FIT_BEST orders by size, then address; FIT_ADDRESS by address
+    if (pool->fit_policy == FIT_BEST && block_size(a) != block_size(b)) {
+        return block_size(a) < block_size(b);
+    }
+    return a < b;
+}
+
+static void tree_update(BlockHeader* block) {
+    FreeTreeNode* node = tree_node(block);
+    int left_height = tree_height(node->left);
+    int right_height = tree_height(node->right);
+    node->height = 1 + (left_height > right_height ? left_height : right_height);
     
-    // Check medium pool
-    if (pool == nullptr && medium_pool.pool_start != nullptr) {
-        uintptr_t pool_start = (uintptr_t)medium_pool.pool_start;
-        uintptr_t pool_end = pool_start + medium_pool.pool_size;
-        if (block_addr >= pool_start && block_addr < pool_end) {
-            pool = &medium_pool;
-        }
+    size_t max_size = block_size(block);
+    if (tree_max_size(node->left) > max_size) {
+        max_size = tree_max_size(node->left);
     }
+    if (tree_max_size(node->right) > max_size) {
+        max_size = tree_max_size(node->right);
+    }
+    node->max_size = max_size;
+}
+
+static BlockHeader* tree_rotate_right(BlockHeader* block) {
+    BlockHeader* left = tree_node(block)->left;
+    tree_node(block)->left = tree_node(left)->right;
+    tree_node(left)->right = block;
+    tree_update(block);
+    tree_update(left);
+    return left;
+}
+
+static BlockHeader* tree_rotate_left(BlockHeader* block) {
+    BlockHeader* right = tree_node(block)->right;
+    tree_node(block)->right = tree_node(right)->left;
+    tree_node(right)->left = block;
+    tree_update(block);
+    tree_update(right);
+    return right;
+}
+
+static BlockHeader* tree_balance(BlockHeader* block) {
+    // Restore the AVL invariant at one node; returns the subtree's new root
+    
+    FreeTreeNode* node = tree_node(block);
+    tree_update(block);
+    int balance = tree_height(node->left) - tree_height(node->right);
     
-    // Check large pool
-    if (pool == nullptr && large_pool.pool_start != nullptr) {
-        uintptr_t pool_start = (uintptr_t)large_pool.pool_start;
-        uintptr_t pool_end = pool_start + large_pool.pool_size;
-        if (block_addr >= pool_start && block_addr < pool_end) {
-            pool = &large_pool;
+    if (balance > 1) {
+        BlockHeader* left = node->left;
+        if (tree_height(tree_node(left)->left) < tree_height(tree_node(left)->right)) {
+            node->left = tree_rotate_left(left);
         }
+        return tree_rotate_right(block);
+    }
+    if (balance < -1) {
+        BlockHeader* right = node->right;
+        if (tree_height(tree_node(right)->right) < tree_height(tree_node(right)->left)) {
+            node->right = tree_rotate_right(right);
+        }
+        return tree_rotate_left(block);
+    }
+    return block;
+}
+
+static BlockHeader* tree_insert(MemoryPool* pool, BlockHeader* root, BlockHeader* block) {
+    if (root == nullptr) {
+        FreeTreeNode* node = tree_node(block);
+        node->left = nullptr;
+        node->right = nullptr;
+        tree_update(block);
+        return block;
+    }
+    
+    FreeTreeNode* node = tree_node(root);
+    if (tree_less(pool, block, root)) {
+        node->left = tree_insert(pool, node->left, block);
+    } else {
+        node->right = tree_insert(pool, node->right, block);
+    }
+    return tree_balance(root);
+}
+
+static BlockHeader* tree_remove_min(BlockHeader* root, BlockHeader** min) {
+    FreeTreeNode* node = tree_node(root);
+    if (node->left == nullptr) {
+        *min = root;
+        return node->right;
+    }
+    node->left = tree_remove_min(node->left, min);
+    return tree_balance(root);
+}
+
+static BlockHeader* tree_remove(MemoryPool* pool, BlockHeader* root, BlockHeader* block) {
+    if (root == nullptr) {
+        return nullptr;  // Not in the tree
     }
     
-    // Check xlarge pool
-    if (pool == nullptr && xlarge_pool.pool_start != nullptr) {
-        uintptr_t pool_start = (uintptr_t)xlarge_pool.pool_start;
-        uintptr_t pool_end = pool_start + xlarge_pool.pool_size;
-        if (block_addr >= pool_start && block_addr < pool_end) {
-            pool = &xlarge_pool;
+    FreeTreeNode* node = tree_node(root);
+    if (root == block) {
+        // Replace the node with its in-order successor
+        if (node->right == nullptr) {
+            return node->left;
         }
+        BlockHeader* successor;
+        BlockHeader* right = tree_remove_min(node->right, &successor);
+        tree_node(successor)->left = node->left;
+        tree_node(successor)->right = right;
+        return tree_balance(successor);
     }
     
-    // Step 3: Free to the appropriate pool
-    if (pool != nullptr) {
-        free_to_pool(pool, header);
+    if (tree_less(pool, block, root)) {
+        node->left = tree_remove(pool, node->left, block);
     } else {
-        // Block doesn't belong to any pool - invalid pointer or corruption
-        std::cerr << "Warning: Attempted to free invalid pointer\n";
+        node->right = tree_remove(pool, node->right, block);
     }
+    return tree_balance(root);
 }
 
-void* my_calloc(size_t num, size_t size) {
-    // TODO: Implement calloc
-    // 1. Calculate total size
-    // 2. Check for overflow
-    // 3. Allocate using my_malloc
-    // 4. Zero the memory using memset
+static BlockHeader* tree_lowest_fit(BlockHeader* root, size_t size) {
+    // Address order: the leftmost block that fits, steering by max_size
     
-    size_t total_size = num * size;
+    if (tree_max_size(root) < size) {
+        return nullptr;
+    }
+    BlockHeader* block = root;
+    for (;;) {
+        FreeTreeNode* node = tree_node(block);
+        if (tree_max_size(node->left) >= size) {
+            block = node->left;
+        } else if (block_size(block) >= size) {
+            return block;
+        } else {
+            block = node->right;  // max_size says something here fits
+        }
+    }
+}
+
+static BlockHeader* tree_smallest_fit(BlockHeader* root, size_t size) {
+    // Size order: the leftmost block of at least size (lower bound)
     
-    // Check for overflow
-    if (num != 0 && total_size / num != size) {
-        return nullptr;  // Overflow
+    BlockHeader* best = nullptr;
+    BlockHeader* block = root;
+    while (block != nullptr) {
+        if (block_size(block) >= size) {
+            best = block;
+            block = tree_node(block)->left;
+        } else {
+            block = tree_node(block)->right;
+        }
     }
+    return best;
+}
+
+static BlockHeader* tree_smallest_fit_by_address(BlockHeader* root, size_t size,
+                                                 BlockHeader* best) {
+    // Best fit in an address-ordered tree: visit only subtrees where
+    // something fits, and stop at an exact fit
     
-    void* ptr = my_malloc(total_size);
-    if (ptr != nullptr) {
-        std::memset(ptr, 0, total_size);
+    if (tree_max_size(root) < size || (best != nullptr && block_size(best) == size)) {
+        return best;
     }
+    FreeTreeNode* node = tree_node(root);
+    if (block_size(root) >= size && (best == nullptr || block_size(root) < block_size(best))) {
+        best = root;
+    }
+    best = tree_smallest_fit_by_address(node->left, size, best);
+    return tree_smallest_fit_by_address(node->right, size, best);
+}
+
+static BlockHeader* first_free_from(MemoryPool* pool, int fl, int sl) {
+    // Head of the first non-empty list at (fl, sl) or after it, found with
+    // one bit scan per level
     
-    return ptr;
+    uint32_t sl_map = (sl < TLSF_SL_COUNT) ? pool->sl_bitmap[fl] & (~0u << sl) : 0;
+    if (sl_map == 0) {
+        uint32_t fl_map = (fl + 1 < TLSF_FL_COUNT) ? pool->fl_bitmap & (~0u << (fl + 1)) : 0;
+        if (fl_map == 0) {
+            return nullptr;  // Nothing this large is free
+        }
+        fl = __builtin_ctz(fl_map);
+        sl_map = pool->sl_bitmap[fl];
+    }
+    return pool->free_lists[fl][__builtin_ctz(sl_map)];
 }
 
-void* my_realloc(void* ptr, size_t size) {
-    // Reallocate memory - resize an existing allocation
+BlockHeader* coalesce_blocks(MemoryPool* pool, BlockHeader* header) {
+    // Merge a free block with its free physical neighbours
     
-    // Handle NULL ptr (like malloc)
-    if (ptr == nullptr) {
-        return my_malloc(size);
+    if (pool == nullptr || header == nullptr) {
+        return header;
     }
     
-    // Handle zero size (like free)
-    if (size == 0) {
-        my_free(ptr);
-        return nullptr;
+    // Step 1: Absorb the next block (header + size)
+    BlockHeader* next = get_next_block(pool, header);
+    if (next != nullptr && block_is_free(next)) {
+        remove_from_free_list(pool, next);
+        set_block_size(header, block_size(header) + block_size(next));
     }
     
-    // Get old block header
-    BlockHeader* old_header = get_header(ptr);
-    if (old_header == nullptr) {
-        return nullptr;  // Invalid pointer
+    // Step 2: Let the previous block (header - footer size) absorb us
+    BlockHeader* prev = get_prev_free_block(pool, header);
+    if (prev != nullptr) {
+        remove_from_free_list(pool, prev);
+        set_block_size(prev, block_size(prev) + block_size(header));
+        header = prev;
     }
     
-    // Calculate sizes
-    size_t aligned_new_size = align_size(size);
-    size_t new_total_size = aligned_new_size + sizeof(BlockHeader);
-    new_total_size = align_size(new_total_size);
+    // Step 3: The merged block needs its footer and the block after it
+    // must know its predecessor is free. It counts as freshly freed, so the
+    // scavenger ages it again.
+    header->size_and_flags &= ~(BLOCK_AGED | BLOCK_PURGED);
+    mark_block_free(header);
     
-    size_t old_total_size = old_header->size;
-    size_t old_user_size = old_total_size - sizeof(BlockHeader);
+    return header;  // Return coalesced block
+}
+
+// ============================================================================
+// ALLOCATION STRATEGIES
+// ============================================================================
+
+BlockHeader* find_good_fit(MemoryPool* pool, size_t size) {
+    // Round the request up to the next list boundary, so every block of
+    // that list and above is large enough, then take the first one
     
-    // If new size is smaller or equal, we can just use the existing block
-    // (We could shrink it, but for simplicity, we'll just keep the same size)
-    if (new_total_size <= old_total_size) {
-        return ptr;  // Can use existing block
+    if (pool == nullptr) {
+        return nullptr;
+    }
+    if (pool->fit_policy != FIT_GOOD) {
+        return find_first_fit(pool, size);
     }
     
-    // New size is larger - need to allocate new block and copy data
-    void* new_ptr = my_malloc(size);
-    if (new_ptr == nullptr) {
-        return nullptr;  // Allocation failed
+    if (size >= TLSF_SMALL_SIZE) {
+        int log2 = 63 - __builtin_clzll(size);
+        size += ((size_t)1 << (log2 - TLSF_SL_LOG2)) - 1;
     }
+    int fl;
+    int sl;
+    free_list_index(size, &fl, &sl);
+    return first_free_from(pool, fl, sl);
+}
+
+BlockHeader* find_first_fit(MemoryPool* pool, size_t size) {
+    // Search the request's own list for the first block that's large
+    // enough; every block of a later list is
     
-    // Copy old data to new location
-    // Copy the minimum of old and new sizes
-    size_t copy_size = (old_user_size < aligned_new_size) ? old_user_size : aligned_new_size;
-    std::memcpy(new_ptr, ptr, copy_size);
+    if (pool == nullptr) {
+        return nullptr;
+    }
     
-    // Free the old block
-    my_free(ptr);
+    // Tree pools: the lowest address (or smallest block) that fits
+    if (pool->fit_policy == FIT_ADDRESS) {
+        return tree_lowest_fit(pool->free_tree, size);
+    }
+    if (pool->fit_policy == FIT_BEST) {
+        return tree_smallest_fit(pool->free_tree, size);
+    }
     
-    return new_ptr;
+    int fl;
+    int sl;
+    free_list_index(size, &fl, &sl);
+    
+    // Walk the list blocks of about this size share
+    for (BlockHeader* current = pool->free_lists[fl][sl]; current != nullptr;
+         current = block_links(current)->next_free) {
+        if (block_size(current) >= size) {
+            return current;  // Found a suitable block!
+        }
+    }
+    
+    // Otherwise the head of the next non-empty list
+    return first_free_from(pool, fl, sl + 1);
 }
 
-// ============================================================================
-// STATISTICS & DEBUGGING
-// ============================================================================
-
-void print_allocator_stats() {
-    // TODO: Print statistics for all pools
-    // - Total allocated
-    // - Total free
-    // - Number of free blocks
-    // - Fragmentation metrics
+BlockHeader* find_best_fit(MemoryPool* pool, size_t size) {
+    // Search for the smallest block that's large enough
     
-    std::cout << "=== Allocator Statistics ===\n";
-    // TODO: Print stats for each pool
+    if (pool == nullptr) {
+        return nullptr;
+    }
+    
+    if (pool->fit_policy == FIT_BEST) {
+        return tree_smallest_fit(pool->free_tree, size);
+    }
+    if (pool->fit_policy == FIT_ADDRESS) {
+        return tree_smallest_fit_by_address(pool->free_tree, size, nullptr);
+    }
+    
+    // Lists: the smallest fitting block of the request's own list, else
+    // the smallest of the next non-empty list (all of which fit)
+    int fl;
+    int sl;
+    free_list_index(size, &fl, &sl);
+    BlockHeader* best = nullptr;
+    for (BlockHeader* current = pool->free_lists[fl][sl]; current != nullptr;
+         current = block_links(current)->next_free) {
+        if (block_size(current) >= size && (best == nullptr || block_size(current) < block_size(best))) {
+            best = current;
+        }
+    }
+    if (best != nullptr) {
+        return best;
+    }
+    
+    for (BlockHeader* current = first_free_from(pool, fl, sl + 1); current != nullptr;
+         current = block_links(current)->next_free) {
+        if (best == nullptr || block_size(current) < block_size(best)) {
+            best = current;
+        }
+    }
+    return best;
 }
 
-size_t get_allocated_bytes() {
-    // TODO: Sum allocated bytes across all pools
-    return 0;
+static BlockHeader* find_fit(MemoryPool* pool, size_t size) {
+    // The search the pool's fit policy calls for
+    switch (pool->fit_policy) {
+    case FIT_BEST:
+        return find_best_fit(pool, size);
+    case FIT_ADDRESS:
+        return find_first_fit(pool, size);
+    default:
+        return find_good_fit(pool, size);
+    }
 }
 
-size_t get_free_bytes() {
-    // TODO: Sum free bytes across all pools
-    return 0;
+static void pool_set_fit_policy(MemoryPool* pool, FitPolicy policy) {
+    // Switch a live variable-size pool to another policy by re-indexing
+    // every free block found walking its arenas (pool lock held)
+    
+    if (pool->fit_policy == policy) {
+        return;
+    }
+    free_lists_reset(pool);
+    pool->free_block_count = 0;
+    pool->fit_policy = policy;
+    
+    for (Arena* arena = pool->arenas; arena != nullptr; arena = arena->next) {
+        for (BlockHeader* block = first_block(arena); block != nullptr;
+             block = get_next_block(pool, block)) {
+            if (block_is_free(block)) {
+                add_to_free_list(pool, block);
+            }
+        }
+    }
 }
 
-size_t get_free_block_count() {
-    // TODO: Count free blocks across all pools
-    return 0;
+BlockHeader* split_block(MemoryPool* pool, BlockHeader* header, size_t size) {
+    // Split a block if it's much larger than needed
+    
+    if (pool == nullptr || header == nullptr) {
+        return header;
+    }
+    
+    // Step 1: Only split if the remainder can be a free block of its own
+    size_t original_size = block_size(header);
+    if (original_size < size + MIN_BLOCK_SIZE) {
+        return header;  // Use the whole block (too small to split efficiently)
+    }
+    
+    // Step 2: Shrink the block and create a free block from the remainder
+    // (its predecessor is the allocated block, so no flags)
+    set_block_size(header, size);
+    
+    BlockHeader* remainder = (BlockHeader*)((char*)header + size);
+    remainder->size_and_flags = original_size - size;
+    
+    // Step 3: Merge with a free next neighbour (this also writes the
+    // remainder's footer and flags the block after it), then make it available
+    remainder = coalesce_blocks(pool, remainder);
+    add_to_free_list(pool, remainder);
+    
+    return header;
 }
 
-bool validate_allocator() {
-    // TODO: Validate allocator integrity
-    // Check:
-    // - All headers are valid
-    // - Free list is consistent
-    // - No double-free
-    // - No memory corruption
+bool resize_in_place(MemoryPool* pool, BlockHeader* header, size_t size) {
+    // Try to satisfy a realloc without allocating, copying or freeing
     
-    return true;  // Placeholder
+    size_t new_total = block_total_size(size);
+    size_t old_total = block_size(header);
+    
+    // Step 1: Grow by absorbing the physically next block if it is free
+    // and together they are large enough
+    if (new_total > old_total) {
+        BlockHeader* next = get_next_block(pool, header);
+        if (next == nullptr || !block_is_free(next) ||
+            old_total + block_size(next) < new_total) {
+            return false;
+        }
+        
+        size_t next_size = block_size(next);
+        remove_from_free_list(pool, next);
+        set_block_size(header, old_total + next_size);
+        mark_block_allocated(header);  // The block after loses its free predecessor
+        pool->allocated_bytes += next_size;
+        pool->free_bytes -= next_size;
+    }
+    
+    // Step 2: Give back whatever is beyond the new size (this is the whole
+    // story for a shrink)
+    size_t before_split = block_size(header);
+    split_block(pool, header, new_total);
+    pool->allocated_bytes -= before_split - block_size(header);
+    pool->free_bytes += before_split - block_size(header);
+    
+    return true;
+}
+
+// ============================================================================
+// HUGE ALLOCATIONS
+// ============================================================================
+
+static size_t page_round(size_t size) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    return (size + page - 1) & ~(page - 1);
+}
+
+static size_t huge_slot(void* ptr) {
+    // Mappings are page aligned, so hash the page number (Fibonacci hashing)
+    return (size_t)(((uintptr_t)ptr >> 12) * 0x9E3779B97F4A7C15ull) & (huge_capacity - 1);
+}
+
+static bool huge_table_grow() {
+    // Double the table and reinsert every live entry (huge_lock held)
+    
+    size_t new_capacity = (huge_capacity == 0) ? 256 : huge_capacity * 2;
+    void* memory = mmap(NULL, new_capacity * sizeof(HugeAllocation), PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        return false;
+    }
+    
+    HugeAllocation* old_table = huge_table;
+    size_t old_capacity = huge_capacity;
+    huge_table = (HugeAllocation*)memory;  // Zeroed by the kernel: all empty
+    huge_capacity = new_capacity;
+    
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old_table[i].ptr != nullptr) {
+            size_t slot = huge_slot(old_table[i].ptr);
+            while (huge_table[slot].ptr != nullptr) {
+                slot = (slot + 1) & (huge_capacity - 1);
+            }
+            huge_table[slot] = old_table[i];
+        }
+    }
+    
+    if (old_table != nullptr) {
+        munmap(old_table, old_capacity * sizeof(HugeAllocation));
+    }
+    return true;
+}
+
+static HugeAllocation* huge_find(void* ptr) {
+    // Linear probe until the entry or an empty slot (huge_lock held)
+    
+    if (huge_capacity == 0) {
+        return nullptr;
+    }
+    
+    size_t slot = huge_slot(ptr);
+    while (huge_table[slot].ptr != nullptr) {
+        if (huge_table[slot].ptr == ptr) {
+            return &huge_table[slot];
+        }
+        slot = (slot + 1) & (huge_capacity - 1);
+    }
+    return nullptr;
+}
+
+static bool huge_insert(void* ptr, size_t size) {
+    // Keep the load factor under 1/2 so probes stay short (huge_lock held)
+    
+    if ((huge_count + 1) * 2 > huge_capacity && !huge_table_grow()) {
+        return false;
+    }
+    
+    size_t slot = huge_slot(ptr);
+    while (huge_table[slot].ptr != nullptr) {
+        slot = (slot + 1) & (huge_capacity - 1);
+    }
+    huge_table[slot].ptr = ptr;
+    huge_table[slot].size = size;
+    huge_count++;
+    huge_bytes += size;
+    return true;
+}
+
+static void huge_erase(HugeAllocation* entry) {
+    // Backward-shift deletion: pull later entries of the probe run into the
+    // hole so lookups never need tombstones (huge_lock held)
+    
+    size_t hole = entry - huge_table;
+    size_t slot = hole;
+    huge_bytes -= entry->size;
+    
+    while (true) {
+        slot = (slot + 1) & (huge_capacity - 1);
+        if (huge_table[slot].ptr == nullptr) {
+            break;
+        }
+        
+        // An entry may move into the hole only if its home slot is not
+        // between the hole and its current position (cyclically)
+        size_t home = huge_slot(huge_table[slot].ptr);
+        bool home_in_range = (hole <= slot) ? (hole < home && home <= slot)
+                                            : (hole < home || home <= slot);
+        if (!home_in_range) {
+            huge_table[hole] = huge_table[slot];
+            hole = slot;
+        }
+    }
+    
+    huge_table[hole].ptr = nullptr;
+    huge_table[hole].size = 0;
+    huge_count--;
+}
+
+void* huge_alloc(size_t size, size_t alignment) {
+    // Step 1: Map whole pages just for this request (over-mapping and
+    // trimming only when it must start beyond page alignment)
+    size_t mapped_size = page_round(size);
+    void* ptr;
+    if (alignment > (size_t)sysconf(_SC_PAGESIZE)) {
+        ptr = map_aligned(mapped_size, alignment);
+    } else {
+        ptr = mmap(NULL, mapped_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    if (ptr == MAP_FAILED) {
+        return nullptr;
+    }
+    bind_to_node(ptr, mapped_size, current_node(false));
+    
+    // Step 2: Record it in the side table, and mark its first page so
+    // my_free can tell it apart without probing the table
+    std::lock_guard<std::mutex> guard(huge_lock);
+    PageMapEntry entry = PageMapEntry();
+    entry.span_size = mapped_size;
+    entry.kind = PAGE_HUGE;
+    
+    if (!page_map_set(ptr, 1, entry)) {
+        munmap(ptr, mapped_size);
+        return nullptr;
+    }
+    if (!huge_insert(ptr, mapped_size)) {
+        page_map_set(ptr, 1, PageMapEntry());
+        munmap(ptr, mapped_size);
+        return nullptr;
+    }
+    huge_alloc_calls++;
+    return ptr;
+}
+
+bool huge_free(void* ptr) {
+    size_t size;
+    {
+        std::lock_guard<std::mutex> guard(huge_lock);
+        HugeAllocation* entry = huge_find(ptr);
+        if (entry == nullptr) {
+            return false;
+        }
+        size = entry->size;
+        huge_erase(entry);
+        huge_free_calls++;
+        page_map_set(ptr, 1, PageMapEntry());
+    }
+    
+    // Pages go straight back to the OS. If the kernel cannot unmap them
+    // now, drop their contents and keep them for a later retry.
+    if (munmap(ptr, size) != 0) {
+        madvise(ptr, size, MADV_DONTNEED);
+        PendingUnmap* pending = (PendingUnmap*)ptr;
+        pending->size = size;
+        std::lock_guard<std::mutex> guard(huge_lock);
+        pending->next = huge_pending;
+        huge_pending = pending;
+        huge_pending_bytes.store(huge_pending_bytes.load(std::memory_order_relaxed) + size,
+                                 std::memory_order_relaxed);
+        return true;
+    }
+    
+    // An unmap just succeeded, so the ones that failed may succeed too
+    if (huge_pending_bytes.load(std::memory_order_relaxed) != 0) {
+        huge_retry_unmaps();
+    }
+    return true;
+}
+
+static void huge_retry_unmaps() {
+    // Take the whole pending list, and put back what still fails
+    
+    PendingUnmap* list;
+    {
+        std::lock_guard<std::mutex> guard(huge_lock);
+        list = huge_pending;
+        huge_pending = nullptr;
+    }
+    
+    PendingUnmap* failed = nullptr;
+    size_t released = 0;
+    while (list != nullptr) {
+        PendingUnmap* next = list->next;  // Read before the memory goes away
+        size_t size = list->size;
+        if (munmap(list, size) == 0) {
+            released += size;
+        } else {
+            list->next = failed;
+            failed = list;
+        }
+        list = next;
+    }
+    
+    std::lock_guard<std::mutex> guard(huge_lock);
+    while (failed != nullptr) {
+        PendingUnmap* next = failed->next;
+        failed->next = huge_pending;
+        huge_pending = failed;
+        failed = next;
+    }
+    huge_pending_bytes.store(huge_pending_bytes.load(std::memory_order_relaxed) - released,
+                             std::memory_order_relaxed);
+}
+
+void* huge_realloc(void* ptr, size_t size) {
+    // The kernel moves page-table entries, so no bytes are copied
+    
+    size_t new_size = page_round(size);
+    std::lock_guard<std::mutex> guard(huge_lock);
+    
+    HugeAllocation* entry = huge_find(ptr);
+    if (entry == nullptr) {
+        return nullptr;
+    }
+    if (entry->size == new_size) {
+        return ptr;
+    }
+    
+    void* new_ptr = mremap(ptr, entry->size, new_size, MREMAP_MAYMOVE);
+    if (new_ptr == MAP_FAILED) {
+        return nullptr;
+    }
+    
+    if (new_ptr == ptr) {
+        huge_bytes += new_size - entry->size;
+        entry->size = new_size;
+    } else {
+        // Re-key the entry under the new address (cannot fail: the count
+        // is unchanged, so the table never needs to grow here)
+        huge_erase(entry);
+        huge_insert(new_ptr, new_size);
+        page_map_set(ptr, 1, PageMapEntry());
+    }
+    
+    PageMapEntry page_entry = PageMapEntry();
+    page_entry.span_size = new_size;
+    page_entry.kind = PAGE_HUGE;
+    page_map_set(new_ptr, 1, page_entry);
+    return new_ptr;
+}
+
+size_t huge_usable_size(void* ptr) {
+    std::lock_guard<std::mutex> guard(huge_lock);
+    HugeAllocation* entry = huge_find(ptr);
+    return (entry != nullptr) ? entry->size : 0;
+}
+
+// ============================================================================
+// NUMA NODES
+// ============================================================================
+
+static int detect_numa_nodes() {
+    // Count the nodes the kernel may bring online by reading the highest
+    // node number. MYALLOC_NUMA=0 keeps a single node.
+    
+    const char* numa_env = getenv("MYALLOC_NUMA");
+    if (numa_env != nullptr && numa_env[0] == '0') {
+        return 1;
+    }
+    
+    int highest = highest_listed_id("/sys/devices/system/node/possible");
+    if (highest < 0) {
+        return 1;
+    }
+    return highest + 1 < MAX_NUMA_NODES ? highest + 1 : MAX_NUMA_NODES;
+}
+
+static int current_node(bool refresh) {
+    // The node the calling thread runs on, asked of the kernel with getcpu
+    // the first time and again whenever the caller refreshes it (when a
+    // cache takes a new slab). Threads migrate, so this is a hint.
+    
+    if (numa_node_count == 1) {
+        return 0;
+    }
+    if (thread_node < 0 || refresh) {
+        unsigned cpu = 0;
+        unsigned node = 0;
+        if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) {
+            node = 0;
+        } else if (node >= (unsigned)numa_node_count) {
+            node = numa_node_count - 1;  // Beyond MAX_NUMA_NODES
+        }
+        thread_node = (int)node;
+    }
+    return thread_node;
+}
+
+static void bind_to_node(void* memory, size_t size, int node) {
+    // Ask for a mapping's pages to come from a node. Preferred rather than
+    // bound, so allocation still succeeds when that node runs out. Nothing
+    // is touched yet, so this decides where every page lands.
+    
+    if (numa_node_count == 1) {
+        return;
+    }
+    unsigned long mask = 1ul << node;
+    syscall(SYS_mbind, memory, size, MPOL_PREFERRED, &mask,
+            (unsigned long)MAX_NUMA_NODES + 1, 0ul);
+}
+
+static int collect_pools(MemoryPool** pools) {
+    // Every pool of every node, small to xlarge node by node
+    int count = 0;
+    for (int n = 0; n < numa_node_count; n++) {
+        pools[count++] = &nodes[n].small_pool;
+        pools[count++] = &nodes[n].medium_pool;
+        pools[count++] = &nodes[n].large_pool;
+        pools[count++] = &nodes[n].xlarge_pool;
+    }
+    return count;
+}
+
+int allocator_numa_nodes() {
+    if (!allocator_initialized) {
+        allocator_init();
+    }
+    return numa_node_count;
+}
+
+int my_malloc_node(void* ptr) {
+    PageMapEntry* entry = page_map_lookup(ptr);
+    if (entry == nullptr || entry->pool == nullptr) {
+        return -1;  // Not ours, or a huge mapping (no pool)
+    }
+    return entry->pool->node;
+}
+
+// ============================================================================
+// SIZE CLASSES
+// ============================================================================
+
+static void init_size_classes(NodePools* node) {
+    // Build the class table: 16, 32, 48, 64, then four geometric steps
+    // per doubling (80, 96, 112, 128, 160, ...) up to LARGE_BLOCK_MAX.
+    // Every class is a multiple of ALIGNMENT, so every slot is aligned.
+    // Each class carves its slabs from the pool covering its size.
+    
+    static_assert(size_class_slot_size(NUM_SIZE_CLASSES - 1) == LARGE_BLOCK_MAX,
+                  "size classes must end at LARGE_BLOCK_MAX");
+    
+    SizeClass* size_classes = node->size_classes;
+    for (int i = 0; i < NUM_SIZE_CLASSES; i++) {
+        size_classes[i].slot_size = size_class_slot_size(i);
+        size_classes[i].pool = select_node_pool(node, size_classes[i].slot_size);
+        size_classes[i].partial = nullptr;
+        size_classes[i].slab_count = 0;
+    }
+    
+    // Lookup table indexed by size in ALIGNMENT units, so mapping a request
+    // to its class is a single load
+    int class_index = 0;
+    for (size_t units = 0; units <= LARGE_BLOCK_MAX / ALIGNMENT; units++) {
+        while (size_classes[class_index].slot_size < units * ALIGNMENT) {
+            class_index++;
+        }
+        class_lookup[units] = (uint8_t)class_index;
+    }
+}
+
+int size_class_index(size_t size) {
+    return class_lookup[(size + ALIGNMENT - 1) / ALIGNMENT];
+}
+
+size_t size_class_size(int class_index) {
+    return nodes[0].size_classes[class_index].slot_size;
+}
+
+static SizeClass* slab_class(SlabHeader* slab) {
+    // The slab's size class on the node it was carved from
+    return &nodes[slab->node].size_classes[slab->class_index];
+}
+
+// ============================================================================
+// SLABS
+// ============================================================================
+
+static void partial_list_push(SizeClass* size_class, SlabHeader* slab) {
+    slab->prev = nullptr;
+    slab->next = size_class->partial;
+    if (size_class->partial != nullptr) {
+        size_class->partial->prev = slab;
+    }
+    size_class->partial = slab;
+    slab->in_partial_list = true;
+}
+
+static void partial_list_remove(SizeClass* size_class, SlabHeader* slab) {
+    if (slab->prev != nullptr) {
+        slab->prev->next = slab->next;
+    } else {
+        size_class->partial = slab->next;
+    }
+    if (slab->next != nullptr) {
+        slab->next->prev = slab->prev;
+    }
+    slab->next = nullptr;
+    slab->prev = nullptr;
+    slab->in_partial_list = false;
+}
+
+static SlabHeader* slab_create(int node, int class_index) {
+    // Take an empty slab from the node's pool and format it for a size class
+    
+    SizeClass* size_class = &nodes[node].size_classes[class_index];
+    MemoryPool* pool = size_class->pool;
+    SlabHeader* slab = nullptr;
+    
+    // Step 1: Prefer a slab another class has emptied, else carve a new
+    // one, mapping another arena once the newest is used up
+    if (pool->free_slabs != nullptr) {
+        slab = pool->free_slabs;
+        pool->free_slabs = slab->next;
+        pool->free_slab_count--;
+    } else {
+        if (pool->slab_cursor + pool->slab_size > pool->slab_end &&
+            grow_pool(pool, pool->slab_size) == nullptr) {
+            return nullptr;  // Out of memory
+        }
+        slab = (SlabHeader*)meta_alloc(&slab_descriptor_free_list, sizeof(SlabHeader));
+        if (slab == nullptr) {
+            return nullptr;
+        }
+        slab->base = pool->slab_cursor;
+        pool->slab_cursor += pool->slab_size;
+    }
+    
+    // Step 2: Slots are handed out lazily, so pages are touched on demand
+    slab->owner.store(nullptr, std::memory_order_relaxed);
+    slab->free_slots = nullptr;
+    slab->used = 0;
+    slab->capacity = (uint32_t)(pool->slab_size / size_class->slot_size);
+    slab->next_unused = 0;
+    slab->class_index = (uint16_t)class_index;
+    slab->node = (uint8_t)node;
+    
+    // Step 3: Point the slab's pages at its header and class
+    PageMapEntry entry = PageMapEntry();
+    entry.pool = pool;
+    entry.slab = slab;
+    entry.size_class = (uint16_t)class_index;
+    entry.kind = PAGE_SLAB;
+    page_map_set(slab->base, pool->slab_size, entry);
+    
+    partial_list_push(size_class, slab);
+    size_class->slab_count++;
+    return slab;
+}
+
+void* slab_alloc(int node, int class_index) {
+    SizeClass* size_class = &nodes[node].size_classes[class_index];
+    
+    // Step 1: Any partial slab will do; otherwise start a new one
+    SlabHeader* slab = size_class->partial;
+    if (slab == nullptr) {
+        slab = slab_create(node, class_index);
+        if (slab == nullptr) {
+            return nullptr;
+        }
+    }
+    
+    // Step 2: Pop a recycled slot, or take the next never-used one
+    void* ptr;
+    if (slab->free_slots != nullptr) {
+        ptr = slab->free_slots;
+        slab->free_slots = *(void**)ptr;
+    } else {
+        ptr = slab->base + slab->next_unused * size_class->slot_size;
+        slab->next_unused++;
+    }
+    slab->used++;
+    
+    // Step 3: Full slabs leave the partial list until a slot comes back
+    if (slab->used == slab->capacity) {
+        partial_list_remove(size_class, slab);
+    }
+    
+    size_class->pool->allocated_bytes += size_class->slot_size;
+    size_class->pool->free_bytes -= size_class->slot_size;
+    return ptr;
+}
+
+void slab_free(SlabHeader* slab, void* ptr) {
+    SizeClass* size_class = slab_class(slab);
+    MemoryPool* pool = size_class->pool;
+    
+    // Step 1: Push the slot onto the slab's free list
+    *(void**)ptr = slab->free_slots;
+    slab->free_slots = ptr;
+    slab->used--;
+    
+    pool->allocated_bytes -= size_class->slot_size;
+    pool->free_bytes += size_class->slot_size;
+    
+    // Step 2: A previously full slab can serve allocations again
+    if (!slab->in_partial_list) {
+        partial_list_push(size_class, slab);
+    }
+    
+    // Step 3: Give empty slabs back to the pool, but keep the last partial
+    // slab of the class so alternating alloc/free does not thrash
+    if (slab->used == 0 && (slab->next != nullptr || slab->prev != nullptr)) {
+        partial_list_remove(size_class, slab);
+        slab->scavenge_state = SCAVENGE_DIRTY;
+        slab->next = pool->free_slabs;
+        pool->free_slabs = slab;
+        pool->free_slab_count++;
+        size_class->slab_count--;
+    }
+}
+
+SlabHeader* get_slab(void* ptr) {
+    return page_map_lookup(ptr)->slab;
+}
+
+// Owned slabs: only the owning cache's thread touches these, without locks
+
+static void owned_list_push(ThreadCache* cache, SlabHeader* slab) {
+    // Slabs with a free slot go on the class's owned list, full ones on
+    // its full list, so that a release can find every slab the cache owns
+    bool has_free = slab->used < slab->capacity;
+    SlabHeader** head = has_free ? &cache->owned[slab->class_index]
+                                 : &cache->full[slab->class_index];
+    slab->prev = nullptr;
+    slab->next = *head;
+    if (*head != nullptr) {
+        (*head)->prev = slab;
+    }
+    *head = slab;
+    slab->in_partial_list = has_free;
+}
+
+static void owned_list_remove(ThreadCache* cache, SlabHeader* slab) {
+    if (slab->prev != nullptr) {
+        slab->prev->next = slab->next;
+    } else if (slab->in_partial_list) {
+        cache->owned[slab->class_index] = slab->next;
+    } else {
+        cache->full[slab->class_index] = slab->next;
+    }
+    if (slab->next != nullptr) {
+        slab->next->prev = slab->prev;
+    }
+    slab->next = nullptr;
+    slab->prev = nullptr;
+    slab->in_partial_list = false;
+}
+
+static bool slab_claim(ThreadCache* cache, int class_index) {
+    // Take a central slab (partial, recycled or new) for this cache. From
+    // the pool's point of view all of its free slots are now allocated.
+    // Slabs come from the node the thread runs on now, so a thread that
+    // migrated picks up local memory from its next slab on.
+    
+    int node = current_node(true);
+    SizeClass* size_class = &nodes[node].size_classes[class_index];
+    MemoryPool* pool = size_class->pool;
+    SlabHeader* slab;
+    {
+        std::lock_guard<std::mutex> guard(pool->lock);
+        slab = size_class->partial;
+        if (slab == nullptr) {
+            slab = slab_create(node, class_index);
+            if (slab == nullptr) {
+                return false;
+            }
+        }
+        partial_list_remove(size_class, slab);
+        slab->owner.store(cache, std::memory_order_release);
+        
+        size_t free_bytes = (size_t)(slab->capacity - slab->used) * size_class->slot_size;
+        pool->allocated_bytes += free_bytes;
+        pool->free_bytes -= free_bytes;
+    }
+    
+    owned_list_push(cache, slab);
+    return true;
+}
+
+static void slab_disown(ThreadCache* cache, SlabHeader* slab) {
+    // Hand an owned slab back to its pool: empty slabs become free slabs,
+    // partial ones go on the class's central partial list, and full ones
+    // join it when slab_free frees a slot of theirs
+    
+    SizeClass* size_class = slab_class(slab);
+    MemoryPool* pool = size_class->pool;
+    owned_list_remove(cache, slab);
+    
+    std::lock_guard<std::mutex> guard(pool->lock);
+    slab->owner.store(nullptr, std::memory_order_release);
+    
+    size_t free_bytes = (size_t)(slab->capacity - slab->used) * size_class->slot_size;
+    pool->allocated_bytes -= free_bytes;
+    pool->free_bytes += free_bytes;
+    
+    if (slab->used == 0) {
+        slab->scavenge_state = SCAVENGE_DIRTY;
+        slab->next = pool->free_slabs;
+        pool->free_slabs = slab;
+        pool->free_slab_count++;
+        size_class->slab_count--;
+    } else if (slab->used < slab->capacity) {
+        partial_list_push(size_class, slab);
+    }
+}
+
+static void* owned_slab_alloc(ThreadCache* cache, int class_index) {
+    // Pop a slot from the first owned slab of the class that has one
+    
+    SlabHeader* slab = cache->owned[class_index];
+    if (slab == nullptr) {
+        return nullptr;
+    }
+    
+    void* ptr;
+    if (slab->free_slots != nullptr) {
+        ptr = slab->free_slots;
+        slab->free_slots = *(void**)ptr;
+    } else {
+        ptr = slab->base + slab->next_unused * size_class_size(class_index);
+        slab->next_unused++;
+    }
+    slab->used++;
+    
+    // Full slabs move to the full list; a freed slot brings them back
+    if (slab->used == slab->capacity) {
+        owned_list_remove(cache, slab);
+        owned_list_push(cache, slab);
+    }
+    return ptr;
+}
+
+static void owned_slab_free(ThreadCache* cache, SlabHeader* slab, void* ptr) {
+    *(void**)ptr = slab->free_slots;
+    slab->free_slots = ptr;
+    slab->used--;
+    
+    if (!slab->in_partial_list) {
+        owned_list_remove(cache, slab);
+        owned_list_push(cache, slab);
+    }
+    
+    // Give an empty slab back unless it is the class's only one, so
+    // alternating alloc/free does not thrash the pool lock. With used at 0
+    // no block of it is live anywhere, so no remote free can race this.
+    if (slab->used == 0 && (slab->next != nullptr || slab->prev != nullptr)) {
+        slab_disown(cache, slab);
+    }
+}
+
+void slab_free_remote(SlabHeader* slab, void* ptr) {
+    // The owner is read without a lock: if it changes after we look, the
+    // drain on the other side re-checks ownership (see thread_cache_drain)
+    
+    for (;;) {
+        ThreadCache* owner = slab->owner.load(std::memory_order_acquire);
+        if (owner != nullptr) {
+            std::atomic<void*>* head = &owner->remote_free[slab->class_index];
+            void* old_head = head->load(std::memory_order_relaxed);
+            do {
+                *(void**)ptr = old_head;
+            } while (!head->compare_exchange_weak(old_head, ptr, std::memory_order_release,
+                                                  std::memory_order_relaxed));
+            return;
+        }
+        
+        // Central slab (its owner exited, or it was filled without a
+        // cache): free it under its node's pool lock unless it was claimed
+        // meanwhile
+        MemoryPool* pool = slab_class(slab)->pool;
+        std::lock_guard<std::mutex> guard(pool->lock);
+        if (slab->owner.load(std::memory_order_relaxed) == nullptr) {
+            slab_free(slab, ptr);
+            return;
+        }
+    }
+}
+
+static void thread_cache_drain(ThreadCache* cache, int class_index) {
+    // Take every remotely freed block of a class in one exchange: top up
+    // the magazine, return the rest to their slabs. A block whose slab was
+    // handed back to the pool since it was pushed is freed there instead.
+    
+    void* block = cache->remote_free[class_index].exchange(nullptr, std::memory_order_acquire);
+    CacheBin* bin = &cache->bins[class_index];
+    
+    while (block != nullptr) {
+        void* next = *(void**)block;
+        SlabHeader* slab = get_slab(block);
+        
+        if (slab->owner.load(std::memory_order_relaxed) != cache) {
+            slab_free_remote(slab, block);
+        } else if (bin->count < tcache_max.load(std::memory_order_relaxed)) {
+            bin->slots[bin->count++] = block;
+        } else {
+            owned_slab_free(cache, slab, block);
+        }
+        block = next;
+    }
+}
+
+// ============================================================================
+// THREAD CACHE
+// ============================================================================
+
+ThreadCache* get_thread_cache() {
+    // Fast path: this thread already has a cache
+    if (tcache != nullptr) {
+        return tcache;
+    }
+    
+    // Reuse a cache left behind by an exited thread, or map a fresh one.
+    // Caches are never unmapped, so a late thread-exit hook can still read them.
+    ThreadCache* cache = nullptr;
+    {
+        std::lock_guard<std::mutex> guard(cache_list_lock);
+        if (cache_free_list != nullptr) {
+            cache = cache_free_list;
+            cache_free_list = cache->next_free;
+        }
+    }
+    
+    if (cache == nullptr) {
+        void* memory = mmap(NULL, sizeof(ThreadCache), PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) {
+            return nullptr;  // Callers fall back to the shared pools
+        }
+        cache = (ThreadCache*)memory;
+    }
+    
+    // Magazines start empty. A recycled cache owns no slabs, but its
+    // remote lists may have caught a late free; this thread drains them.
+    for (int i = 0; i < NUM_SIZE_CLASSES; i++) {
+        cache->bins[i].count = 0;
+    }
+    cache->next_free = nullptr;
+    
+    tcache = cache;
+    pthread_setspecific(tcache_key, cache);
+    return cache;
+}
+
+size_t thread_cache_refill(ThreadCache* cache, int class_index) {
+    // Fill the magazine without touching shared state if we can
+    
+    CacheBin* bin = &cache->bins[class_index];
+    uint32_t before = bin->count;
+    uint32_t batch = tcache_batch.load(std::memory_order_relaxed);
+    
+    // Step 1: Blocks other threads freed for us (recently touched, so
+    // hand them out before fresh slots)
+    thread_cache_drain(cache, class_index);
+    if (bin->count > before) {
+        return bin->count - before;
+    }
+    
+    // Step 2: Slots of our own slabs, claiming another slab when they run
+    // out (the only step that takes a lock)
+    while (bin->count < batch) {
+        void* ptr = owned_slab_alloc(cache, class_index);
+        if (ptr == nullptr) {
+            if (!slab_claim(cache, class_index)) {
+                break;  // Pool is full; hand out what we got
+            }
+            continue;
+        }
+        bin->slots[bin->count++] = ptr;
+    }
+    
+    return bin->count - before;
+}
+
+void thread_cache_flush_bin(ThreadCache* cache, int class_index, size_t count) {
+    // Return the oldest blocks (bottom of the magazine) to the pool and keep
+    // the recently freed, cache-warm ones on top
+    
+    CacheBin* bin = &cache->bins[class_index];
+    if (count > bin->count) {
+        count = bin->count;
+    }
+    if (count == 0) {
+        return;
+    }
+    
+    // Every cached block comes from a slab this cache owns
+    for (size_t i = 0; i < count; i++) {
+        owned_slab_free(cache, get_slab(bin->slots[i]), bin->slots[i]);
+    }
+    
+    scavenge_tick();
+    
+    // Slide the remaining blocks down
+    for (size_t i = count; i < bin->count; i++) {
+        bin->slots[i - count] = bin->slots[i];
+    }
+    bin->count -= count;
+}
+
+static void thread_cache_release(ThreadCache* cache) {
+    // Empty a cache that is about to lose its thread
+    
+    for (int i = 0; i < NUM_SIZE_CLASSES; i++) {
+        thread_cache_drain(cache, i);
+        thread_cache_flush_bin(cache, i, cache->bins[i].count);
+        
+        // Every owned slab goes back to the pool, full ones included, so
+        // later frees of their blocks take the central path instead of
+        // piling up on this cache's remote lists
+        while (cache->owned[i] != nullptr) {
+            slab_disown(cache, cache->owned[i]);
+        }
+        while (cache->full[i] != nullptr) {
+            slab_disown(cache, cache->full[i]);
+        }
+        
+        // A free that read the owner before its slab was disowned may have
+        // pushed since the first drain; the slab is central now, so this
+        // drain forwards such blocks there. One that pushes later still is
+        // drained by the thread that adopts the cache (or allocator_cleanup).
+        thread_cache_drain(cache, i);
+    }
+}
+
+void thread_cache_flush() {
+    ThreadCache* cache = tcache;
+    if (cache == nullptr) {
+        return;
+    }
+    
+    if (allocator_initialized) {
+        thread_cache_release(cache);
+    }
+    
+    // Detach the cache from this thread and recycle it
+    tcache = nullptr;
+    if (tcache_key_created) {
+        pthread_setspecific(tcache_key, nullptr);
+    }
+    
+    std::lock_guard<std::mutex> guard(cache_list_lock);
+    cache->next_free = cache_free_list;
+    cache_free_list = cache;
+}
+
+static void tcache_thread_exit(void* /* arg */) {
+    // pthread key destructor: runs when a thread with a cache exits
+    thread_cache_flush();
+}
+
+// ============================================================================
+// PER-CPU CACHES
+// ============================================================================
+//
+// A restartable sequence is a short run of instructions ending in a single
+// committing store. If the kernel preempts, migrates or signals the thread
+// before that store, it resumes the thread at an abort handler instead,
+// which starts over. So a thread can pop or push the free list of the CPU
+// it runs on with plain loads and stores: nothing else runs on that CPU
+// meanwhile. Only x86-64 has the sequences below; elsewhere (and under
+// ThreadSanitizer, which cannot see the ordering rseq provides) the mode
+// is unavailable and thread caches are used.
+
+#if defined(__x86_64__) && defined(__linux__) && !defined(__SANITIZE_THREAD__)
+#define PERCPU_RSEQ 1
+
+// Signature in front of every abort handler; must match the one the area
+// was registered with (glibc uses the same value)
+#define RSEQ_SIGNATURE 0x53053053
+
+static_assert(offsetof(struct rseq, cpu_id) == 4, "rseq layout");
+static_assert(offsetof(struct rseq, rseq_cs) == 8, "rseq layout");
+static_assert(offsetof(PerCpuBin, slots) == 8, "PerCpuBin layout");
+
+// glibc 2.35+ registers an rseq area for every thread and publishes where
+// it is; weak so older glibc still links (both are then 0)
+extern "C" {
+extern const ptrdiff_t __rseq_offset __attribute__((weak, visibility("default")));
+extern const unsigned int __rseq_size __attribute__((weak, visibility("default")));
+}
+
+// Our own area for threads glibc did not register
+static thread_local struct rseq own_rseq __attribute__((tls_model("initial-exec")));
+#endif
+
+static struct rseq* rseq_register_thread() {
+    // Find (or make) the calling thread's rseq area
+    
+#ifdef PERCPU_RSEQ
+    if (&__rseq_size != nullptr && __rseq_size != 0) {
+        struct rseq* area = (struct rseq*)((char*)__builtin_thread_pointer() + __rseq_offset);
+        if ((int32_t)area->cpu_id >= 0) {
+            return area;
+        }
+        return &rseq_unavailable;  // glibc's registration failed
+    }
+    if (syscall(SYS_rseq, &own_rseq, sizeof(own_rseq), 0, RSEQ_SIGNATURE) == 0) {
+        return &own_rseq;
+    }
+#endif
+    return &rseq_unavailable;
+}
+
+static struct rseq* percpu_area(int class_index) {
+    // The thread's rseq area if this class is cached per CPU, else NULL
+    
+    if (class_index >= PERCPU_NUM_CLASSES || !percpu_enabled.load(std::memory_order_acquire)) {
+        return nullptr;
+    }
+    if (thread_rseq == nullptr) {
+        thread_rseq = rseq_register_thread();
+    }
+    return (thread_rseq != &rseq_unavailable) ? thread_rseq : nullptr;
+}
+
+static void* percpu_pop(struct rseq* area, int class_index) {
+    // Pop the top block of this CPU's bin (NULL if empty). The store of the
+    // new count commits; an abort before it jumps back to retry.
+    
+#ifdef PERCPU_RSEQ
+    void* result;
+    __asm__ __volatile__(
+        ".pushsection __rseq_cs, \"aw\"\n\t"
+        ".balign 32\n\t"
+        ".Lpop_cs%=:\n\t"
+        ".long 0, 0\n\t"
+        ".quad .Lpop_start%=, .Lpop_commit%= - .Lpop_start%=, .Lpop_abort%=\n\t"
+        ".popsection\n\t"
+        ".Lpop_retry%=:\n\t"
+        "leaq .Lpop_cs%=(%%rip), %%rax\n\t"
+        "movq %%rax, 8(%[area])\n\t"
+        ".Lpop_start%=:\n\t"
+        "xorl %k[result], %k[result]\n\t"
+        "movl 4(%[area]), %%eax\n\t"            // cpu_id
+        "imulq %[stride], %%rax\n\t"
+        "addq %[bin], %%rax\n\t"                // This CPU's bin
+        "movl (%%rax), %%ecx\n\t"               // count
+        "testl %%ecx, %%ecx\n\t"
+        "jz .Lpop_commit%=\n\t"
+        "subl $1, %%ecx\n\t"
+        "movq 8(%%rax, %%rcx, 8), %[result]\n\t"
+        "movl %%ecx, (%%rax)\n\t"               // Commit
+        ".Lpop_commit%=:\n\t"
+        ".pushsection __rseq_failure, \"ax\"\n\t"
+        ".byte 0x0f, 0xb9, 0x3d\n\t"
+        ".long %c[signature]\n\t"
+        ".Lpop_abort%=:\n\t"
+        "jmp .Lpop_retry%=\n\t"
+        ".popsection\n\t"
+        : [result] "=&r"(result)
+        : [area] "r"(area), [stride] "r"((uint64_t)sizeof(PerCpuCache)),
+          [bin] "r"(&percpu_caches[0].bins[class_index]), [signature] "i"(RSEQ_SIGNATURE)
+        : "rax", "rcx", "memory", "cc");
+    return result;
+#else
+    (void)area;
+    (void)class_index;
+    return nullptr;
+#endif
+}
+
+static bool percpu_push(struct rseq* area, int class_index, void* ptr) {
+    // Push a block onto this CPU's bin (false if it is full)
+    
+#ifdef PERCPU_RSEQ
+    uint32_t pushed;
+    __asm__ __volatile__(
+        ".pushsection __rseq_cs, \"aw\"\n\t"
+        ".balign 32\n\t"
+        ".Lpush_cs%=:\n\t"
+        ".long 0, 0\n\t"
+        ".quad .Lpush_start%=, .Lpush_commit%= - .Lpush_start%=, .Lpush_abort%=\n\t"
+        ".popsection\n\t"
+        ".Lpush_retry%=:\n\t"
+        "leaq .Lpush_cs%=(%%rip), %%rax\n\t"
+        "movq %%rax, 8(%[area])\n\t"
+        ".Lpush_start%=:\n\t"
+        "xorl %[pushed], %[pushed]\n\t"
+        "movl 4(%[area]), %%eax\n\t"            // cpu_id
+        "imulq %[stride], %%rax\n\t"
+        "addq %[bin], %%rax\n\t"                // This CPU's bin
+        "movl (%%rax), %%ecx\n\t"               // count
+        "cmpl %[capacity], %%ecx\n\t"
+        "jae .Lpush_commit%=\n\t"
+        "movq %[ptr], 8(%%rax, %%rcx, 8)\n\t"
+        "addl $1, %%ecx\n\t"
+        "movl $1, %[pushed]\n\t"
+        "movl %%ecx, (%%rax)\n\t"               // Commit
+        ".Lpush_commit%=:\n\t"
+        ".pushsection __rseq_failure, \"ax\"\n\t"
+        ".byte 0x0f, 0xb9, 0x3d\n\t"
+        ".long %c[signature]\n\t"
+        ".Lpush_abort%=:\n\t"
+        "jmp .Lpush_retry%=\n\t"
+        ".popsection\n\t"
+        : [pushed] "=&r"(pushed)
+        : [area] "r"(area), [stride] "r"((uint64_t)sizeof(PerCpuCache)),
+          [bin] "r"(&percpu_caches[0].bins[class_index]), [ptr] "r"(ptr),
+          [capacity] "i"(PERCPU_SLOTS), [signature] "i"(RSEQ_SIGNATURE)
+        : "rax", "rcx", "memory", "cc");
+    return pushed != 0;
+#else
+    (void)area;
+    (void)class_index;
+    (void)ptr;
+    return false;
+#endif
+}
+
+static void percpu_release(void** blocks, int count) {
+    // Return blocks to their slabs. Central slabs of one pool are freed
+    // under a single acquisition of its lock; slabs a thread cache owns get
+    // the block on the owner's remote list.
+    
+    std::unique_lock<std::mutex> guard;
+    for (int i = 0; i < count; i++) {
+        SlabHeader* slab = get_slab(blocks[i]);
+        MemoryPool* pool = slab_class(slab)->pool;
+        if (guard.mutex() != &pool->lock) {
+            guard = std::unique_lock<std::mutex>(pool->lock);
+        }
+        // Ownership only changes under the pool lock, so this check holds
+        if (slab->owner.load(std::memory_order_relaxed) == nullptr) {
+            slab_free(slab, blocks[i]);
+        } else {
+            guard = std::unique_lock<std::mutex>();
+            slab_free_remote(slab, blocks[i]);
+        }
+    }
+}
+
+static void* percpu_alloc(struct rseq* area, int class_index) {
+    // Fast path: pop from this CPU's bin
+    void* ptr = percpu_pop(area, class_index);
+    if (ptr != nullptr) {
+        return ptr;
+    }
+    
+    // Slow path: take a batch from the local node's central slabs under
+    // one lock, keep one and cache the rest on this CPU (a thread that ran
+    // here meanwhile may have filled the bin; give back what does not fit)
+    void* blocks[PERCPU_BATCH_SIZE];
+    int count = 0;
+    int node = current_node(false);
+    {
+        std::lock_guard<std::mutex> guard(nodes[node].size_classes[class_index].pool->lock);
+        while (count < PERCPU_BATCH_SIZE &&
+               (blocks[count] = slab_alloc(node, class_index)) != nullptr) {
+            count++;
+        }
+    }
+    if (count == 0) {
+        return nullptr;  // Pool exhausted
+    }
+    
+    for (int i = count - 1; i > 0; i--) {
+        if (!percpu_push(area, class_index, blocks[i])) {
+            percpu_release(blocks + 1, i);
+            break;
+        }
+    }
+    return blocks[0];
+}
+
+static void percpu_free(struct rseq* area, int class_index, void* ptr) {
+    // Fast path: push onto this CPU's bin
+    if (percpu_push(area, class_index, ptr)) {
+        return;
+    }
+    
+    // The bin is full: return this block and a batch from the bin
+    void* blocks[PERCPU_BATCH_SIZE];
+    int count = 0;
+    blocks[count++] = ptr;
+    while (count < PERCPU_BATCH_SIZE &&
+           (blocks[count] = percpu_pop(area, class_index)) != nullptr) {
+        count++;
+    }
+    percpu_release(blocks, count);
+    
+    scavenge_tick();
+}
+
+static bool percpu_setup() {
+    // Map the per-CPU caches and turn the mode on, if the calling thread
+    // has rseq (caller holds init_lock)
+    
+#ifdef PERCPU_RSEQ
+    if (percpu_caches == nullptr) {
+        int highest = highest_listed_id("/sys/devices/system/cpu/possible");
+        int cpus = (highest >= 0) ? highest + 1 : (int)sysconf(_SC_NPROCESSORS_CONF);
+        if (cpus <= 0) {
+            return false;
+        }
+        void* memory = mmap(NULL, (size_t)cpus * sizeof(PerCpuCache), PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) {
+            return false;
+        }
+        percpu_caches = (PerCpuCache*)memory;
+        percpu_cpu_count = cpus;
+    }
+    
+    if (thread_rseq == nullptr) {
+        thread_rseq = rseq_register_thread();
+    }
+    if (thread_rseq == &rseq_unavailable) {
+        return false;
+    }
+    
+    percpu_enabled.store(true, std::memory_order_release);
+    log_message(false, "Per-CPU caches on for %d CPUs\n", percpu_cpu_count);
+    return true;
+#else
+    return false;
+#endif
+}
+
+static void percpu_release_all() {
+    // Empty every CPU's caches (only from allocator_cleanup, when no
+    // other thread is allocating)
+    
+    if (percpu_caches == nullptr) {
+        return;
+    }
+    for (int cpu = 0; cpu < percpu_cpu_count; cpu++) {
+        for (int i = 0; i < PERCPU_NUM_CLASSES; i++) {
+            PerCpuBin* bin = &percpu_caches[cpu].bins[i];
+            percpu_release(bin->slots, (int)bin->count);
+            bin->count = 0;
+        }
+    }
+}
+
+// ============================================================================
+// TRACING
+// ============================================================================
+
+static uint64_t monotonic_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+static void trace_write(const void* data, size_t size) {
+    // write(2) straight from the buffer; stdio could allocate
+    const char* cursor = (const char*)data;
+    while (size > 0) {
+        ssize_t written = write(trace_fd, cursor, size);
+        if (written <= 0) {
+            return;
+        }
+        cursor += written;
+        size -= written;
+    }
+}
+
+static void trace_flush_locked() {
+    trace_write(trace_buffer, trace_count * sizeof(TraceRecord));
+    trace_count = 0;
+}
+
+bool allocator_trace_start(const char* path) {
+    std::lock_guard<std::mutex> guard(trace_lock);
+    if (trace_fd >= 0) {
+        return false;  // Already tracing
+    }
+    
+    // Step 1: The buffer is mapped once and kept across traces
+    if (trace_buffer == nullptr) {
+        void* memory = mmap(NULL, TRACE_BUFFER_RECORDS * sizeof(TraceRecord),
+                            PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) {
+            return false;
+        }
+        trace_buffer = (TraceRecord*)memory;
+    }
+    
+    // Step 2: Create the file and write its header
+    trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (trace_fd < 0) {
+        log_message(true, "Failed to open trace file %s\n", path);
+        return false;
+    }
+    
+    TraceFileHeader header;
+    std::memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.record_size = sizeof(TraceRecord);
+    trace_write(&header, sizeof(header));
+    
+    trace_count = 0;
+    trace_start_ns = monotonic_ns();
+    tracing_enabled.store(true, std::memory_order_release);
+    return true;
+}
+
+void allocator_trace_stop() {
+    std::lock_guard<std::mutex> guard(trace_lock);
+    tracing_enabled.store(false, std::memory_order_relaxed);
+    if (trace_fd < 0) {
+        return;
+    }
+    
+    trace_flush_locked();
+    close(trace_fd);
+    trace_fd = -1;
+}
+
+static void trace_record(uint8_t op, size_t size, void* ptr, uint64_t arg) {
+    // Append one record; the buffer goes to the file whenever it fills up
+    
+    if (trace_thread == 0) {
+        trace_thread = trace_thread_count.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+    
+    std::lock_guard<std::mutex> guard(trace_lock);
+    if (trace_fd < 0) {
+        return;  // Stopped since the caller checked
+    }
+    
+    TraceRecord* record = &trace_buffer[trace_count++];
+    record->timestamp = monotonic_ns() - trace_start_ns;
+    record->size = size;
+    record->ptr = (uint64_t)(uintptr_t)ptr;
+    record->arg = arg;
+    record->thread = trace_thread;
+    record->op = op;
+    std::memset(record->reserved, 0, sizeof(record->reserved));
+    
+    if (trace_count == TRACE_BUFFER_RECORDS) {
+        trace_flush_locked();
+    }
+}
+
+// ============================================================================
+// HEAP PROFILING
+// ============================================================================
+
+static size_t profile_slot(void* ptr) {
+    // Blocks are ALIGNMENT-aligned, so hash the bits above (Fibonacci hashing)
+    return (size_t)(((uintptr_t)ptr / ALIGNMENT) * 0x9E3779B97F4A7C15ull) & (profile_capacity - 1);
+}
+
+static size_t profile_filter_slot(void* ptr) {
+    return (size_t)((((uintptr_t)ptr / ALIGNMENT) * 0x9E3779B97F4A7C15ull) >>
+                    (64 - PROFILE_FILTER_BITS));
+}
+
+static void profile_filter_add(void* ptr, int delta) {
+    // Only changed under profile_lock; my_free reads it without
+    std::atomic<uint16_t>* slot = &profile_filter[profile_filter_slot(ptr)];
+    slot->store((uint16_t)(slot->load(std::memory_order_relaxed) + delta),
+                std::memory_order_relaxed);
+}
+
+static bool profile_table_grow() {
+    // Double the sample table and reinsert every entry (profile_lock held)
+    
+    size_t new_capacity = (profile_capacity == 0) ? 1024 : profile_capacity * 2;
+    void* memory = mmap(NULL, new_capacity * sizeof(ProfileSample), PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        return false;
+    }
+    
+    ProfileSample* old_table = profile_samples;
+    size_t old_capacity = profile_capacity;
+    profile_samples = (ProfileSample*)memory;  // Zeroed by the kernel: all empty
+    profile_capacity = new_capacity;
+    
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old_table[i].ptr != nullptr) {
+            size_t slot = profile_slot(old_table[i].ptr);
+            while (profile_samples[slot].ptr != nullptr) {
+                slot = (slot + 1) & (profile_capacity - 1);
+            }
+            profile_samples[slot] = old_table[i];
+        }
+    }
+    
+    if (old_table != nullptr) {
+        munmap(old_table, old_capacity * sizeof(ProfileSample));
+    }
+    return true;
+}
+
+static ProfileSample* profile_find(void* ptr) {
+    // Linear probe until the entry or an empty slot (profile_lock held)
+    
+    if (profile_capacity == 0) {
+        return nullptr;
+    }
+    
+    size_t slot = profile_slot(ptr);
+    while (profile_samples[slot].ptr != nullptr) {
+        if (profile_samples[slot].ptr == ptr) {
+            return &profile_samples[slot];
+        }
+        slot = (slot + 1) & (profile_capacity - 1);
+    }
+    return nullptr;
+}
+
+static void profile_erase(ProfileSample* entry) {
+    // Take a freed object out of its bucket's live counts and the table,
+    // with the backward-shift deletion huge_erase uses (profile_lock held)
+    
+    entry->bucket->live_objects--;
+    entry->bucket->live_bytes -= entry->size;
+    profile_filter_add(entry->ptr, -1);
+    
+    size_t hole = entry - profile_samples;
+    size_t slot = hole;
+    while (true) {
+        slot = (slot + 1) & (profile_capacity - 1);
+        if (profile_samples[slot].ptr == nullptr) {
+            break;
+        }
+        
+        size_t home = profile_slot(profile_samples[slot].ptr);
+        bool home_in_range = (hole <= slot) ? (hole < home && home <= slot)
+                                            : (hole < home || home <= slot);
+        if (!home_in_range) {
+            profile_samples[hole] = profile_samples[slot];
+            hole = slot;
+        }
+    }
+    
+    profile_samples[hole].ptr = nullptr;
+    profile_live.store(profile_live.load(std::memory_order_relaxed) - 1,
+                       std::memory_order_relaxed);
+}
+
+static bool profile_insert(void* ptr, size_t size, ProfileBucket* bucket) {
+    // Add a live object to the table and its bucket's live counts, keeping
+    // the load factor under 1/2 (profile_lock held)
+    
+    size_t live = profile_live.load(std::memory_order_relaxed);
+    if ((live + 1) * 2 > profile_capacity && !profile_table_grow()) {
+        return false;
+    }
+    
+    size_t slot = profile_slot(ptr);
+    while (profile_samples[slot].ptr != nullptr) {
+        slot = (slot + 1) & (profile_capacity - 1);
+    }
+    profile_samples[slot].ptr = ptr;
+    profile_samples[slot].size = size;
+    profile_samples[slot].bucket = bucket;
+    profile_filter_add(ptr, 1);
+    profile_live.store(live + 1, std::memory_order_relaxed);
+    
+    bucket->live_objects++;
+    bucket->live_bytes += size;
+    return true;
+}
+
+static ProfileBucket* profile_bucket(void* const* frames, int depth) {
+    // Find the bucket of a stack, or add one (profile_lock held). Buckets
+    // are never freed: a stack seen once is likely to be seen again.
+    
+    uint64_t hash = (uint64_t)depth;
+    for (int i = 0; i < depth; i++) {
+        hash = (hash ^ (uintptr_t)frames[i]) * 0x9E3779B97F4A7C15ull;
+        hash ^= hash >> 32;
+    }
+    
+    ProfileBucket** chain = &profile_buckets[hash % PROFILE_BUCKET_SLOTS];
+    for (ProfileBucket* bucket = *chain; bucket != nullptr; bucket = bucket->next) {
+        if (bucket->hash == hash && bucket->depth == (uint32_t)depth &&
+            std::memcmp(bucket->frames, frames, depth * sizeof(void*)) == 0) {
+            return bucket;
+        }
+    }
+    
+    void* no_recycled = nullptr;
+    ProfileBucket* bucket = (ProfileBucket*)meta_alloc(&no_recycled, sizeof(ProfileBucket));
+    if (bucket == nullptr) {
+        return nullptr;
+    }
+    std::memset(bucket, 0, sizeof(ProfileBucket));
+    bucket->hash = hash;
+    bucket->depth = (uint32_t)depth;
+    std::memcpy(bucket->frames, frames, depth * sizeof(void*));
+    bucket->next = *chain;
+    *chain = bucket;
+    return bucket;
+}
+
+static void profile_clear_samples() {
+    // Forget every live sample (profile_lock held); buckets keep their
+    // cumulative counts
+    
+    for (size_t i = 0; i < profile_capacity; i++) {
+        if (profile_samples[i].ptr != nullptr) {
+            profile_samples[i].bucket->live_objects = 0;
+            profile_samples[i].bucket->live_bytes = 0;
+            profile_samples[i].ptr = nullptr;
+        }
+    }
+    for (size_t i = 0; i < (1 << PROFILE_FILTER_BITS); i++) {
+        profile_filter[i].store(0, std::memory_order_relaxed);
+    }
+    profile_live.store(0, std::memory_order_relaxed);
+}
+
+static int64_t sample_gap(size_t interval) {
+    // Bytes to the next sample point, exponentially distributed with the
+    // given mean (xorshift64* for the uniform draw)
+    
+    sample_rng ^= sample_rng >> 12;
+    sample_rng ^= sample_rng << 25;
+    sample_rng ^= sample_rng >> 27;
+    uint64_t bits = sample_rng * 0x2545F4914F6CDD1Dull;
+    double uniform = (double)((bits >> 11) + 1) / 9007199254740992.0;  // (0, 1]
+    return (int64_t)(-std::log(uniform) * (double)interval) + 1;
+}
+
+static void profile_warm_up() {
+    // The first backtrace loads the unwinder, which allocates; get that
+    // done before a sample needs it
+    void* frame;
+    in_profiler = true;
+    backtrace(&frame, 1);
+    in_profiler = false;
+}
+
+__attribute__((noinline)) static void profile_sample(void* ptr, size_t size) {
+    // The countdown ran out: draw the next gap, and record the allocation
+    // that crossed the sample point. Kept out of line so the countdown
+    // inlines into every allocation entry point.
+    
+    if (in_profiler) {
+        return;  // Allocated by backtrace itself
+    }
+    
+    if (!profiling_enabled.load(std::memory_order_relaxed)) {
+        sample_countdown = PROFILE_SAMPLE_INTERVAL;  // Look again after a while
+        return;
+    }
+    
+    // Step 1: The first countdown of a thread ends at 0, not at a random
+    // point, so it only arms the real one
+    bool armed = (sample_rng != 0);
+    if (!armed) {
+        sample_rng = (monotonic_ns() ^ (uintptr_t)&sample_rng) | 1;
+    }
+    sample_countdown = sample_gap(profile_interval.load(std::memory_order_relaxed));
+    if (!armed || ptr == nullptr) {
+        return;
+    }
+    
+    // Step 2: Capture the stack before locking, leaving out this function
+    // and the entry point profile_note_alloc is inlined into, so it starts
+    // at their caller
+    void* frames[PROFILE_MAX_DEPTH + 2];
+    in_profiler = true;
+    int depth = backtrace(frames, PROFILE_MAX_DEPTH + 2) - 2;
+    in_profiler = false;
+    if (depth < 0) {
+        depth = 0;
+    }
+    
+    // Step 3: Count the sample in its stack's bucket and remember the
+    // object for my_free
+    std::lock_guard<std::mutex> guard(profile_lock);
+    ProfileBucket* bucket = profile_bucket(frames + 2, depth);
+    if (bucket == nullptr || !profile_insert(ptr, size, bucket)) {
+        return;
+    }
+    bucket->alloc_objects++;
+    bucket->alloc_bytes += size;
+}
+
+__attribute__((noinline)) static void profile_forget(void* ptr, ProfileSample* taken) {
+    // Drop ptr's sample, handing a copy to taken (if not NULL) so that it
+    // can be put back
+    std::lock_guard<std::mutex> guard(profile_lock);
+    ProfileSample* entry = profile_find(ptr);
+    if (entry != nullptr) {
+        if (taken != nullptr) {
+            *taken = *entry;
+        }
+        profile_erase(entry);
+    }
+    // Otherwise ptr only shares a filter slot with a sampled object
+}
+
+__attribute__((noinline)) static void profile_restore(const ProfileSample* sample) {
+    // Put back a sample profile_forget took for a block that stayed live
+    // (its cumulative counts were never taken out)
+    std::lock_guard<std::mutex> guard(profile_lock);
+    profile_insert(sample->ptr, sample->size, sample->bucket);
+}
+
+static inline __attribute__((always_inline)) void profile_note_alloc(void* ptr, size_t size) {
+    // Called by every allocation entry point: one thread-local subtraction
+    // unless this allocation crosses the thread's next sample point
+    sample_countdown -= (int64_t)size;
+    if (sample_countdown < 0) {
+        profile_sample(ptr, size);
+    }
+}
+
+static inline __attribute__((always_inline)) void profile_note_free(void* ptr,
+                                                                     ProfileSample* taken = nullptr) {
+    // Called before the block is freed, so its address cannot be handed
+    // out (and sampled) again while it is still in the table
+    if (profile_live.load(std::memory_order_relaxed) != 0 &&
+        profile_filter[profile_filter_slot(ptr)].load(std::memory_order_relaxed) != 0) {
+        profile_forget(ptr, taken);
+    }
+}
+
+void allocator_profile_start(size_t sample_interval) {
+    if (sample_interval != 0) {
+        profile_interval.store(sample_interval, std::memory_order_relaxed);
+    }
+    
+    // During init (MYALLOC_CONF) allocating would deadlock;
+    // finish_first_init warms up instead
+    if (allocator_initialized.load(std::memory_order_acquire)) {
+        profile_warm_up();
+    }
+    
+    // Drop the samples and counts of an earlier run
+    std::lock_guard<std::mutex> guard(profile_lock);
+    profile_clear_samples();
+    for (size_t i = 0; i < PROFILE_BUCKET_SLOTS; i++) {
+        for (ProfileBucket* bucket = profile_buckets[i]; bucket != nullptr; bucket = bucket->next) {
+            bucket->alloc_objects = 0;
+            bucket->alloc_bytes = 0;
+        }
+    }
+    profiling_enabled.store(true, std::memory_order_relaxed);
+    
+    // This thread draws its next gap right away; others notice within
+    // PROFILE_SAMPLE_INTERVAL bytes
+    sample_countdown = 0;
+}
+
+void allocator_profile_stop() {
+    profiling_enabled.store(false, std::memory_order_relaxed);
+}
+
+// Output of allocator_profile_dump, written out whenever the buffer fills
+struct ProfileWriter {
+    int fd;
+    size_t used;
+    char buffer[8192];
+};
+
+static void profile_flush(ProfileWriter* writer) {
+    // write(2) straight from the buffer; stdio could allocate
+    const char* cursor = writer->buffer;
+    while (writer->used > 0) {
+        ssize_t written = write(writer->fd, cursor, writer->used);
+        if (written <= 0) {
+            break;
+        }
+        cursor += written;
+        writer->used -= written;
+    }
+    writer->used = 0;
+}
+
+static void profile_print(ProfileWriter* writer, const char* format, ...) {
+    // Lines are far shorter than the buffer, so one flush always makes room
+    for (int attempt = 0; attempt < 2; attempt++) {
+        size_t room = sizeof(writer->buffer) - writer->used;
+        va_list args;
+        va_start(args, format);
+        int length = vsnprintf(writer->buffer + writer->used, room, format, args);
+        va_end(args);
+        if (length < 0) {
+            return;
+        }
+        if ((size_t)length < room) {
+            writer->used += length;
+            return;
+        }
+        profile_flush(writer);
+    }
+}
+
+bool allocator_profile_dump(const char* path) {
+    ProfileWriter writer;
+    writer.used = 0;
+    writer.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (writer.fd < 0) {
+        log_message(true, "Failed to open profile file %s\n", path);
+        return false;
+    }
+    
+    {
+        std::lock_guard<std::mutex> guard(profile_lock);
+        
+        // Step 1: Header with the totals; heap_v2 tells pprof how to scale
+        // samples back up
+        unsigned long long totals[4] = {0, 0, 0, 0};
+        for (size_t i = 0; i < PROFILE_BUCKET_SLOTS; i++) {
+            for (ProfileBucket* bucket = profile_buckets[i]; bucket != nullptr;
+                 bucket = bucket->next) {
+                totals[0] += bucket->live_objects;
+                totals[1] += bucket->live_bytes;
+                totals[2] += bucket->alloc_objects;
+                totals[3] += bucket->alloc_bytes;
+            }
+        }
+        profile_print(&writer, "heap profile: %llu: %llu [%llu: %llu] @ heap_v2/%zu\n",
+                      totals[0], totals[1], totals[2], totals[3],
+                      profile_interval.load(std::memory_order_relaxed));
+        
+        // Step 2: One line per stack sampled during this run
+        for (size_t i = 0; i < PROFILE_BUCKET_SLOTS; i++) {
+            for (ProfileBucket* bucket = profile_buckets[i]; bucket != nullptr;
+                 bucket = bucket->next) {
+                if (bucket->alloc_objects == 0 && bucket->live_objects == 0) {
+                    continue;
+                }
+                profile_print(&writer, "%llu: %llu [%llu: %llu] @",
+                              (unsigned long long)bucket->live_objects,
+                              (unsigned long long)bucket->live_bytes,
+                              (unsigned long long)bucket->alloc_objects,
+                              (unsigned long long)bucket->alloc_bytes);
+                for (uint32_t f = 0; f < bucket->depth; f++) {
+                    profile_print(&writer, " 0x%lx", (unsigned long)(uintptr_t)bucket->frames[f]);
+                }
+                profile_print(&writer, "\n");
+            }
+        }
+    }
+    
+    // Step 3: The process's mappings, for pprof to symbolize addresses with
+    profile_print(&writer, "\nMAPPED_LIBRARIES:\n");
+    profile_flush(&writer);
+    int maps = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+    if (maps >= 0) {
+        ssize_t length;
+        while ((length = read(maps, writer.buffer, sizeof(writer.buffer))) > 0) {
+            writer.used = (size_t)length;
+            profile_flush(&writer);
+        }
+        close(maps);
+    }
+    
+    close(writer.fd);
+    return true;
+}
+
+// ============================================================================
+// SCAVENGER
+// ============================================================================
+
+static size_t scavenge_block(BlockHeader* block, size_t page, bool force) {
+    // Release the whole pages inside one free block once it has aged
+    
+    if ((block->size_and_flags & BLOCK_PURGED) != 0) {
+        return 0;
+    }
+    
+    uintptr_t start = (uintptr_t)block + sizeof(BlockHeader) + sizeof(FreeTreeNode);
+    uintptr_t end = (uintptr_t)block + block_size(block) - sizeof(size_t);
+    start = (start + page - 1) & ~(uintptr_t)(page - 1);
+    end &= ~(uintptr_t)(page - 1);
+    if (end <= start) {
+        return 0;  // No whole page inside
+    }
+    
+    if ((block->size_and_flags & BLOCK_AGED) == 0 && !force) {
+        block->size_and_flags |= BLOCK_AGED;
+        return 0;
+    }
+    madvise((void*)start, end - start, MADV_DONTNEED);
+    block->size_and_flags |= BLOCK_PURGED;
+    return end - start;
+}
+
+static size_t scavenge_tree(BlockHeader* root, size_t page, bool force) {
+    // Every block of a free tree, skipping subtrees with nothing a page long
+    if (tree_max_size(root) < page) {
+        return 0;
+    }
+    FreeTreeNode* node = tree_node(root);
+    return scavenge_block(root, page, force) + scavenge_tree(node->left, page, force) +
+           scavenge_tree(node->right, page, force);
+}
+
+static size_t scavenge_pool(MemoryPool* pool, bool force) {
+    // Release free memory that has stayed free since the previous pass
+    // (caller holds the pool lock). The first pass to see a free slab or
+    // block only marks it aged; reuse or coalescing clears the mark.
+    
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t released = 0;
+    
+    // Slab pools: whole empty slabs (unless releasing them would split
+    // huge pages)
+    if (pool->slab_size != 0 && pool->huge_pages) {
+        return 0;
+    }
+    if (pool->slab_size != 0) {
+        for (SlabHeader* slab = pool->free_slabs; slab != nullptr; slab = slab->next) {
+            if (slab->scavenge_state == SCAVENGE_PURGED) {
+                continue;
+            }
+            if (slab->scavenge_state == SCAVENGE_DIRTY && !force) {
+                slab->scavenge_state = SCAVENGE_AGED;
+                continue;
+            }
+            madvise(slab->base, pool->slab_size, MADV_DONTNEED);
+            slab->scavenge_state = SCAVENGE_PURGED;
+            released += pool->slab_size;
+        }
+        pool->released_bytes += released;
+        return released;
+    }
+    
+    // Variable-size pools: the whole pages inside each free block. The
+    // header and links at the front and the footer at the back stay put.
+    if (pool->fit_policy != FIT_GOOD) {
+        released = scavenge_tree(pool->free_tree, page, force);
+        pool->released_bytes += released;
+        return released;
+    }
+    
+    // Lists below a page cannot hold one, so start at the page's row.
+    int first_fl;
+    int first_sl;
+    free_list_index(page, &first_fl, &first_sl);
+    for (int fl = first_fl; fl < TLSF_FL_COUNT; fl++) {
+        if ((pool->fl_bitmap & (1u << fl)) == 0) {
+            continue;
+        }
+        for (int sl = 0; sl < TLSF_SL_COUNT; sl++) {
+            for (BlockHeader* block = pool->free_lists[fl][sl]; block != nullptr;
+                 block = block_links(block)->next_free) {
+                released += scavenge_block(block, page, force);
+            }
+        }
+    }
+    pool->released_bytes += released;
+    return released;
+}
+
+size_t allocator_scavenge(bool force) {
+    if (!allocator_initialized) {
+        return 0;
+    }
+    
+    // One pool at a time, so allocation elsewhere carries on meanwhile
+    MemoryPool* pools[MAX_NUMA_NODES * 4];
+    int pool_count = collect_pools(pools);
+    size_t released = 0;
+    for (int i = 0; i < pool_count; i++) {
+        std::lock_guard<std::mutex> guard(pools[i]->lock);
+        released += scavenge_pool(pools[i], force);
+    }
+    
+    if (released > 0) {
+        log_message(false, "Scavenger released %zu bytes\n", released);
+    }
+    return released;
+}
+
+static void scavenge_tick() {
+    // Called on free paths (no locks held): run a pass if a decay period
+    // has gone by, on whichever thread gets there first
+    
+    long decay_ms = scavenge_decay_ms.load(std::memory_order_relaxed);
+    if (decay_ms < 0) {
+        return;
+    }
+    
+    uint64_t now = monotonic_ns();
+    uint64_t due = next_scavenge_ns.load(std::memory_order_relaxed);
+    if (now < due ||
+        !next_scavenge_ns.compare_exchange_strong(due, now + (uint64_t)decay_ms * 1000000ull,
+                                                  std::memory_order_relaxed)) {
+        return;
+    }
+    
+    allocator_scavenge(false);
+}
+
+static void* scavenger_main(void* /* arg */) {
+    while (scavenger_running.load(std::memory_order_relaxed)) {
+        long decay_ms = scavenge_decay_ms.load(std::memory_order_relaxed);
+        long sleep_ms = (decay_ms > 0) ? decay_ms : SCAVENGE_DECAY_MS;
+        
+        // Sleep in short steps so allocator_cleanup does not wait long
+        for (long slept = 0; slept < sleep_ms && scavenger_running.load(); slept += 10) {
+            struct timespec step = {0, 10 * 1000000L};
+            nanosleep(&step, nullptr);
+        }
+        
+        if (decay_ms >= 0 && scavenger_running.load()) {
+            scavenge_tick();
+        }
+    }
+    return nullptr;
+}
+
+bool allocator_start_scavenger() {
+    allocator_init();
+    
+    if (scavenger_running.exchange(true)) {
+        return true;  // Already running
+    }
+    if (pthread_create(&scavenger_thread, nullptr, scavenger_main, nullptr) != 0) {
+        scavenger_running.store(false);
+        return false;
+    }
+    return true;
+}
+
+// ============================================================================
+// STATISTICS COUNTERS
+// ============================================================================
+
+__attribute__((noinline)) static ThreadStats* thread_stats_attach() {
+    // First count on this thread: adopt the ThreadStats of an exited
+    // thread (counts and all), or carve a new one and list it. Kept out of
+    // line so count_slab_calls inlines into the malloc path.
+    
+    if (!stats_key_created) {
+        return nullptr;
+    }
+    
+    ThreadStats* stats;
+    {
+        std::lock_guard<std::mutex> guard(stats_lock);
+        stats = stats_free_list;
+        if (stats != nullptr) {
+            stats_free_list = stats->next_free;
+        } else {
+            // Recycled ones come from stats_free_list, so meta_alloc only
+            // ever carves fresh memory here
+            void* no_recycled = nullptr;
+            stats = (ThreadStats*)meta_alloc(&no_recycled, sizeof(ThreadStats));
+            if (stats == nullptr) {
+                return nullptr;  // Uncounted, like a thread with no cache
+            }
+            for (int i = 0; i < NUM_SIZE_CLASSES; i++) {
+                stats->allocs[i].store(0, std::memory_order_relaxed);
+                stats->frees[i].store(0, std::memory_order_relaxed);
+            }
+            stats->next = stats_list;
+            stats_list = stats;
+        }
+        stats->next_free = nullptr;
+    }
+    
+    thread_stats = stats;
+    pthread_setspecific(stats_key, stats);
+    return stats;
+}
+
+static void stats_thread_exit(void* arg) {
+    // pthread key destructor: the counts stay listed for snapshots
+    ThreadStats* stats = (ThreadStats*)arg;
+    thread_stats = nullptr;
+    
+    std::lock_guard<std::mutex> guard(stats_lock);
+    stats->next_free = stats_free_list;
+    stats_free_list = stats;
+}
+
+static void count_slab_calls(bool alloc, int class_index, size_t count) {
+    // Only this thread writes its counters, so a relaxed load and store
+    // is enough; snapshots read them from other threads
+    
+    ThreadStats* stats = thread_stats;
+    if (stats == nullptr && (stats = thread_stats_attach()) == nullptr) {
+        return;
+    }
+    std::atomic<uint64_t>* counter = alloc ? &stats->allocs[class_index]
+                                           : &stats->frees[class_index];
+    counter->store(counter->load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+}
+
+// ============================================================================
+// PUBLIC API
+// ============================================================================
+
+static void* class_alloc_untraced(int class_index) {
+    // Served from the CPU's or the thread's cache without locking, or from
+    // the shared pool when this thread has no cache
+    
+    void* ptr;
+    struct rseq* area = percpu_area(class_index);
+    ThreadCache* cache;
+    if (area != nullptr) {
+        ptr = percpu_alloc(area, class_index);
+    } else if ((cache = get_thread_cache()) != nullptr) {
+        CacheBin* bin = &cache->bins[class_index];
+        if (bin->count == 0 && thread_cache_refill(cache, class_index) == 0) {
+            return nullptr;  // Pool exhausted
+        }
+        ptr = bin->slots[--bin->count];
+    } else {
+        int node = current_node(false);
+        std::lock_guard<std::mutex> guard(nodes[node].size_classes[class_index].pool->lock);
+        ptr = slab_alloc(node, class_index);
+    }
+    
+    if (ptr != nullptr) {
+        count_slab_calls(true, class_index, 1);
+    }
+    return ptr;
+}
+
+static void* malloc_untraced(size_t size) {
+    // Route a request by size: a slab size class (through the CPU's or
+    // thread's cache), a variable-size block, or a mapping of its own
+    
+    if (!allocator_initialized) {
+        allocator_init();
+    }
+    
+    if (size == 0) {
+        return nullptr;  // The malloc shim asks for 1 byte instead
+    }
+    
+    // Small requests come from slabs of their size class
+    if (size <= LARGE_BLOCK_MAX) {
+        return class_alloc_untraced(size_class_index(size));
+    }
+    
+    // Huge requests get their own mapping
+    if (size >= MMAP_THRESHOLD) {
+        return huge_alloc(size);
+    }
+    
+    // Everything in between is a variable-size block of the xlarge pool
+    MemoryPool* pool = select_pool(size);
+    std::lock_guard<std::mutex> guard(pool->lock);
+    return allocate_from_pool(pool, size);
+}
+
+static void free_untraced(void* ptr) {
+    // Main free function - frees memory allocated by my_malloc()
+    
+    if (ptr == nullptr) {
+        return;  // Freeing NULL is safe (like standard free)
+    }
+    
+    // Step 1: One page map lookup tells us what kind of block this is
+    PageMapEntry* entry = page_map_lookup(ptr);
+    uint8_t kind = (entry != nullptr) ? entry->kind : (uint8_t)PAGE_UNUSED;
+    
+    // Step 2: Slab slots carry no header; the page map knows the size class
+    if (kind == PAGE_SLAB) {
+        int class_index = entry->size_class;
+        count_slab_calls(false, class_index, 1);
+        
+        // Per-CPU mode: any slot of a cached class goes to this CPU's bin
+        struct rseq* area = percpu_area(class_index);
+        if (area != nullptr) {
+            percpu_free(area, class_index, ptr);
+            return;
+        }
+        
+        // Common case: the slab is ours, so park the slot in this thread's
+        // cache without locking
+        ThreadCache* cache = get_thread_cache();
+        if (cache != nullptr &&
+            entry->slab->owner.load(std::memory_order_acquire) == cache) {
+            // A full magazine keeps tcache.batch fewer than it may hold
+            CacheBin* bin = &cache->bins[class_index];
+            uint32_t limit = tcache_max.load(std::memory_order_relaxed);
+            if (bin->count >= limit) {
+                uint32_t batch = tcache_batch.load(std::memory_order_relaxed);
+                thread_cache_flush_bin(cache, class_index, bin->count - limit + batch);
+            }
+            bin->slots[bin->count++] = ptr;
+            return;
+        }
+        
+        // Another thread's slab: hand the slot to its owner lock-free
+        slab_free_remote(entry->slab, ptr);
+        return;
+    }
+    
+    // Step 3: Variable-size blocks go back to the pool's free list
+    if (kind == PAGE_BLOCK) {
+        {
+            std::lock_guard<std::mutex> guard(entry->pool->lock);
+            free_to_pool(entry->pool, get_header(ptr));
+        }
+        scavenge_tick();
+        return;
+    }
+    
+    // Step 4: Huge mappings go straight back to the OS
+    if (kind == PAGE_HUGE && huge_free(ptr)) {
+        return;
+    }
+    
+    // Block doesn't belong to any pool - invalid pointer or corruption
+    log_message(true, "Warning: Attempted to free invalid pointer\n");
+}
+
+static void* calloc_untraced(size_t num, size_t size) {
+    // malloc plus zeroing, skipped for huge mappings the kernel zeroed
+    
+    size_t total_size = num * size;
+    
+    // Check for overflow
+    if (num != 0 && total_size / num != size) {
+        return nullptr;  // Overflow
+    }
+    
+    void* ptr = malloc_untraced(total_size);
+    
+    // Huge allocations are fresh anonymous mappings, already zeroed
+    if (ptr != nullptr && total_size < MMAP_THRESHOLD) {
+        std::memset(ptr, 0, total_size);
+    }
+    
+    return ptr;
+}
+
+static void* realloc_untraced(void* ptr, size_t size) {
+    // Reallocate memory - resize an existing allocation
+    
+    // Handle NULL ptr (like malloc)
+    if (ptr == nullptr) {
+        return malloc_untraced(size);
+    }
+    
+    // Handle zero size (like free)
+    if (size == 0) {
+        free_untraced(ptr);
+        return nullptr;
+    }
+    
+    // Get the usable size of the old block
+    size_t old_user_size = my_malloc_usable_size(ptr);
+    if (old_user_size == 0) {
+        return nullptr;  // Invalid pointer
+    }
+    
+    size_t aligned_new_size = align_size(size);
+    PageMapEntry* entry = page_map_lookup(ptr);
+    
+    // Huge blocks: let the kernel grow or shrink the mapping, or move the
+    // data into a pool once it drops below the threshold
+    if (entry->kind == PAGE_HUGE) {
+        if (size >= MMAP_THRESHOLD) {
+            return huge_realloc(ptr, size);
+        }
+        
+        void* new_ptr = malloc_untraced(size);
+        if (new_ptr != nullptr) {
+            std::memcpy(new_ptr, ptr, size);
+            huge_free(ptr);
+        }
+        return new_ptr;
+    }
+    
+    // Variable-size blocks: grow into a free neighbour or trim the tail
+    if (entry->kind == PAGE_BLOCK) {
+        std::lock_guard<std::mutex> guard(entry->pool->lock);
+        if (resize_in_place(entry->pool, get_header(ptr), size)) {
+            return ptr;
+        }
+    }
+    
+    // Slab slots: any size up to the slot size fits the existing block
+    if (aligned_new_size <= old_user_size) {
+        return ptr;  // Can use existing block
+    }
+    
+    // New size is larger - need to allocate new block and copy data
+    void* new_ptr = malloc_untraced(size);
+    if (new_ptr == nullptr) {
+        return nullptr;  // Allocation failed
+    }
+    
+    // Copy old data to new location
+    // Copy the minimum of old and new sizes
+    size_t copy_size = (old_user_size < aligned_new_size) ? old_user_size : aligned_new_size;
+    std::memcpy(new_ptr, ptr, copy_size);
+    
+    // Free the old block
+    free_untraced(ptr);
+    
+    return new_ptr;
+}
+
+// Traced entry points: each wraps its *_untraced worker, so a call made on
+// behalf of another (calloc -> malloc) is recorded once
+
+void* my_malloc(size_t size) {
+    void* ptr = malloc_untraced(size);
+    profile_note_alloc(ptr, size);
+    if (tracing_enabled.load(std::memory_order_relaxed)) {
+        trace_record(TRACE_MALLOC, size, ptr, 0);
+    }
+    return ptr;
+}
+
+void my_free(void* ptr) {
+    if (ptr == nullptr) {
+        return;
+    }
+    if (tracing_enabled.load(std::memory_order_relaxed)) {
+        trace_record(TRACE_FREE, 0, ptr, 0);
+    }
+    profile_note_free(ptr);
+    free_untraced(ptr);
+}
+
+void* my_calloc(size_t num, size_t size) {
+    void* ptr = calloc_untraced(num, size);
+    if (ptr != nullptr) {
+        profile_note_alloc(ptr, num * size);
+    }
+    if (tracing_enabled.load(std::memory_order_relaxed)) {
+        trace_record(TRACE_CALLOC, num * size, ptr, num);
+    }
+    return ptr;
+}
+
+void* my_realloc(void* ptr, size_t size) {
+    // Counted as a free and a new allocation. The old block may be freed
+    // inside, so its sample leaves the profile first; if realloc fails the
+    // block is still live and the sample goes back.
+    ProfileSample old_sample = {};
+    if (ptr != nullptr) {
+        profile_note_free(ptr, &old_sample);
+    }
+    void* new_ptr = realloc_untraced(ptr, size);
+    if (new_ptr != nullptr) {
+        profile_note_alloc(new_ptr, size);
+    } else if (old_sample.ptr != nullptr && size != 0) {
+        profile_restore(&old_sample);
+    }
+    if (tracing_enabled.load(std::memory_order_relaxed)) {
+        trace_record(TRACE_REALLOC, size, new_ptr, (uint64_t)(uintptr_t)ptr);
+    }
+    return new_ptr;
+}
+
+void* my_malloc_class(int class_index) {
+    if (!allocator_initialized) {
+        allocator_init();
+    }
+    
+    void* ptr = class_alloc_untraced(class_index);
+    profile_note_alloc(ptr, size_class_size(class_index));
+    if (tracing_enabled.load(std::memory_order_relaxed)) {
+        trace_record(TRACE_MALLOC, size_class_size(class_index), ptr, 0);
+    }
+    return ptr;
+}
+
+size_t my_malloc_usable_size(void* ptr) {
+    // Bytes the caller may use at ptr (0 for pointers we do not own)
+    
+    if (ptr == nullptr) {
+        return 0;
+    }
+    
+    PageMapEntry* entry = page_map_lookup(ptr);
+    if (entry == nullptr) {
+        return 0;
+    }
+    
+    switch (entry->kind) {
+        case PAGE_SLAB:
+            return size_class_size(entry->size_class);
+        case PAGE_BLOCK:
+            return block_size(get_header(ptr)) - sizeof(BlockHeader);
+        case PAGE_HUGE:
+            return entry->span_size;
+        default:
+            return 0;
+    }
+}
+
+static void* aligned_alloc_untraced(size_t alignment, size_t size) {
+    // Alignment comes from where blocks already sit rather than from padding:
+    // slab slots lie at multiples of their slot size from a page-aligned slab,
+    // variable-size blocks can be split at any ALIGNMENT boundary, and huge
+    // mappings start on a page (or coarser) boundary
+    
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0 || size == 0) {
+        return nullptr;
+    }
+    
+    // Step 1: Every block is at least ALIGNMENT-aligned
+    if (alignment <= ALIGNMENT) {
+        return malloc_untraced(size);
+    }
+    
+    // Step 2: Small requests take a size class whose slot size is a multiple
+    // of the alignment; the power-of-two classes always qualify
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t rounded = (size + alignment - 1) & ~(alignment - 1);
+    if (alignment <= page && rounded <= LARGE_BLOCK_MAX) {
+        if (size_class_size(size_class_index(rounded)) % alignment != 0) {
+            size_t power = alignment;
+            while (power < rounded) {
+                power <<= 1;
+            }
+            rounded = power;
+        }
+        return malloc_untraced(rounded);
+    }
+    
+    // Step 3: Mid-size requests (and small ones with coarse alignment) are
+    // carved out of a variable-size block at an aligned offset
+    allocator_init();
+    if (size < MMAP_THRESHOLD && alignment < MMAP_THRESHOLD) {
+        MemoryPool* pool = &nodes[current_node(false)].xlarge_pool;
+        std::lock_guard<std::mutex> guard(pool->lock);
+        return allocate_aligned_from_pool(pool, size, alignment);
+    }
+    
+    // Step 4: Huge requests get their own aligned mapping
+    return huge_alloc(size, alignment);
+}
+
+void* my_aligned_alloc(size_t alignment, size_t size) {
+    void* ptr = aligned_alloc_untraced(alignment, size);
+    profile_note_alloc(ptr, size);
+    if (tracing_enabled.load(std::memory_order_relaxed)) {
+        trace_record(TRACE_ALIGNED_ALLOC, size, ptr, alignment);
+    }
+    return ptr;
+}
+
+int my_posix_memalign(void** memptr, size_t alignment, size_t size) {
+    if (alignment < sizeof(void*) || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    
+    void* ptr = my_aligned_alloc(alignment, size == 0 ? 1 : size);
+    if (ptr == nullptr) {
+        return ENOMEM;
+    }
+    
+    *memptr = ptr;
+    return 0;
+}
+
+// ============================================================================
+// BATCH ALLOCATION
+// ============================================================================
+
+static size_t cache_alloc_batch(ThreadCache* cache, int class_index, size_t count, void** out) {
+    // Empty the magazine first, then carve the rest straight from owned
+    // slabs rather than cycling it through the magazine
+    
+    CacheBin* bin = &cache->bins[class_index];
+    if (bin->count < count) {
+        thread_cache_drain(cache, class_index);
+    }
+    
+    size_t filled = 0;
+    while (filled < count) {
+        if (bin->count > 0) {
+            size_t take = count - filled;
+            if (take > bin->count) {
+                take = bin->count;
+            }
+            bin->count -= (uint32_t)take;
+            std::memcpy(out + filled, bin->slots + bin->count, take * sizeof(void*));
+            filled += take;
+            continue;
+        }
+        
+        void* ptr = owned_slab_alloc(cache, class_index);
+        if (ptr != nullptr) {
+            out[filled++] = ptr;
+        } else if (!slab_claim(cache, class_index)) {
+            break;  // Pool exhausted
+        }
+    }
+    
+    return filled;
+}
+
+static size_t malloc_batch_untraced(size_t size, size_t count, void** out) {
+    if (!allocator_initialized) {
+        allocator_init();
+    }
+    
+    if (size == 0 || count == 0) {
+        return 0;
+    }
+    
+    // Step 1: Slab sizes come from the CPU's or the thread's cache
+    if (size <= LARGE_BLOCK_MAX) {
+        int class_index = size_class_index(size);
+        struct rseq* area = percpu_area(class_index);
+        if (area != nullptr) {
+            size_t filled = 0;
+            while (filled < count && (out[filled] = percpu_alloc(area, class_index)) != nullptr) {
+                filled++;
+            }
+            count_slab_calls(true, class_index, filled);
+            return filled;
+        }
+        
+        ThreadCache* cache = get_thread_cache();
+        if (cache != nullptr) {
+            size_t filled = cache_alloc_batch(cache, class_index, count, out);
+            count_slab_calls(true, class_index, filled);
+            return filled;
+        }
+    }
+    
+    // Step 2: Huge requests each need their own mapping
+    size_t filled = 0;
+    if (size >= MMAP_THRESHOLD) {
+        while (filled < count && (out[filled] = huge_alloc(size)) != nullptr) {
+            filled++;
+        }
+        return filled;
+    }
+    
+    // Step 3: Everything else under a single acquisition of the local
+    // node's pool lock
+    int node = current_node(false);
+    MemoryPool* pool = select_node_pool(&nodes[node], size);
+    std::lock_guard<std::mutex> guard(pool->lock);
+    if (pool->slab_size != 0) {
+        int class_index = size_class_index(size);
+        while (filled < count && (out[filled] = slab_alloc(node, class_index)) != nullptr) {
+            filled++;
+        }
+        count_slab_calls(true, class_index, filled);
+    } else {
+        while (filled < count && (out[filled] = allocate_from_pool(pool, size)) != nullptr) {
+            filled++;
+        }
+    }
+    return filled;
+}
+
+static void free_batch_untraced(void** ptrs, size_t count) {
+    // Slab slots and huge blocks gain nothing from batching; runs of
+    // variable-size blocks from one pool are freed under one lock
+    
+    size_t i = 0;
+    while (i < count) {
+        PageMapEntry* entry = (ptrs[i] != nullptr) ? page_map_lookup(ptrs[i]) : nullptr;
+        if (entry == nullptr || entry->kind != PAGE_BLOCK) {
+            free_untraced(ptrs[i++]);
+            continue;
+        }
+        
+        MemoryPool* pool = entry->pool;
+        std::lock_guard<std::mutex> guard(pool->lock);
+        do {
+            free_to_pool(pool, get_header(ptrs[i++]));
+            entry = (i < count && ptrs[i] != nullptr) ? page_map_lookup(ptrs[i]) : nullptr;
+        } while (entry != nullptr && entry->kind == PAGE_BLOCK && entry->pool == pool);
+    }
+}
+
+size_t my_malloc_batch(size_t size, size_t count, void** out) {
+    size_t filled = malloc_batch_untraced(size, count, out);
+    for (size_t i = 0; i < filled; i++) {
+        profile_note_alloc(out[i], size);
+    }
+    if (tracing_enabled.load(std::memory_order_relaxed)) {
+        for (size_t i = 0; i < filled; i++) {
+            trace_record(TRACE_MALLOC, size, out[i], 0);
+        }
+    }
+    return filled;
+}
+
+void my_free_batch(void** ptrs, size_t count) {
+    if (tracing_enabled.load(std::memory_order_relaxed)) {
+        for (size_t i = 0; i < count; i++) {
+            if (ptrs[i] != nullptr) {
+                trace_record(TRACE_FREE, 0, ptrs[i], 0);
+            }
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (ptrs[i] != nullptr) {
+            profile_note_free(ptrs[i]);
+        }
+    }
+    free_batch_untraced(ptrs, count);
+}
+
+// ============================================================================
+// REGIONS
+// ============================================================================
+
+static RegionChunk* region_chunk_alloc(size_t size) {
+    RegionChunk* chunk = (RegionChunk*)malloc_untraced(size);
+    if (chunk != nullptr) {
+        chunk->size = size;
+    }
+    return chunk;
+}
+
+static void region_chunks_free(RegionChunk* chunk, RegionChunk* keep) {
+    // Free a chunk list, except keep. Chunks are xlarge pool blocks or huge
+    // mappings; a pool lock is held across a run of chunks from the same
+    // node (pool before huge_lock, as in fork_prepare).
+    
+    std::unique_lock<std::mutex> guard;
+    while (chunk != nullptr) {
+        RegionChunk* next = chunk->next;  // Freeing overwrites the header
+        if (chunk == keep) {
+            chunk = next;
+            continue;
+        }
+        PageMapEntry* entry = page_map_lookup(chunk);
+        if (entry != nullptr && entry->kind == PAGE_BLOCK) {
+            if (guard.mutex() != &entry->pool->lock) {
+                guard = std::unique_lock<std::mutex>(entry->pool->lock);
+            }
+            free_to_pool(entry->pool, get_header(chunk));
+        } else {
+            free_untraced(chunk);
+        }
+        chunk = next;
+    }
+}
+
+Region* region_create(size_t chunk_size) {
+    if (chunk_size == 0) {
+        chunk_size = REGION_CHUNK_SIZE;
+    }
+    if (chunk_size < REGION_MIN_CHUNK_SIZE) {
+        chunk_size = REGION_MIN_CHUNK_SIZE;
+    }
+    
+    // The region header sits in its first chunk, right after the chunk header
+    RegionChunk* chunk = region_chunk_alloc(chunk_size);
+    if (chunk == nullptr) {
+        return nullptr;
+    }
+    chunk->next = nullptr;
+    
+    Region* region = (Region*)(chunk + 1);
+    region->chunks = chunk;
+    region->chunk_size = chunk_size;
+    region->cursor = (char*)align_size((uintptr_t)(region + 1));
+    region->end = (char*)chunk + chunk_size;
+    return region;
+}
+
+static void* region_alloc_slow(Region* region, size_t size, size_t alignment) {
+    // The current chunk is full: start a new one, or give a big request a
+    // chunk of its own behind the current one so bumping carries on there
+    
+    size_t padding = (alignment > ALIGNMENT) ? alignment - ALIGNMENT : 0;
+    size_t needed = align_size(sizeof(RegionChunk)) + padding + size;
+    if (needed < size) {
+        return nullptr;  // Overflow
+    }
+    
+    // Also a request that might not fit a fresh regular chunk once aligned
+    size_t chunk_room = region->chunk_size - align_size(sizeof(RegionChunk));
+    if (size > region->chunk_size / 4 || padding + size > chunk_room) {
+        RegionChunk* chunk = region_chunk_alloc(needed);
+        if (chunk == nullptr) {
+            return nullptr;
+        }
+        chunk->next = region->chunks->next;
+        region->chunks->next = chunk;
+        
+        uintptr_t data = (uintptr_t)chunk + align_size(sizeof(RegionChunk));
+        return (void*)((data + alignment - 1) & ~(uintptr_t)(alignment - 1));
+    }
+    
+    RegionChunk* chunk = region_chunk_alloc(region->chunk_size);
+    if (chunk == nullptr) {
+        return nullptr;
+    }
+    chunk->next = region->chunks;
+    region->chunks = chunk;
+    region->end = (char*)chunk + region->chunk_size;
+    
+    // The chunk has room for the request at any alignment padding
+    uintptr_t data = (uintptr_t)chunk + align_size(sizeof(RegionChunk));
+    uintptr_t ptr = (data + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    region->cursor = (char*)(ptr + size);
+    return (void*)ptr;
+}
+
+void* region_alloc(Region* region, size_t size, size_t alignment) {
+    if (size == 0 || alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        return nullptr;
+    }
+    
+    // Fast path: align the cursor and bump it
+    uintptr_t ptr = ((uintptr_t)region->cursor + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    if (ptr <= (uintptr_t)region->end && size <= (uintptr_t)region->end - ptr) {
+        region->cursor = (char*)(ptr + size);
+        return (void*)ptr;
+    }
+    
+    return region_alloc_slow(region, size, alignment);
+}
+
+void region_reset(Region* region) {
+    // Keep only the chunk holding the region header and rewind into it
+    
+    RegionChunk* first = (RegionChunk*)region - 1;
+    region_chunks_free(region->chunks, first);
+    
+    first->next = nullptr;
+    region->chunks = first;
+    region->cursor = (char*)align_size((uintptr_t)(region + 1));
+    region->end = (char*)first + region->chunk_size;
+}
+
+void region_destroy(Region* region) {
+    if (region == nullptr) {
+        return;
+    }
+    region_chunks_free(region->chunks, nullptr);
+}
+
+// ============================================================================
+// STATISTICS & DEBUGGING
+// ============================================================================
+
+// StatsPool names, in report rows and control keys
+static const char* const pool_names[STATS_POOL_COUNT] = {"small", "medium", "large", "xlarge",
+                                                         "huge"};
+
+static size_t largest_free_block(MemoryPool* pool) {
+    // Largest free block of a variable-size pool (pool lock held): a free
+    // tree keeps it at the root; with TLSF only the highest non-empty list
+    // needs searching
+    
+    if (pool->fit_policy != FIT_GOOD) {
+        return tree_max_size(pool->free_tree);
+    }
+    if (pool->fl_bitmap == 0) {
+        return 0;
+    }
+    int fl = 31 - __builtin_clz(pool->fl_bitmap);
+    int sl = 31 - __builtin_clz(pool->sl_bitmap[fl]);
+    size_t largest = 0;
+    for (BlockHeader* block = pool->free_lists[fl][sl]; block != nullptr;
+         block = block_links(block)->next_free) {
+        if (block_size(block) > largest) {
+            largest = block_size(block);
+        }
+    }
+    return largest;
+}
+
+static size_t resident_bytes(char* start, size_t size, AllocStats* classes) {
+    // Resident part of a mapping, a batch of pages per mincore call. With
+    // classes given, each resident page of a slab still held by a class is
+    // also credited to that class (pool lock held: a slab without an owner
+    // is guarded by it, and an owned one is in use).
+    
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    unsigned char resident[1024];
+    size_t total = 0;
+    
+    for (size_t offset = 0; offset < size; offset += sizeof(resident) * page) {
+        size_t length = size - offset;
+        if (length > sizeof(resident) * page) {
+            length = sizeof(resident) * page;
+        }
+        if (mincore(start + offset, length, resident) != 0) {
+            continue;
+        }
+        for (size_t i = 0; i * page < length; i++) {
+            if ((resident[i] & 1) == 0) {
+                continue;
+            }
+            total += page;
+            PageMapEntry* entry = (classes != nullptr)
+                                      ? page_map_lookup(start + offset + i * page) : nullptr;
+            if (entry == nullptr || entry->kind != PAGE_SLAB) {
+                continue;
+            }
+            SlabHeader* slab = entry->slab;
+            bool on_free_slabs = slab->owner.load(std::memory_order_acquire) == nullptr &&
+                                 slab->used == 0 && !slab->in_partial_list;
+            if (!on_free_slabs) {
+                classes[entry->size_class].resident_bytes += page;
+            }
+        }
+    }
+    return total;
+}
+
+static void stats_set_fragmentation(AllocStats* stats) {
+    // External fragmentation: how much of the free memory is not in the
+    // largest extent (and so cannot serve a request that large)
+    stats->fragmentation = (stats->free_bytes == 0)
+                               ? 0.0 : 1.0 - (double)stats->largest_free / stats->free_bytes;
+}
+
+static void stats_add(AllocStats* total, const AllocStats* stats) {
+    total->alloc_calls += stats->alloc_calls;
+    total->free_calls += stats->free_calls;
+    total->live_objects += stats->live_objects;
+    total->live_bytes += stats->live_bytes;
+    total->free_blocks += stats->free_blocks;
+    total->free_bytes += stats->free_bytes;
+    if (stats->largest_free > total->largest_free) {
+        total->largest_free = stats->largest_free;
+    }
+    total->mapped_bytes += stats->mapped_bytes;
+    total->resident_bytes += stats->resident_bytes;
+}
+
+void allocator_stats_snapshot(AllocatorStats* stats, bool resident) {
+    std::memset(stats, 0, sizeof(*stats));
+    if (!allocator_initialized) {
+        return;
+    }
+    
+    // Step 1: Slab calls are counted per thread; add up every thread's
+    {
+        std::lock_guard<std::mutex> guard(stats_lock);
+        for (ThreadStats* thread = stats_list; thread != nullptr; thread = thread->next) {
+            for (int i = 0; i < NUM_SIZE_CLASSES; i++) {
+                stats->classes[i].alloc_calls += thread->allocs[i].load(std::memory_order_relaxed);
+                stats->classes[i].free_calls += thread->frees[i].load(std::memory_order_relaxed);
+            }
+        }
+    }
+    
+    // Step 2: Each pool's counters, and the slabs each class holds in it.
+    // Free slots are counted as total slots here and corrected in step 3;
+    // resident pages are looked up under the lock too.
+    int class_pool[NUM_SIZE_CLASSES];
+    for (int n = 0; n < numa_node_count; n++) {
+        MemoryPool* node_pools[4] = {&nodes[n].small_pool, &nodes[n].medium_pool,
+                                     &nodes[n].large_pool, &nodes[n].xlarge_pool};
+        for (int p = 0; p < 4; p++) {
+            MemoryPool* pool = node_pools[p];
+            AllocStats* pool_stats = &stats->pools[p];
+            std::lock_guard<std::mutex> guard(pool->lock);
+            pool_stats->mapped_bytes += pool->pool_size;
+            
+            if (pool->slab_size == 0) {
+                pool_stats->alloc_calls += pool->alloc_calls;
+                pool_stats->free_calls += pool->free_calls;
+                pool_stats->live_objects += pool->allocated_blocks;
+                pool_stats->live_bytes += pool->allocated_bytes;
+                pool_stats->free_blocks += pool->free_block_count;
+                pool_stats->free_bytes += pool->free_bytes;
+                size_t largest = largest_free_block(pool);
+                if (largest > pool_stats->largest_free) {
+                    pool_stats->largest_free = largest;
+                }
+            } else {
+                for (int i = 0; i < NUM_SIZE_CLASSES; i++) {
+                    SizeClass* size_class = &nodes[n].size_classes[i];
+                    if (size_class->pool != pool) {
+                        continue;
+                    }
+                    class_pool[i] = p;
+                    stats->classes[i].mapped_bytes += size_class->slab_count * pool->slab_size;
+                    stats->classes[i].free_blocks +=
+                        size_class->slab_count * (pool->slab_size / size_class->slot_size);
+                }
+                
+                // Empty slabs and the uncarved rest of the newest arena
+                // are free for any class
+                size_t uncarved = pool->slab_end - pool->slab_cursor;
+                pool_stats->free_blocks += pool->free_slab_count + (uncarved > 0 ? 1 : 0);
+                if (pool->free_slab_count > 0 && pool->slab_size > pool_stats->largest_free) {
+                    pool_stats->largest_free = pool->slab_size;
+                }
+                if (uncarved > pool_stats->largest_free) {
+                    pool_stats->largest_free = uncarved;
+                }
+            }
+            
+            for (Arena* arena = pool->arenas; resident && arena != nullptr;
+                 arena = arena->next) {
+                pool_stats->resident_bytes += resident_bytes(arena->start, arena->size,
+                                                             stats->classes);
+            }
+        }
+    }
+    
+    // Step 3: Live slots are allocations minus frees; the rest are free.
+    // Slab pools are made of their classes' slabs plus free space.
+    for (int i = 0; i < NUM_SIZE_CLASSES; i++) {
+        AllocStats* class_stats = &stats->classes[i];
+        AllocStats* pool_stats = &stats->pools[class_pool[i]];
+        size_t slot_size = size_class_size(i);
+        
+        uint64_t live = (class_stats->alloc_calls > class_stats->free_calls)
+                            ? class_stats->alloc_calls - class_stats->free_calls : 0;
+        if (live > class_stats->free_blocks) {
+            live = class_stats->free_blocks;  // Counted mid-operation
+        }
+        class_stats->live_objects = live;
+        class_stats->live_bytes = live * slot_size;
+        class_stats->free_blocks -= live;
+        class_stats->free_bytes = class_stats->free_blocks * slot_size;
+        class_stats->largest_free = (class_stats->free_blocks > 0) ? slot_size : 0;
+        class_stats->fragmentation = (class_stats->mapped_bytes == 0)
+            ? 0.0 : (double)class_stats->free_bytes / class_stats->mapped_bytes;
+        
+        pool_stats->alloc_calls += class_stats->alloc_calls;
+        pool_stats->free_calls += class_stats->free_calls;
+        pool_stats->live_objects += class_stats->live_objects;
+        pool_stats->live_bytes += class_stats->live_bytes;
+        pool_stats->free_blocks += class_stats->free_blocks;
+        if (class_stats->largest_free > pool_stats->largest_free) {
+            pool_stats->largest_free = class_stats->largest_free;
+        }
+    }
+    for (int p = STATS_POOL_SMALL; p <= STATS_POOL_LARGE; p++) {
+        stats->pools[p].free_bytes = stats->pools[p].mapped_bytes - stats->pools[p].live_bytes;
+    }
+    
+    // Step 4: Huge allocations are all live; each is its own mapping (freed
+    // ones waiting for a retried munmap still count as mapped)
+    AllocStats* huge_stats = &stats->pools[STATS_POOL_HUGE];
+    {
+        std::lock_guard<std::mutex> guard(huge_lock);
+        huge_stats->alloc_calls = huge_alloc_calls;
+        huge_stats->free_calls = huge_free_calls;
+        huge_stats->live_objects = huge_count;
+        huge_stats->live_bytes = huge_bytes;
+        huge_stats->mapped_bytes = huge_bytes + huge_pending_bytes.load(std::memory_order_relaxed);
+        for (size_t i = 0; resident && i < huge_capacity; i++) {
+            if (huge_table[i].ptr != nullptr) {
+                huge_stats->resident_bytes += resident_bytes((char*)huge_table[i].ptr,
+                                                             huge_table[i].size, nullptr);
+            }
+        }
+    }
+    
+    // Step 5: Totals
+    for (int p = 0; p < STATS_POOL_COUNT; p++) {
+        stats_set_fragmentation(&stats->pools[p]);
+        stats_add(&stats->total, &stats->pools[p]);
+    }
+    stats_set_fragmentation(&stats->total);
+}
+
+static void print_stats_row(const char* name, const AllocStats* stats) {
+    char line[256];
+    snprintf(line, sizeof(line),
+             "%-8s %10llu %10llu %9zu %11zu %9zu %11zu %10zu %5.2f %11zu %11zu\n", name,
+             (unsigned long long)stats->alloc_calls, (unsigned long long)stats->free_calls,
+             stats->live_objects, stats->live_bytes, stats->free_blocks, stats->free_bytes,
+             stats->largest_free, stats->fragmentation, stats->mapped_bytes,
+             stats->resident_bytes);
+    std::cout << line;
+}
+
+void print_allocator_stats() {
+    // One row per pool and the total, then one per size class in use
+    
+    AllocatorStats stats;
+    allocator_stats_snapshot(&stats, true);
+    
+    std::cout << "=== Allocator Statistics ===\n";
+    char header[256];
+    snprintf(header, sizeof(header), "%-8s %10s %10s %9s %11s %9s %11s %10s %5s %11s %11s\n",
+             "", "allocs", "frees", "live", "live_bytes", "free", "free_bytes", "largest",
+             "frag", "mapped", "resident");
+    std::cout << header;
+    for (int p = 0; p < STATS_POOL_COUNT; p++) {
+        print_stats_row(pool_names[p], &stats.pools[p]);
+    }
+    print_stats_row("total", &stats.total);
+    
+    std::cout << "--- Size classes ---\n";
+    for (int i = 0; i < NUM_SIZE_CLASSES; i++) {
+        if (stats.classes[i].alloc_calls == 0 && stats.classes[i].mapped_bytes == 0) {
+            continue;
+        }
+        char name[16];
+        snprintf(name, sizeof(name), "%zu", size_class_size(i));
+        print_stats_row(name, &stats.classes[i]);
+    }
+}
+
+size_t get_allocated_bytes() {
+    AllocatorStats stats;
+    allocator_stats_snapshot(&stats);
+    return stats.total.live_bytes;
+}
+
+size_t get_free_bytes() {
+    AllocatorStats stats;
+    allocator_stats_snapshot(&stats);
+    return stats.total.free_bytes;
+}
+
+size_t get_free_block_count() {
+    AllocatorStats stats;
+    allocator_stats_snapshot(&stats);
+    return stats.total.free_blocks;
+}
+
+bool validate_allocator() {
+    // TODO: Validate allocator integrity
+    // Check:
+    // - All headers are valid
+    // - Free list is consistent
+    // - No double-free
+    // - No memory corruption
+    
+    return true;  // Placeholder
+}
+
+// ============================================================================
+// CONTROL INTERFACE
+// ============================================================================
+
+// Value types of control keys
+enum CtlType : uint8_t {
+    CTL_BOOL,
+    CTL_LONG,
+    CTL_SIZE,
+    CTL_UINT64,
+    CTL_DOUBLE,
+    CTL_STRING
+};
+
+// What a control key names
+enum CtlKeyId : uint8_t {
+    CTL_ARENA_SIZE,
+    CTL_MAX_SIZE,
+    CTL_SLAB_SIZE,
+    CTL_TCACHE_MAX,
+    CTL_TCACHE_BATCH,
+    CTL_TCACHE_FLUSH,
+    CTL_PERCPU,
+    CTL_DECAY,
+    CTL_SCAVENGE,
+    CTL_HUGE_PAGES,
+    CTL_FIT,
+    CTL_VERBOSE,
+    CTL_MMAP_THRESHOLD,
+    CTL_NUMA_NODES,
+    CTL_CLASS_COUNT,
+    CTL_CLASS_SIZE,
+    CTL_PROFILE_ACTIVE,
+    CTL_PROFILE_INTERVAL,
+    CTL_PROFILE_DUMP,
+    CTL_STATS
+};
+
+// A key name taken apart
+struct CtlKey {
+    uint8_t id;        // CtlKeyId
+    uint8_t type;      // CtlType
+    bool readable;
+    bool writable;
+    int pool;          // StatsPool (STATS_POOL_COUNT: stats.total; -1: stats.classes)
+    int class_index;
+    int field;         // stats.*: index in stats_fields
+};
+
+// A value of any CtlType
+union CtlValue {
+    bool b;
+    long l;
+    size_t z;
+    uint64_t u;
+    double d;
+    const char* s;
+};
+
+// Keys with nothing variable in their name
+struct CtlNamedKey {
+    const char* name;
+    uint8_t id;
+    uint8_t type;
+    bool readable;
+    bool writable;
+};
+
+static const CtlNamedKey ctl_named_keys[] = {
+    {"tcache.max", CTL_TCACHE_MAX, CTL_SIZE, true, true},
+    {"tcache.batch", CTL_TCACHE_BATCH, CTL_SIZE, true, true},
+    {"tcache.flush", CTL_TCACHE_FLUSH, CTL_BOOL, false, true},
+    {"percpu.enabled", CTL_PERCPU, CTL_BOOL, true, true},
+    {"decay_ms", CTL_DECAY, CTL_LONG, true, true},
+    {"scavenge", CTL_SCAVENGE, CTL_BOOL, false, true},
+    {"huge_pages", CTL_HUGE_PAGES, CTL_STRING, true, true},
+    {"fit_policy", CTL_FIT, CTL_STRING, true, true},
+    {"verbose", CTL_VERBOSE, CTL_BOOL, true, true},
+    {"mmap_threshold", CTL_MMAP_THRESHOLD, CTL_SIZE, true, false},
+    {"numa.nodes", CTL_NUMA_NODES, CTL_SIZE, true, false},
+    {"size_classes.count", CTL_CLASS_COUNT, CTL_SIZE, true, false},
+    {"profile.active", CTL_PROFILE_ACTIVE, CTL_BOOL, true, true},
+    {"profile.sample_interval", CTL_PROFILE_INTERVAL, CTL_SIZE, true, true},
+    {"profile.dump", CTL_PROFILE_DUMP, CTL_STRING, false, true},
+};
+
+// AllocStats fields, in declaration order
+static const char* const stats_fields[] = {
+    "alloc_calls", "free_calls", "live_objects", "live_bytes", "free_blocks",
+    "free_bytes", "largest_free", "fragmentation", "mapped_bytes", "resident_bytes"
+};
+#define STATS_FIELD_COUNT   (int)(sizeof(stats_fields) / sizeof(stats_fields[0]))
+#define STATS_FIELD_FRAG     7
+#define STATS_FIELD_RESIDENT 9
+
+static const char* const huge_page_names[] = {"off", "thp", "hugetlb"};
+static const char* const fit_policy_names[] = {"good", "best", "address"};
+
+static bool ctl_match(const char** name, const char* word) {
+    // Consume word and the dot after it from the front of *name
+    size_t length = strlen(word);
+    if (strncmp(*name, word, length) != 0 || (*name)[length] != '.') {
+        return false;
+    }
+    *name += length + 1;
+    return true;
+}
+
+static int ctl_match_pool(const char** name, int count) {
+    for (int p = 0; p < count; p++) {
+        if (ctl_match(name, pool_names[p])) {
+            return p;
+        }
+    }
+    return -1;
+}
+
+static int ctl_match_class(const char** name) {
+    // A size class index followed by a dot, or -1
+    char* end;
+    long index = strtol(*name, &end, 10);
+    if (end == *name || *end != '.' || index < 0 || index >= NUM_SIZE_CLASSES) {
+        return -1;
+    }
+    *name = end + 1;
+    return (int)index;
+}
+
+static bool ctl_resolve(const char* name, CtlKey* key) {
+    // Take a key name apart: a fixed key, or one naming a pool, a size
+    // class or a statistic
+    
+    std::memset(key, 0, sizeof(*key));
+    key->pool = -1;
+    key->class_index = -1;
+    
+    for (size_t i = 0; i < sizeof(ctl_named_keys) / sizeof(ctl_named_keys[0]); i++) {
+        if (strcmp(name, ctl_named_keys[i].name) == 0) {
+            key->id = ctl_named_keys[i].id;
+            key->type = ctl_named_keys[i].type;
+            key->readable = ctl_named_keys[i].readable;
+            key->writable = ctl_named_keys[i].writable;
+            return true;
+        }
+    }
+    
+    const char* rest = name;
+    key->readable = true;
+    key->type = CTL_SIZE;
+    
+    // pools.<pool>.<setting> (huge allocations are no pool)
+    if (ctl_match(&rest, "pools")) {
+        key->pool = ctl_match_pool(&rest, STATS_POOL_HUGE);
+        if (key->pool < 0) {
+            return false;
+        }
+        if (strcmp(rest, "arena_size") == 0) {
+            key->id = CTL_ARENA_SIZE;
+            key->writable = true;
+        } else if (strcmp(rest, "max_size") == 0) {
+            key->id = CTL_MAX_SIZE;
+        } else if (strcmp(rest, "slab_size") == 0) {
+            key->id = CTL_SLAB_SIZE;
+        } else {
+            return false;
+        }
+        return true;
+    }
+    
+    // size_classes.<i>.size
+    if (ctl_match(&rest, "size_classes")) {
+        key->id = CTL_CLASS_SIZE;
+        key->class_index = ctl_match_class(&rest);
+        return key->class_index >= 0 && strcmp(rest, "size") == 0;
+    }
+    
+    // stats.<scope>.<field>
+    if (ctl_match(&rest, "stats")) {
+        key->id = CTL_STATS;
+        if (ctl_match(&rest, "total")) {
+            key->pool = STATS_POOL_COUNT;
+        } else if (ctl_match(&rest, "classes")) {
+            key->class_index = ctl_match_class(&rest);
+            if (key->class_index < 0) {
+                return false;
+            }
+        } else if ((key->pool = ctl_match_pool(&rest, STATS_POOL_COUNT)) < 0) {
+            return false;
+        }
+        
+        for (key->field = 0; key->field < STATS_FIELD_COUNT; key->field++) {
+            if (strcmp(rest, stats_fields[key->field]) == 0) {
+                break;
+            }
+        }
+        if (key->field == STATS_FIELD_COUNT) {
+            return false;
+        }
+        if (key->field <= 1) {
+            key->type = CTL_UINT64;  // Call counts
+        } else if (key->field == STATS_FIELD_FRAG) {
+            key->type = CTL_DOUBLE;
+        }
+        return true;
+    }
+    
+    return false;
+}
+
+static size_t ctl_type_size(uint8_t type) {
+    switch (type) {
+    case CTL_BOOL:
+        return sizeof(bool);
+    case CTL_LONG:
+        return sizeof(long);
+    case CTL_UINT64:
+        return sizeof(uint64_t);
+    case CTL_DOUBLE:
+        return sizeof(double);
+    case CTL_STRING:
+        return sizeof(const char*);
+    default:
+        return sizeof(size_t);
+    }
+}
+
+static void ctl_read_stat(const CtlKey* key, CtlValue* value) {
+    AllocatorStats stats;
+    allocator_stats_snapshot(&stats, key->field == STATS_FIELD_RESIDENT);
+    
+    const AllocStats* scope;
+    if (key->pool == STATS_POOL_COUNT) {
+        scope = &stats.total;
+    } else if (key->pool >= 0) {
+        scope = &stats.pools[key->pool];
+    } else {
+        scope = &stats.classes[key->class_index];
+    }
+    
+    const size_t fields[] = {0, 0, scope->live_objects, scope->live_bytes, scope->free_blocks,
+                             scope->free_bytes, scope->largest_free, 0, scope->mapped_bytes,
+                             scope->resident_bytes};
+    if (key->field == 0) {
+        value->u = scope->alloc_calls;
+    } else if (key->field == 1) {
+        value->u = scope->free_calls;
+    } else if (key->field == STATS_FIELD_FRAG) {
+        value->d = scope->fragmentation;
+    } else {
+        value->z = fields[key->field];
+    }
+}
+
+static void ctl_read(const CtlKey* key, CtlValue* value) {
+    static const size_t pool_max_size[STATS_POOL_HUGE] = {SMALL_BLOCK_MAX, MEDIUM_BLOCK_MAX,
+                                                          LARGE_BLOCK_MAX, MMAP_THRESHOLD - 1};
+    static const size_t pool_slab_size[STATS_POOL_HUGE] = {SMALL_SLAB_SIZE, MEDIUM_SLAB_SIZE,
+                                                           LARGE_SLAB_SIZE, 0};
+    
+    switch (key->id) {
+    case CTL_ARENA_SIZE: {
+        // Every node's pool is set alike; the first one speaks for them all
+        MemoryPool* pools[MAX_NUMA_NODES * 4];
+        collect_pools(pools);
+        std::lock_guard<std::mutex> guard(pools[key->pool]->lock);
+        value->z = pools[key->pool]->next_arena_size;
+        break;
+    }
+    case CTL_MAX_SIZE:
+        value->z = pool_max_size[key->pool];
+        break;
+    case CTL_SLAB_SIZE:
+        value->z = pool_slab_size[key->pool];
+        break;
+    case CTL_TCACHE_MAX:
+        value->z = tcache_max.load(std::memory_order_relaxed);
+        break;
+    case CTL_TCACHE_BATCH:
+        value->z = tcache_batch.load(std::memory_order_relaxed);
+        break;
+    case CTL_PERCPU:
+        value->b = percpu_enabled.load(std::memory_order_relaxed);
+        break;
+    case CTL_DECAY:
+        value->l = scavenge_decay_ms.load(std::memory_order_relaxed);
+        break;
+    case CTL_HUGE_PAGES:
+        value->s = huge_page_names[huge_page_mode.load(std::memory_order_relaxed)];
+        break;
+    case CTL_FIT:
+        value->s = fit_policy_names[default_fit_policy.load(std::memory_order_relaxed)];
+        break;
+    case CTL_VERBOSE:
+        value->b = verbose_logging;
+        break;
+    case CTL_MMAP_THRESHOLD:
+        value->z = MMAP_THRESHOLD;
+        break;
+    case CTL_NUMA_NODES:
+        value->z = (size_t)numa_node_count;
+        break;
+    case CTL_CLASS_COUNT:
+        value->z = NUM_SIZE_CLASSES;
+        break;
+    case CTL_CLASS_SIZE:
+        value->z = size_class_slot_size(key->class_index);
+        break;
+    case CTL_PROFILE_ACTIVE:
+        value->b = profiling_enabled.load(std::memory_order_relaxed);
+        break;
+    case CTL_PROFILE_INTERVAL:
+        value->z = profile_interval.load(std::memory_order_relaxed);
+        break;
+    case CTL_STATS:
+        ctl_read_stat(key, value);
+        break;
+    }
+}
+
+static int ctl_find_name(const char* const* names, int count, const char* name) {
+    for (int i = 0; name != nullptr && i < count; i++) {
+        if (strcmp(name, names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int ctl_write(const CtlKey* key, const CtlValue* value) {
+    // Apply a new value. Before allocator_init (MYALLOC_CONF) only the
+    // settings init will use are recorded.
+    
+    bool initialized = allocator_initialized.load(std::memory_order_acquire);
+    
+    switch (key->id) {
+    case CTL_ARENA_SIZE:
+        if (value->z < ARENA_CHUNK_SIZE || value->z > ARENA_MAX_SIZE ||
+            value->z % ARENA_CHUNK_SIZE != 0) {
+            return EINVAL;  // Slabs must tile it, aligned
+        }
+        initial_arena_size[key->pool] = value->z;
+        if (initialized) {
+            MemoryPool* pools[MAX_NUMA_NODES * 4];
+            int pool_count = collect_pools(pools);
+            for (int i = key->pool; i < pool_count; i += 4) {
+                std::lock_guard<std::mutex> guard(pools[i]->lock);
+                pools[i]->next_arena_size = value->z;
+            }
+        }
+        return 0;
+    case CTL_TCACHE_MAX:
+        if (value->z < tcache_batch.load(std::memory_order_relaxed) ||
+            value->z > TCACHE_MAGAZINE_SIZE) {
+            return EINVAL;
+        }
+        tcache_max.store((uint32_t)value->z, std::memory_order_relaxed);
+        return 0;
+    case CTL_TCACHE_BATCH:
+        if (value->z < 1 || value->z > tcache_max.load(std::memory_order_relaxed)) {
+            return EINVAL;
+        }
+        tcache_batch.store((uint32_t)value->z, std::memory_order_relaxed);
+        return 0;
+    case CTL_TCACHE_FLUSH:
+        if (initialized) {
+            thread_cache_flush();
+        }
+        return 0;
+    case CTL_PERCPU:
+        percpu_requested = value->b;
+        if (initialized) {
+            allocator_set_percpu_cache(value->b);
+        }
+        return 0;
+    case CTL_DECAY:
+        allocator_set_decay_ms(value->l);
+        return 0;
+    case CTL_SCAVENGE:
+        allocator_scavenge(value->b);
+        return 0;
+    case CTL_HUGE_PAGES: {
+        int mode = ctl_find_name(huge_page_names, 3, value->s);
+        if (mode < 0) {
+            return EINVAL;
+        }
+        allocator_set_huge_pages((HugePageMode)mode);
+        return 0;
+    }
+    case CTL_FIT: {
+        int policy = ctl_find_name(fit_policy_names, 3, value->s);
+        if (policy < 0) {
+            return EINVAL;
+        }
+        allocator_set_fit_policy((FitPolicy)policy);
+        for (int n = 0; initialized && n < numa_node_count; n++) {
+            std::lock_guard<std::mutex> guard(nodes[n].xlarge_pool.lock);
+            pool_set_fit_policy(&nodes[n].xlarge_pool, (FitPolicy)policy);
+        }
+        return 0;
+    }
+    case CTL_VERBOSE:
+        allocator_set_verbose(value->b);
+        return 0;
+    case CTL_PROFILE_ACTIVE:
+        if (value->b) {
+            allocator_profile_start(0);
+        } else {
+            allocator_profile_stop();
+        }
+        return 0;
+    case CTL_PROFILE_INTERVAL:
+        if (value->z == 0) {
+            return EINVAL;
+        }
+        profile_interval.store(value->z, std::memory_order_relaxed);
+        return 0;
+    case CTL_PROFILE_DUMP:
+        if (value->s == nullptr) {
+            return EINVAL;
+        }
+        return allocator_profile_dump(value->s) ? 0 : EIO;
+    default:
+        return EPERM;
+    }
+}
+
+static bool ctl_parse(uint8_t type, const char* text, CtlValue* value) {
+    // A MYALLOC_CONF value as the key's type
+    char* end = nullptr;
+    switch (type) {
+    case CTL_BOOL:
+        value->b = strcmp(text, "1") == 0 || strcmp(text, "true") == 0;
+        return value->b || strcmp(text, "0") == 0 || strcmp(text, "false") == 0;
+    case CTL_LONG:
+        value->l = strtol(text, &end, 10);
+        break;
+    case CTL_DOUBLE:
+        value->d = strtod(text, &end);
+        break;
+    case CTL_STRING:
+        value->s = text;
+        return true;
+    default:
+        if (text[0] == '-') {
+            return false;
+        }
+        value->z = strtoull(text, &end, 10);
+        break;
+    }
+    return end != text && *end == '\0';
+}
+
+static void ctl_apply_config(const char* config) {
+    // MYALLOC_CONF="key:value,key:value", applied in order at init (with
+    // init_lock held, so nothing here may allocate)
+    
+    while (config != nullptr && *config != '\0') {
+        const char* end = strchr(config, ',');
+        if (end == nullptr) {
+            end = config + strlen(config);
+        }
+        const char* colon = (const char*)memchr(config, ':', end - config);
+        
+        char name[64];
+        char text[64];
+        CtlKey key;
+        CtlValue value;
+        bool applied = false;
+        if (colon != nullptr && (size_t)(colon - config) < sizeof(name) &&
+            (size_t)(end - colon - 1) < sizeof(text)) {
+            memcpy(name, config, colon - config);
+            name[colon - config] = '\0';
+            memcpy(text, colon + 1, end - colon - 1);
+            text[end - colon - 1] = '\0';
+            applied = ctl_resolve(name, &key) && key.writable &&
+                      ctl_parse(key.type, text, &value) && ctl_write(&key, &value) == 0;
+        }
+        if (!applied) {
+            log_message(true, "MYALLOC_CONF: ignoring \"%.*s\"\n", (int)(end - config), config);
+        }
+        config = (*end == ',') ? end + 1 : end;
+    }
+}
+
+int my_allocctl(const char* name, void* oldp, size_t* oldlenp, const void* newp, size_t newlen) {
+    if (!allocator_initialized) {
+        allocator_init();
+    }
+    
+    // Step 1: Check the whole request first, so a failed call changes nothing
+    CtlKey key;
+    if (name == nullptr || !ctl_resolve(name, &key)) {
+        return ENOENT;
+    }
+    size_t size = ctl_type_size(key.type);
+    if ((oldp != nullptr && !key.readable) || (newp != nullptr && !key.writable)) {
+        return EPERM;
+    }
+    if ((oldp != nullptr && (oldlenp == nullptr || *oldlenp != size)) ||
+        (newp != nullptr && newlen != size)) {
+        return EINVAL;
+    }
+    
+    // Step 2: Old value out, then new value in
+    CtlValue value;
+    if (oldp != nullptr) {
+        ctl_read(&key, &value);
+        std::memcpy(oldp, &value, size);
+    }
+    if (newp != nullptr) {
+        std::memcpy(&value, newp, size);
+        return ctl_write(&key, &value);
+    }
+    return 0;
 }
@@ -3,82 +3,538 @@
 
 #include <cstddef>  // for size_t
 #include <cstdint>  // for uintptr_t
+#include <mutex>    // for std::mutex
+#include <atomic>   // for std::atomic
 
 // ============================================================================
 // CONSTANTS
 // ============================================================================
 
-// Alignment requirement (8 bytes is standard for most systems)
-#define ALIGNMENT 8
+// Alignment requirement (16 bytes, as the x86-64 ABI requires of malloc)
+#define ALIGNMENT 16
 
 // Size classes for memory pools
 #define SMALL_BLOCK_MAX   64
 #define MEDIUM_BLOCK_MAX  256
 #define LARGE_BLOCK_MAX   1024
 
-// Initial pool sizes (you can adjust these)
+// Initial pool sizes (defaults for the pools.<name>.arena_size control keys;
+// the xlarge pool starts at LARGE_POOL_SIZE too)
 #define SMALL_POOL_SIZE   (64 * 1024)   // 64 KB
 #define MEDIUM_POOL_SIZE  (256 * 1024)  // 256 KB
 #define LARGE_POOL_SIZE   (1024 * 1024) // 1 MB
 
+// Pools grow by chaining arenas; each new arena doubles the last one
+#define ARENA_CHUNK_SIZE  (64 * 1024)          // Arena alignment (largest slab size)
+#define ARENA_MAX_SIZE    (256 * 1024 * 1024)  // Growth stops doubling here
+
+// Requests of at least this size get their own mapping instead of a pool block
+#define MMAP_THRESHOLD    (128 * 1024)  // 128 KB
+
+// Page map granularity (pointer -> span lookup)
+#define PAGE_MAP_SHIFT    12            // 4 KB pages
+
+// Size classes for small objects (16/32/48/64, then four geometric steps
+// per doubling up to LARGE_BLOCK_MAX). Each class is served from slabs.
+#define NUM_SIZE_CLASSES  20
+
+// Slot size of a size class, and the class serving a request size (both
+// usable in constant expressions; the runtime tables are built from these)
+constexpr size_t size_class_slot_size(int class_index) {
+    if (class_index < 4) {
+        return (size_t)(class_index + 1) * 16;
+    }
+    size_t base = (size_t)64 << ((class_index - 4) / 4);
+    return base + (size_t)((class_index - 4) % 4 + 1) * (base / 4);
+}
+
+constexpr int size_class_for(size_t size) {
+    int class_index = 0;
+    while (size_class_slot_size(class_index) < size) {
+        class_index++;
+    }
+    return class_index;
+}
+
+// Slab sizes for the slab-backed pools (each slab holds one size class)
+#define SMALL_SLAB_SIZE   (4 * 1024)    // 4 KB
+#define MEDIUM_SLAB_SIZE  (16 * 1024)   // 16 KB
+#define LARGE_SLAB_SIZE   (64 * 1024)   // 64 KB
+
+// Thread cache tuning (tcache.max and tcache.batch lower them at run time)
+#define TCACHE_MAGAZINE_SIZE 64  // Max cached blocks per size class
+#define TCACHE_BATCH_SIZE    32  // Blocks moved per refill/flush
+
+// Per-CPU cache tuning (allocator_set_percpu_cache or MYALLOC_PERCPU=1).
+// Classes up to PERCPU_MAX_SIZE are cached per CPU instead of per thread.
+#define PERCPU_MAX_SIZE      MEDIUM_BLOCK_MAX
+#define PERCPU_NUM_CLASSES   (size_class_for(PERCPU_MAX_SIZE) + 1)
+#define PERCPU_SLOTS         32  // Max cached blocks per CPU and size class
+#define PERCPU_BATCH_SIZE    16  // Blocks moved per refill/flush
+
+// Huge pages for slab arenas (MYALLOC_HUGEPAGES=thp|hugetlb or
+// allocator_set_huge_pages). Arenas mapped with them are HUGE_PAGE_SIZE
+// aligned and sized.
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+enum HugePageMode {
+    HUGE_PAGES_OFF = 0,  // Regular 4 KB pages
+    HUGE_PAGES_THP,      // Transparent huge pages via madvise(MADV_HUGEPAGE)
+    HUGE_PAGES_HUGETLB   // Reserved huge pages (MAP_HUGETLB), else THP
+};
+
+// Each NUMA node gets its own set of pools (up to this many nodes; the
+// rest share the last set). MYALLOC_NUMA=0 forces a single set.
+#define MAX_NUMA_NODES 8
+
+// Free memory is returned to the OS once it has stayed free for a whole
+// scavenger period (MYALLOC_DECAY_MS or allocator_set_decay_ms)
+#define SCAVENGE_DECAY_MS 1000
+
 // ============================================================================
 // BLOCK HEADER STRUCTURE
 // ============================================================================
 
 /**
  * Block header structure
- * This is stored before each allocated block
+ * This is stored before each block of the variable-size pool
  * 
- * TODO: You need to design this structure!
- * Consider:
- * - Size of the block
- * - Whether it's free or allocated
- * - Pointer to next free block (for free list)
- * - Maybe a magic number for debugging?
+ * A single word: the block's total size (header included, a multiple of
+ * ALIGNMENT) with the flags below packed into its low bits. Everything a
+ * free block needs beyond that lives in its own payload, which is unused
+ * while it is free: the free-list links right after the header and a copy
+ * of the size (the footer) in its last word, so the next block can find it.
  */
 struct BlockHeader {
-    // TODO: Add your fields here
-    // Example:
-    // size_t size;
-    // bool is_free;
-    // BlockHeader* next_free;
-    // uint32_t magic;  // For debugging (e.g., 0xDEADBEEF)
-    size_t size;
-    bool is_free;
+    size_t size_and_flags;
+};
+
+#define BLOCK_FREE       ((size_t)1)  // Block is on the free list
+#define BLOCK_PREV_FREE  ((size_t)2)  // Physically previous block is free (its footer is valid)
+#define BLOCK_AGED       ((size_t)4)  // Free and seen by the last scavenger pass
+#define BLOCK_PURGED     ((size_t)8)  // Free and its interior pages returned to the OS
+#define BLOCK_FLAG_MASK  ((size_t)(ALIGNMENT - 1))
+
+/**
+ * Free-list links, stored in a free block's payload right after its header
+ * (free lists are doubly linked for O(1) removal)
+ */
+struct FreeBlockLinks {
     BlockHeader* next_free;
+    BlockHeader* prev_free;
+};
 
+/**
+ * Free-tree node, stored in a free block's payload right after its header
+ * in pools with a tree fit policy (in place of FreeBlockLinks)
+ * The tree is an AVL tree ordered by size then address (FIT_BEST) or by
+ * address (FIT_ADDRESS). max_size is the largest block in the node's
+ * subtree, so an address-ordered search skips subtrees where nothing fits.
+ */
+struct FreeTreeNode {
+    BlockHeader* left;
+    BlockHeader* right;
+    size_t max_size;
+    int height;
+};
+
+// Smallest block: header, free-list links or tree node, and footer
+#define MIN_BLOCK_SIZE    (sizeof(BlockHeader) + sizeof(FreeTreeNode) + sizeof(size_t))
+
+// How a variable-size pool picks a free block (allocator_set_fit_policy or
+// MYALLOC_FIT=good|best|address, applied at allocator_init)
+enum FitPolicy : uint8_t {
+    FIT_GOOD = 0,  // Segregated lists (TLSF): constant time, default
+    FIT_BEST,      // Smallest block that fits, lowest address among equals
+    FIT_ADDRESS    // Lowest-addressed block that fits
 };
 
+// Free blocks of a variable-size pool are kept in segregated lists indexed
+// two levels deep (TLSF): the first level is the power of two below the
+// block size, the second splits each power of two into TLSF_SL_COUNT equal
+// ranges. Below TLSF_SMALL_SIZE the lists are simply ALIGNMENT apart.
+#define TLSF_SL_LOG2      4
+#define TLSF_SL_COUNT     (1 << TLSF_SL_LOG2)
+#define TLSF_FL_SHIFT     (TLSF_SL_LOG2 + 4)  // 4 = log2(ALIGNMENT)
+#define TLSF_SMALL_SIZE   ((size_t)1 << TLSF_FL_SHIFT)
+#define TLSF_FL_MAX       32                  // Blocks below 4 GB
+#define TLSF_FL_COUNT     (TLSF_FL_MAX - TLSF_FL_SHIFT + 1)
+
 // ============================================================================
-// MEMORY POOL STRUCTURE
+// SLAB STRUCTURES
 // ============================================================================
 
+struct ThreadCache;
+
 /**
- * Represents a memory pool for a specific size class
+ * Slab header
+ * A slab is an aligned chunk of a pool carved into identical slots of one
+ * size class. The header is kept out of band and found through the page
+ * map, so the slab itself is nothing but slots.
  * 
- * TODO: Design this structure
- * Consider:
- * - Pointer to the memory pool
- * - Size of the pool
- * - Free list head
- * - Statistics (allocated, free, etc.)
+ * A slab is either central (owner is NULL; guarded by its pool's lock) or
+ * owned by one thread cache, whose thread alone touches the fields below
+ * without locking. Other threads only read owner, to route frees.
+ */
+struct SlabHeader {
+    char* base;              // First slot (the slab's start address)
+    SlabHeader* next;        // Links in the class's partial list (or owner's slab lists)
+    SlabHeader* prev;
+    void* free_slots;        // Intrusive free list through the slots
+    uint32_t used;           // Slots handed out
+    uint32_t capacity;       // Total slots in this slab
+    uint32_t next_unused;    // Slots past this index were never handed out
+    uint16_t class_index;
+    bool in_partial_list;
+    uint8_t scavenge_state;  // ScavengeState, while on the pool's free_slabs
+    uint8_t node;            // NUMA node of the pool it was carved from
+    std::atomic<ThreadCache*> owner;  // Owning cache, or NULL while central
+};
+
+// How far the scavenger has got with an empty slab
+enum ScavengeState : uint8_t {
+    SCAVENGE_DIRTY = 0,  // Freed since the last pass
+    SCAVENGE_AGED,       // Seen free by one pass; the next one purges it
+    SCAVENGE_PURGED      // Pages returned to the OS
+};
+
+/**
+ * Central state for one size class
+ * Slabs with at least one free slot sit on the partial list.
+ */
+struct SizeClass {
+    size_t slot_size;
+    struct MemoryPool* pool;  // Pool the slabs are carved from
+    SlabHeader* partial;
+    size_t slab_count;        // Slabs formatted for the class and not yet back on free_slabs
+};
+
+// ============================================================================
+// PAGE MAP STRUCTURE
+// ============================================================================
+
+// What a page of the page map belongs to
+enum PageKind : uint8_t {
+    PAGE_UNUSED = 0,  // Not ours
+    PAGE_SLAB,        // Slab pool: slots of one size class
+    PAGE_BLOCK,       // Variable-size pool: blocks with headers
+    PAGE_HUGE         // First page of a huge mapping
+};
+
+/**
+ * Page map entry
+ * One per page of every arena (and the first page of each huge mapping),
+ * so any pointer is classified in a few loads without touching the block.
+ */
+struct PageMapEntry {
+    struct MemoryPool* pool;  // Owning pool (NULL for huge mappings)
+    SlabHeader* slab;         // Slab pages: the slab's header
+    size_t span_size;         // Huge pages: mapped length
+    uint16_t size_class;      // Slab pages: the slab's size class
+    uint8_t kind;             // PageKind
+};
+
+// ============================================================================
+// MEMORY POOL STRUCTURE
+// ============================================================================
+
+/**
+ * One mapped region of a pool
+ * Pools start with a single arena and chain more as they fill up. Arenas are
+ * aligned to ARENA_CHUNK_SIZE so slabs never straddle a misaligned boundary.
+ */
+struct Arena {
+    Arena* next;   // Older arenas of the same pool
+    char* start;
+    size_t size;
+};
+
+/**
+ * A pool of memory for one range of request sizes on one NUMA node
+ * Slab pools (small, medium, large) carve their arenas into fixed-size
+ * slabs for the size classes. The variable-size pool (xlarge) splits its
+ * arenas into blocks with headers, indexed by TLSF lists or a free tree
+ * depending on its fit policy.
  */
 struct MemoryPool {
-    // TODO: Add your fields here
-    // Example:
-    // void* pool_start;
-    // size_t pool_size;
-    // BlockHeader* free_list;
-    // size_t allocated_bytes;
-    // size_t free_bytes;
-    void* pool_start;
-    size_t pool_size;
-    BlockHeader* free_list;
-
-
-    // for statistics
+    Arena* arenas;           // Chain of mapped regions, newest first
+    size_t pool_size;        // Total bytes mapped across all arenas
+    size_t next_arena_size;  // Size of the next arena to map
+    size_t max_block_size;   // Largest request this pool serves
+
+    // Variable-size pools only: FIT_GOOD pools index free blocks by size
+    // class (TLSF), the others keep them in free_tree. Bit f of fl_bitmap
+    // is set when row f has a non-empty list, bit s of sl_bitmap[f] when
+    // free_lists[f][s] is non-empty.
+    uint8_t fit_policy;      // FitPolicy
+    BlockHeader* free_tree;
+    uint32_t fl_bitmap;
+    uint32_t sl_bitmap[TLSF_FL_COUNT];
+    BlockHeader* free_lists[TLSF_FL_COUNT][TLSF_SL_COUNT];
+
+    int node;                // NUMA node its arenas are bound to
+
+    // Slab-backed pools only (slab_size is 0 for variable-size pools)
+    size_t slab_size;
+    char* slab_cursor;       // Next never-used slab in the newest arena
+    char* slab_end;          // End of the newest arena
+    SlabHeader* free_slabs;  // Empty slabs ready for any class
+    bool huge_pages;         // Some arena is huge-page backed (not scavenged)
+
+    // Statistics
     size_t allocated_bytes;
     size_t free_bytes;
+    size_t released_bytes;   // Total bytes handed back to the OS by the scavenger
+    size_t free_slab_count;  // Slab pools: slabs on free_slabs
+    size_t free_block_count; // Variable-size pools: blocks in the free lists or tree
+    size_t allocated_blocks; // Variable-size pools: blocks handed out
+    uint64_t alloc_calls;    // Variable-size pools: allocate_from_pool successes
+    uint64_t free_calls;     // Variable-size pools: free_to_pool calls
+
+    // Guards the free list and statistics; pools are shared by all threads
+    std::mutex lock;
+};
+
+/**
+ * The pools and size classes of one NUMA node
+ * Arenas of a node's pools are bound to that node, threads allocate from
+ * the node they run on, and every block is freed back to the node it came
+ * from (the page map points at its pool).
+ */
+struct NodePools {
+    MemoryPool small_pool;
+    MemoryPool medium_pool;
+    MemoryPool large_pool;
+    MemoryPool xlarge_pool;   // For blocks > LARGE_BLOCK_MAX
+    SizeClass size_classes[NUM_SIZE_CLASSES];
+};
+
+// ============================================================================
+// THREAD CACHE STRUCTURES
+// ============================================================================
+
+/**
+ * A magazine of free blocks for one size class
+ * Blocks in a magazine are still "allocated" as far as the pool is concerned,
+ * so popping and pushing them never touches shared state.
+ */
+struct CacheBin {
+    void* slots[TCACHE_MAGAZINE_SIZE];
+    uint32_t count;
+};
+
+/**
+ * Per-thread cache sitting in front of the shared pools
+ * One magazine per size class, fed from slabs the cache owns. Only a slab
+ * claim or release takes a pool lock.
+ * 
+ * Blocks freed by other threads are pushed onto remote_free with a single
+ * CAS (an MPSC list linked through the blocks) and drained in one exchange
+ * the next time the owner refills that class.
+ */
+struct ThreadCache {
+    CacheBin bins[NUM_SIZE_CLASSES];
+    SlabHeader* owned[NUM_SIZE_CLASSES];              // Owned slabs with free slots
+    SlabHeader* full[NUM_SIZE_CLASSES];               // Owned slabs with no free slot
+    std::atomic<void*> remote_free[NUM_SIZE_CLASSES];  // Blocks freed by other threads
+    ThreadCache* next_free;  // Link in the recycled cache list
+};
+
+/**
+ * Free blocks of one size class cached on one CPU
+ * Only touched inside rseq critical sections by a thread running on that
+ * CPU, so pushes and pops need no atomics. Like magazine blocks, cached
+ * blocks count as allocated in the pools.
+ */
+struct PerCpuBin {
+    uint32_t count;
+    uint32_t unused;  // Keeps slots 8-byte aligned at a fixed offset
+    void* slots[PERCPU_SLOTS];
+};
+
+/**
+ * One CPU's caches, cache-line aligned so neighbouring CPUs never share a line
+ */
+struct alignas(64) PerCpuCache {
+    PerCpuBin bins[PERCPU_NUM_CLASSES];
+};
+
+/**
+ * Allocation and free counts of one thread, per size class
+ * Slab allocations never take a lock, so they are counted here rather than
+ * in the pools: only the owning thread writes (a plain load and store, no
+ * locked instruction), and snapshots add up every ThreadStats ever made.
+ * Those of exited threads are recycled with their counts intact.
+ */
+struct ThreadStats {
+    std::atomic<uint64_t> allocs[NUM_SIZE_CLASSES];
+    std::atomic<uint64_t> frees[NUM_SIZE_CLASSES];
+    ThreadStats* next;       // Link in the list of every ThreadStats
+    ThreadStats* next_free;  // Link in the recycled list
+};
+
+// ============================================================================
+// HUGE ALLOCATION STRUCTURE
+// ============================================================================
+
+/**
+ * Side-table entry for a huge allocation
+ * Each huge allocation is its own page-aligned mapping with no in-band
+ * header, so the table is the only record of its size.
+ */
+struct HugeAllocation {
+    void* ptr;     // Start of the mapping (NULL marks an empty slot)
+    size_t size;   // Mapped length, a multiple of the page size
+};
+
+// ============================================================================
+// TRACE STRUCTURES
+// ============================================================================
+
+// Records buffered in memory before each write to the trace file
+#define TRACE_BUFFER_RECORDS 4096
+
+// Trace file: a TraceFileHeader followed by TraceRecords in call order
+#define TRACE_MAGIC    "MYALLOCT"
+#define TRACE_VERSION  1
+
+// Which public call a trace record describes
+enum TraceOp : uint8_t {
+    TRACE_MALLOC = 1,
+    TRACE_FREE,
+    TRACE_CALLOC,
+    TRACE_REALLOC,
+    TRACE_ALIGNED_ALLOC
+};
+
+struct TraceFileHeader {
+    char magic[8];         // TRACE_MAGIC (no terminator)
+    uint32_t version;      // TRACE_VERSION
+    uint32_t record_size;  // sizeof(TraceRecord)
+};
+
+/**
+ * One traced call
+ * Pointers are identified by their address, which is unique while the
+ * block is live; a replay maps each one to its own allocation.
+ */
+struct TraceRecord {
+    uint64_t timestamp;  // Nanoseconds since tracing started
+    uint64_t size;       // Requested bytes (calloc: num * size)
+    uint64_t ptr;        // Pointer returned, or freed for TRACE_FREE (0 on failure)
+    uint64_t arg;        // realloc: old pointer; calloc: num; aligned: alignment
+    uint32_t thread;     // Small per-thread id, in order of first traced call
+    uint8_t op;          // TraceOp
+    uint8_t reserved[3];
+};
+
+// ============================================================================
+// PROFILING STRUCTURES
+// ============================================================================
+
+// Mean bytes allocated between two heap profile samples
+#define PROFILE_SAMPLE_INTERVAL (2 * 1024 * 1024)
+
+// Deepest stack kept per sample (deeper ones are cut off at the bottom)
+#define PROFILE_MAX_DEPTH 32
+
+// Chains of the bucket table, and log2 of the slots of the filter my_free
+// checks before looking a pointer up
+#define PROFILE_BUCKET_SLOTS 4096
+#define PROFILE_FILTER_BITS  14
+
+/**
+ * One allocation stack of the heap profile
+ * Counts are of samples as drawn; pprof scales them back up using the
+ * sample interval named in the dump.
+ */
+struct ProfileBucket {
+    ProfileBucket* next;     // Next bucket of the same chain
+    uint64_t hash;           // Of the frames
+    uint64_t live_objects;   // Sampled and not yet freed
+    uint64_t live_bytes;
+    uint64_t alloc_objects;  // Sampled since profiling started
+    uint64_t alloc_bytes;
+    uint32_t depth;
+    void* frames[PROFILE_MAX_DEPTH];  // Return addresses, innermost first
+};
+
+// A sampled object that is still live
+struct ProfileSample {
+    void* ptr;               // NULL marks an empty slot
+    size_t size;             // Requested bytes
+    ProfileBucket* bucket;
+};
+
+// ============================================================================
+// REGION STRUCTURES
+// ============================================================================
+
+// Default and smallest region chunk sizes. Chunks are pool blocks (or huge
+// mappings), never slab slots, so they always come from the xlarge pool.
+#define REGION_CHUNK_SIZE      (64 * 1024)
+#define REGION_MIN_CHUNK_SIZE  (4 * 1024)
+
+// Header at the start of every region chunk
+struct RegionChunk {
+    RegionChunk* next;  // Next older chunk
+    size_t size;        // Bytes in the chunk, header included
+};
+
+/**
+ * Region (scoped arena): bump allocation from chunks taken from the pools
+ * Objects are never freed one by one; region_reset and region_destroy give
+ * every chunk back at once. The Region itself lives in its first chunk.
+ * A region is not thread-safe.
+ */
+struct Region {
+    char* cursor;          // Next free byte in the current chunk
+    char* end;             // End of the current chunk
+    RegionChunk* chunks;   // Newest first; the last one holds this header
+    size_t chunk_size;     // Size of regular chunks
+};
+
+// ============================================================================
+// STATISTICS STRUCTURES
+// ============================================================================
+
+/**
+ * Usage of one size class, one pool, or the whole allocator
+ * 
+ * Blocks sitting in thread or per-CPU caches count as free here (they are
+ * allocated as far as the pools are concerned). fragmentation is the
+ * external fragmentation ratio 1 - largest_free / free_bytes for pools;
+ * for a size class, whose free slots no other class can use, it is the
+ * share of the class's slab bytes that sit free. Both are 0 when nothing
+ * is free.
+ */
+struct AllocStats {
+    uint64_t alloc_calls;
+    uint64_t free_calls;
+    size_t live_objects;
+    size_t live_bytes;
+    size_t free_blocks;     // Free slots, free blocks, free slabs and uncarved space
+    size_t free_bytes;
+    size_t largest_free;    // Largest single free extent
+    double fragmentation;
+    size_t mapped_bytes;
+    size_t resident_bytes;  // 0 unless the snapshot asked for it
+};
+
+// Pools of AllocatorStats (summed over NUMA nodes)
+enum StatsPool {
+    STATS_POOL_SMALL = 0,
+    STATS_POOL_MEDIUM,
+    STATS_POOL_LARGE,
+    STATS_POOL_XLARGE,
+    STATS_POOL_HUGE,    // Huge mappings, one per allocation
+    STATS_POOL_COUNT
+};
+
+struct AllocatorStats {
+    AllocStats classes[NUM_SIZE_CLASSES];
+    AllocStats pools[STATS_POOL_COUNT];
+    AllocStats total;
 };
 
 // ============================================================================
@@ -118,6 +574,92 @@ void* my_calloc(size_t num, size_t size);
  */
 void* my_realloc(void* ptr, size_t size);
 
+/**
+ * Get the number of usable bytes in a block (replaces malloc_usable_size)
+ * 
+ * @param ptr Pointer returned by my_malloc and friends
+ * @return Usable size, or 0 for NULL and pointers we do not own
+ */
+size_t my_malloc_usable_size(void* ptr);
+
+/**
+ * Allocate memory at a multiple of alignment (replaces aligned_alloc)
+ * Release it with my_free; my_realloc keeps only ALIGNMENT alignment.
+ * 
+ * @param alignment Power of two
+ * @param size Number of bytes to allocate
+ * @return Aligned pointer, or NULL on failure or invalid alignment
+ */
+void* my_aligned_alloc(size_t alignment, size_t size);
+
+/**
+ * Allocate aligned memory (replaces posix_memalign)
+ * 
+ * @param memptr Receives the aligned pointer on success
+ * @param alignment Power of two and a multiple of sizeof(void*)
+ * @param size Number of bytes to allocate
+ * @return 0 on success, EINVAL for a bad alignment, ENOMEM if out of memory
+ */
+int my_posix_memalign(void** memptr, size_t alignment, size_t size);
+
+/**
+ * Allocate count blocks of the same size in one call
+ * The size class, thread cache and pool are looked up once and the blocks
+ * are carved in a single pass. Each block is released with my_free or
+ * my_free_batch.
+ * 
+ * @param size Number of bytes in each block
+ * @param count Number of blocks to allocate
+ * @param out Receives the block pointers (count entries)
+ * @return Number of blocks allocated; fewer than count only if memory ran out
+ */
+size_t my_malloc_batch(size_t size, size_t count, void** out);
+
+/**
+ * Free count blocks in one call (NULL entries are skipped)
+ * Consecutive blocks of the same variable-size pool share one lock
+ * acquisition.
+ * 
+ * @param ptrs Blocks to free
+ * @param count Number of entries in ptrs
+ */
+void my_free_batch(void** ptrs, size_t count);
+
+/**
+ * Create a region
+ * 
+ * @param chunk_size Bytes to take from the pool at a time (0 for
+ *                   REGION_CHUNK_SIZE; at least REGION_MIN_CHUNK_SIZE)
+ * @return New region, or NULL if out of memory
+ */
+Region* region_create(size_t chunk_size = 0);
+
+/**
+ * Allocate from a region by bumping its cursor
+ * Requests larger than a quarter of a chunk get a chunk of their own.
+ * 
+ * @param region Region to allocate from
+ * @param size Number of bytes
+ * @param alignment Power of two
+ * @return Pointer valid until the region is reset or destroyed, or NULL
+ */
+void* region_alloc(Region* region, size_t size, size_t alignment = ALIGNMENT);
+
+/**
+ * Free everything allocated from a region, keeping its first chunk
+ * Chunks go back to the pool in one pass under one lock.
+ * 
+ * @param region Region to reset
+ */
+void region_reset(Region* region);
+
+/**
+ * Free everything allocated from a region and the region itself
+ * 
+ * @param region Region to destroy (NULL is ignored)
+ */
+void region_destroy(Region* region);
+
 // ============================================================================
 // INTERNAL FUNCTIONS - Helper functions you'll implement
 // ============================================================================
@@ -128,6 +670,132 @@ void* my_realloc(void* ptr, size_t size);
  */
 void allocator_init();
 
+/**
+ * Enable or disable progress messages (pool setup, init) on stderr.
+ * Off by default; MYALLOC_VERBOSE=1 turns them on at init.
+ *
+ * @param verbose true to print progress messages
+ */
+void allocator_set_verbose(bool verbose);
+
+/**
+ * Set how long memory must stay free before it is returned to the OS
+ * Free slabs and free pages inside pool blocks are released with
+ * madvise(MADV_DONTNEED) by a scavenger pass, which runs incrementally
+ * from the free path at most once per decay period. Memory is released
+ * after between one and two periods, so a burst that frees and
+ * reallocates within a period does not fault pages back in.
+ * Defaults to SCAVENGE_DECAY_MS, or MYALLOC_DECAY_MS at init.
+ * 
+ * @param decay_ms Period in milliseconds; negative turns the scavenger off
+ */
+void allocator_set_decay_ms(long decay_ms);
+
+/**
+ * Run one scavenger pass now
+ * 
+ * @param force Release all free memory, not only memory aged a full period
+ * @return Bytes returned to the OS by this pass
+ */
+size_t allocator_scavenge(bool force);
+
+/**
+ * Back slab-pool arenas mapped from now on with huge pages
+ * Only the slab pools use them: their objects are small and densely
+ * packed, so a huge page is well used and saves many TLB entries. Those
+ * pools are then left alone by the scavenger, which would split the huge
+ * pages. Falls back to regular pages when huge pages are unavailable.
+ * Defaults to MYALLOC_HUGEPAGES at init ("thp" or "hugetlb"), else off.
+ * 
+ * @param mode HugePageMode for future arenas
+ */
+void allocator_set_huge_pages(HugePageMode mode);
+
+/**
+ * Choose how the variable-size pools pick a free block
+ * Takes effect when the pools are set up, i.e. at the next allocator_init
+ * (call it first, or between allocator_cleanup and allocator_init).
+ * Defaults to MYALLOC_FIT at init ("good", "best" or "address"), else
+ * FIT_GOOD.
+ * 
+ * @param policy FitPolicy for pools initialized from now on
+ */
+void allocator_set_fit_policy(FitPolicy policy);
+
+/**
+ * Cache the small size classes (up to PERCPU_MAX_SIZE) per CPU instead of
+ * per thread
+ * Uses Linux restartable sequences: a thread pops and pushes the free list
+ * of the CPU it runs on without atomics, and the kernel restarts the
+ * operation if the thread is preempted or migrated halfway. Cached memory
+ * is then bounded by the number of CPUs, however many threads there are.
+ * Threads without rseq (and larger classes) keep using thread caches.
+ * Blocks already cached per CPU stay there when the mode is turned off,
+ * until it is turned on again or allocator_cleanup.
+ * Defaults to MYALLOC_PERCPU=1 at init, else off.
+ * 
+ * @param enable true to turn per-CPU caches on
+ * @return true if per-CPU caches are now in use (false when rseq is
+ *         unavailable or enable is false)
+ */
+bool allocator_set_percpu_cache(bool enable);
+
+/**
+ * Read and/or change an allocator setting or statistic by name, in the
+ * manner of jemalloc's mallctl
+ * The old value is copied to oldp before newp is applied. Values are
+ * bool, long, size_t, uint64_t, double or const char* (a static string),
+ * depending on the key, and the lengths must match exactly. The same keys
+ * can be set at init with MYALLOC_CONF="key:value,key:value".
+ * 
+ *   pools.<pool>.arena_size  size_t  rw  Size of the pool's next arena (a
+ *                                        multiple of ARENA_CHUNK_SIZE)
+ *   pools.<pool>.max_size    size_t  r   Largest request the pool serves
+ *   pools.<pool>.slab_size   size_t  r   0 for xlarge
+ *   tcache.max               size_t  rw  Blocks a magazine holds (up to
+ *                                        TCACHE_MAGAZINE_SIZE)
+ *   tcache.batch             size_t  rw  Blocks per refill/flush (<= max)
+ *   tcache.flush             bool    w   Empty the calling thread's cache
+ *   percpu.enabled           bool    rw  allocator_set_percpu_cache
+ *   decay_ms                 long    rw  allocator_set_decay_ms
+ *   scavenge                 bool    w   allocator_scavenge(value)
+ *   huge_pages               string  rw  "off", "thp" or "hugetlb"
+ *   fit_policy               string  rw  "good", "best" or "address";
+ *                                        re-indexes the live pools' free
+ *                                        blocks
+ *   verbose                  bool    rw  allocator_set_verbose
+ *   mmap_threshold           size_t  r
+ *   numa.nodes               size_t  r
+ *   size_classes.count       size_t  r
+ *   size_classes.<i>.size    size_t  r
+ *   profile.active           bool    rw  allocator_profile_start/stop
+ *   profile.sample_interval  size_t  rw  Mean bytes between samples
+ *   profile.dump             string  w   allocator_profile_dump(path)
+ *   stats.<scope>.<field>    r       A field of AllocStats for scope
+ *                                    small, medium, large, xlarge, huge,
+ *                                    total or classes.<i> (from a fresh
+ *                                    allocator_stats_snapshot)
+ * 
+ * @param name Key
+ * @param oldp Where to copy the current value (NULL to skip reading)
+ * @param oldlenp Size of *oldp
+ * @param newp New value (NULL to skip writing)
+ * @param newlen Size of *newp
+ * @return 0, ENOENT for an unknown key, EPERM when reading a write-only or
+ *         writing a read-only key, EINVAL for a wrong length or bad value,
+ *         EIO when profile.dump cannot write its file
+ */
+int my_allocctl(const char* name, void* oldp, size_t* oldlenp, const void* newp, size_t newlen);
+
+/**
+ * Start a background thread running a scavenger pass every decay period,
+ * so RSS shrinks even when the program stops freeing memory
+ * Stopped by allocator_cleanup.
+ * 
+ * @return true if the thread is running
+ */
+bool allocator_start_scavenger();
+
 /**
  * Cleanup the allocator
  * Call this at program end
@@ -159,7 +827,7 @@ BlockHeader* get_header(void* ptr);
 void* get_user_ptr(BlockHeader* header);
 
 /**
- * Find the appropriate pool for a given size
+ * Find the appropriate pool for a given size on the calling thread's node
  * 
  * @param size Requested size
  * @return Pointer to appropriate MemoryPool
@@ -170,11 +838,51 @@ MemoryPool* select_pool(size_t size);
  * Initialize a memory pool
  * 
  * @param pool Pool to initialize
- * @param size Size of the pool
+ * @param size Size of the pool's first arena
  * @param max_block_size Maximum block size for this pool
  */
 void init_pool(MemoryPool* pool, size_t pool_size, size_t max_block_size);
 
+/**
+ * Initialize a slab-backed pool
+ * The region is aligned to slab_size so a slot's slab can be found by
+ * rounding its address down.
+ * 
+ * @param pool Pool to initialize
+ * @param pool_size Size of the first arena (a multiple of slab_size)
+ * @param max_block_size Largest size class carved from this pool
+ * @param slab_size Size and alignment of each slab
+ */
+void init_slab_pool(MemoryPool* pool, size_t pool_size, size_t max_block_size,
+                    size_t slab_size);
+
+/**
+ * Map another arena and chain it onto a pool
+ * The arena is at least min_size bytes; arena sizes double from the
+ * initial pool size up to ARENA_MAX_SIZE.
+ * 
+ * @param pool Pool to grow (caller holds its lock)
+ * @param min_size Minimum usable size of the new arena
+ * @return The new arena, or NULL if the OS refused the mapping
+ */
+Arena* grow_pool(MemoryPool* pool, size_t min_size);
+
+/**
+ * Find the pool that owns a pointer
+ * 
+ * @param ptr Any pointer into an arena
+ * @return Owning pool, or NULL if the pointer is not in any arena
+ */
+MemoryPool* lookup_pool(void* ptr);
+
+/**
+ * Look up a pointer in the page map (two loads, no locking)
+ * 
+ * @param ptr Any pointer
+ * @return Entry for ptr's page, or NULL if no page near ptr was ever mapped
+ */
+PageMapEntry* page_map_lookup(void* ptr);
+
 /**
  * Allocate from a specific pool
  * 
@@ -184,6 +892,17 @@ void init_pool(MemoryPool* pool, size_t pool_size, size_t max_block_size);
  */
 void* allocate_from_pool(MemoryPool* pool, size_t size);
 
+/**
+ * Allocate from a variable-size pool at a given alignment, returning the
+ * fragment in front of the aligned block to the pool's free lists
+ * 
+ * @param pool Variable-size pool to allocate from (caller holds its lock)
+ * @param size Size to allocate
+ * @param alignment Power of two above ALIGNMENT
+ * @return Pointer aligned to alignment, or NULL
+ */
+void* allocate_aligned_from_pool(MemoryPool* pool, size_t size, size_t alignment);
+
 /**
  * Free a block back to its pool
  * 
@@ -193,7 +912,8 @@ void* allocate_from_pool(MemoryPool* pool, size_t size);
 void free_to_pool(MemoryPool* pool, BlockHeader* header);
 
 /**
- * Add a block to the free list
+ * Add a block to the free list for its size (at the head), or to the
+ * pool's free tree
  * 
  * @param pool Pool containing the block
  * @param header Block to add
@@ -201,7 +921,8 @@ void free_to_pool(MemoryPool* pool, BlockHeader* header);
 void add_to_free_list(MemoryPool* pool, BlockHeader* header);
 
 /**
- * Remove a block from the free list
+ * Remove a block from its free list or the free tree (its size must not
+ * have changed since it was added)
  * 
  * @param pool Pool containing the block
  * @param header Block to remove
@@ -210,6 +931,9 @@ void remove_from_free_list(MemoryPool* pool, BlockHeader* header);
 
 /**
  * Coalesce adjacent free blocks
+ * Merges with both physical neighbours in O(1) using the boundary tags.
+ * The block must not be on the free list; merged neighbours are removed.
+ * The result is marked free and gets its footer.
  * 
  * @param pool Pool to coalesce in
  * @param header Block to start coalescing from
@@ -217,8 +941,25 @@ void remove_from_free_list(MemoryPool* pool, BlockHeader* header);
  */
 BlockHeader* coalesce_blocks(MemoryPool* pool, BlockHeader* header);
 
+/**
+ * Find a free block in constant time (TLSF good fit)
+ * The request is rounded up to the next list boundary, so the head of the
+ * first non-empty list from there on always fits; two bitmap scans find it.
+ * A block in the request's own list that would just fit may be passed over.
+ * Tree pools have no lists and answer as find_first_fit.
+ * 
+ * @param pool Pool to search
+ * @param size Required size
+ * @return Pointer to suitable block, or NULL
+ */
+BlockHeader* find_good_fit(MemoryPool* pool, size_t size);
+
 /**
  * Find a free block using first-fit strategy
+ * FIT_GOOD pools walk the request's own list, then take the head of the
+ * next non-empty one (finds a block whenever any fits, but the walk is not
+ * bounded). Tree pools search in O(log n): FIT_ADDRESS returns the
+ * lowest-addressed block that fits, FIT_BEST the smallest.
  * 
  * @param pool Pool to search
  * @param size Required size
@@ -228,6 +969,9 @@ BlockHeader* find_first_fit(MemoryPool* pool, size_t size);
 
 /**
  * Find a free block using best-fit strategy
+ * The smallest block that fits: O(log n) in a FIT_BEST pool, a walk of
+ * two lists in a FIT_GOOD pool, and a pruned walk of the tree in a
+ * FIT_ADDRESS pool.
  * 
  * @param pool Pool to search
  * @param size Required size
@@ -237,34 +981,259 @@ BlockHeader* find_best_fit(MemoryPool* pool, size_t size);
 
 /**
  * Split a block if it's too large
+ * The remainder becomes a free block, is merged with a free next
+ * neighbour and goes on the free list. Statistics are left to the caller.
  * 
- * @param header Block to split
- * @param size Size needed
+ * @param pool Pool containing the block
+ * @param header Block to split (not on the free list)
+ * @param size Total block size needed, header included
  * @return Pointer to the block that will be used
  */
-BlockHeader* split_block(BlockHeader* header, size_t size);
+BlockHeader* split_block(MemoryPool* pool, BlockHeader* header, size_t size);
+
+/**
+ * Resize an allocated variable-size block without moving it
+ * Grows by absorbing a free next neighbour; shrinks by returning the tail
+ * to the free list.
+ * 
+ * @param pool Pool containing the block (caller holds its lock)
+ * @param header Block to resize
+ * @param size New user size
+ * @return true if the block now holds size bytes
+ */
+bool resize_in_place(MemoryPool* pool, BlockHeader* header, size_t size);
+
+// ============================================================================
+// HUGE ALLOCATIONS
+// ============================================================================
+
+/**
+ * Map a dedicated region for a huge request
+ * 
+ * @param size Requested size (at least MMAP_THRESHOLD, or any size when
+ *             the caller needs page or coarser alignment)
+ * @param alignment Required alignment; 0 or anything up to the page size
+ *                  means page-aligned
+ * @return Aligned pointer, or NULL on failure
+ */
+void* huge_alloc(size_t size, size_t alignment = 0);
+
+/**
+ * Unmap a huge allocation
+ * 
+ * @param ptr Pointer returned by huge_alloc
+ * @return true if ptr was a huge allocation (and is now unmapped)
+ */
+bool huge_free(void* ptr);
+
+/**
+ * Resize a huge allocation in place or by remapping its pages (no copy)
+ * 
+ * @param ptr Pointer returned by huge_alloc
+ * @param size New size (at least MMAP_THRESHOLD)
+ * @return New pointer, or NULL on failure (ptr stays valid)
+ */
+void* huge_realloc(void* ptr, size_t size);
+
+/**
+ * Get the mapped size of a huge allocation
+ * 
+ * @param ptr Any pointer
+ * @return Mapped size, or 0 if ptr is not a huge allocation
+ */
+size_t huge_usable_size(void* ptr);
+
+// ============================================================================
+// SIZE CLASSES & THREAD CACHE
+// ============================================================================
+
+/**
+ * Map a request size to its size class
+ * 
+ * @param size Requested size (1..LARGE_BLOCK_MAX)
+ * @return Size class index
+ */
+int size_class_index(size_t size);
+
+/**
+ * Get the block size served by a size class
+ * 
+ * @param class_index Size class index
+ * @return Size in bytes of every block in this class
+ */
+size_t size_class_size(int class_index);
+
+/**
+ * Allocate one block of a known size class, skipping the size lookup
+ * Used by ObjectPool (object_pool.h), which picks the class at compile time
+ * with size_class_for. Release the block with my_free.
+ * 
+ * @param class_index Size class index
+ * @return Pointer to a block of size_class_size(class_index) bytes, or NULL
+ */
+void* my_malloc_class(int class_index);
+
+/**
+ * Allocate one slot of a size class from a central slab (caller holds the
+ * class's pool lock on that node; used when the thread has no cache)
+ * 
+ * @param node NUMA node to allocate on
+ * @param class_index Size class to allocate from
+ * @return Pointer to the slot, or NULL if the pool has no slab to spare
+ */
+void* slab_alloc(int node, int class_index);
+
+/**
+ * Return a slot to a central slab (caller holds the slab's pool lock)
+ * 
+ * @param slab Slab owning the slot
+ * @param ptr Slot to free
+ */
+void slab_free(SlabHeader* slab, void* ptr);
+
+/**
+ * Find the slab containing a pointer from a slab-backed pool
+ * 
+ * @param ptr Pointer into a slab
+ * @return Slab header (from the page map)
+ */
+SlabHeader* get_slab(void* ptr);
+
+/**
+ * Get the calling thread's cache, creating it on first use
+ * 
+ * @return Thread cache, or NULL if one could not be created
+ */
+ThreadCache* get_thread_cache();
+
+/**
+ * Move a batch of blocks into a cache bin: remotely freed blocks first,
+ * then slots of owned slabs, claiming a slab from the pool if need be
+ * 
+ * @param cache Thread cache to refill
+ * @param class_index Size class to refill
+ * @return Number of blocks added
+ */
+size_t thread_cache_refill(ThreadCache* cache, int class_index);
+
+/**
+ * Return a batch of blocks from a cache bin to their (owned) slabs
+ * 
+ * @param cache Thread cache to flush
+ * @param class_index Size class to flush
+ * @param count Number of blocks to return
+ */
+void thread_cache_flush_bin(ThreadCache* cache, int class_index, size_t count);
+
+/**
+ * Return every cached block of the calling thread to the shared pools
+ * Threads do this automatically when they exit. Partially used slabs go
+ * back to the pools; full ones stay with the recycled cache, whose next
+ * thread drains their remote frees.
+ */
+void thread_cache_flush();
+
+/**
+ * Free a slab slot that belongs to another thread's cache: a lock-free push
+ * onto the owner's remote list (central slabs are freed under the pool lock)
+ * 
+ * @param slab Slab containing the slot
+ * @param ptr Slot to free
+ */
+void slab_free_remote(SlabHeader* slab, void* ptr);
 
 // ============================================================================
 // STATISTICS & DEBUGGING
 // ============================================================================
 
 /**
- * Print allocator statistics
+ * Number of NUMA nodes with their own pools (1 on single-node machines)
+ */
+int allocator_numa_nodes();
+
+/**
+ * NUMA node whose pools a block came from
+ * 
+ * @param ptr Pointer returned by my_malloc and friends
+ * @return Node index, or -1 for huge allocations and foreign pointers
+ */
+int my_malloc_node(void* ptr);
+
+/**
+ * Start logging every public allocation call to a binary trace file
+ * Also started at init when MYALLOC_TRACE names a file.
+ * 
+ * @param path File to create (truncated if it exists)
+ * @return true if tracing is now on
+ */
+bool allocator_trace_start(const char* path);
+
+/**
+ * Flush buffered trace records and close the trace file
+ */
+void allocator_trace_stop();
+
+/**
+ * Start sampling allocations for the heap profile
+ * Sample points fall on allocated bytes at random, about one per
+ * sample_interval bytes (a Poisson process), so an allocation of n bytes
+ * is sampled with probability 1 - exp(-n / sample_interval). A sampled
+ * allocation's stack is kept until it is freed. Samples of an earlier run
+ * are dropped. Also started at init when MYALLOC_PROFILE names a file,
+ * which the profile is then written to at exit.
+ * 
+ * @param sample_interval Mean bytes between samples (0 keeps the current
+ *                        interval, PROFILE_SAMPLE_INTERVAL unless changed)
+ */
+void allocator_profile_start(size_t sample_interval = 0);
+
+/**
+ * Stop sampling new allocations
+ * Samples already taken stay, and frees keep removing them, so the profile
+ * can still be dumped.
+ */
+void allocator_profile_stop();
+
+/**
+ * Write the heap profile in the gperftools heap format that pprof reads
+ * Every stack gets its live objects and bytes, and in brackets all it
+ * allocated since profiling started (pprof -sample_index=alloc_space).
+ * The counts are raw samples: pprof scales them by the sample interval
+ * in the header.
+ * 
+ * @param path File to create (truncated if it exists)
+ * @return true if the profile was written
+ */
+bool allocator_profile_dump(const char* path);
+
+/**
+ * Take a snapshot of per-class, per-pool and total statistics
+ * Cheap enough to poll: it adds up counters and holds each pool lock only
+ * briefly, without walking blocks or slabs. Asking for resident bytes
+ * makes it query the kernel (mincore) for every mapped page, which is not.
+ * 
+ * @param stats Filled in (zeroed first)
+ * @param resident Also fill in resident_bytes
+ */
+void allocator_stats_snapshot(AllocatorStats* stats, bool resident = false);
+
+/**
+ * Print allocator statistics (a snapshot with resident bytes)
  */
 void print_allocator_stats();
 
 /**
- * Get total allocated memory
+ * Get total allocated memory (live bytes, huge allocations included)
  */
 size_t get_allocated_bytes();
 
 /**
- * Get total free memory
+ * Get total free memory (mapped by the pools but not live)
  */
 size_t get_free_bytes();
 
 /**
- * Get number of free blocks
+ * Get number of free blocks (see AllocStats::free_blocks)
  */
 size_t get_free_block_count();
 
@@ -0,0 +1,511 @@
+#include "allocator.h"
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+// ============================================================================
+// BENCHMARK SUITE
+// ============================================================================
+//
+// Runs every scenario against glibc malloc and my_malloc and prints one CSV
+// row per measurement:
+//
+//     scenario,allocator,parameter,metric,value
+//
+// Rows are stable across runs, so two outputs can be joined on the first
+// four columns to spot regressions. Pass --quick for a short smoke run.
+
+// The allocator under test, as a table of entry points
+struct BenchAllocator {
+    const char* name;
+    void* (*alloc)(size_t);
+    void (*release)(void*);
+    void* (*resize)(void*, size_t);
+    size_t (*alloc_batch)(size_t, size_t, void**);
+    void (*release_batch)(void**, size_t);
+};
+
+// glibc has no batch calls; loop over malloc/free instead
+static size_t glibc_malloc_batch(size_t size, size_t count, void** out) {
+    for (size_t i = 0; i < count; i++) {
+        out[i] = malloc(size);
+    }
+    return count;
+}
+
+static void glibc_free_batch(void** ptrs, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        free(ptrs[i]);
+    }
+}
+
+static const BenchAllocator allocators[] = {
+    {"glibc", malloc, free, realloc, glibc_malloc_batch, glibc_free_batch},
+    {"my_malloc", my_malloc, my_free, my_realloc, my_malloc_batch, my_free_batch},
+};
+
+// Iteration counts (scaled down by --quick)
+static size_t throughput_ops = 2000000;
+static size_t latency_samples = 200000;
+static size_t realloc_rounds = 2000;
+static size_t transfer_ops = 1000000;
+static size_t tlb_accesses = 20000000;
+static size_t fit_ops = 400000;
+
+// ============================================================================
+// HELPERS
+// ============================================================================
+
+typedef std::chrono::steady_clock bench_clock;
+
+static double elapsed_ns(bench_clock::time_point start) {
+    return std::chrono::duration<double, std::nano>(bench_clock::now() - start).count();
+}
+
+static void report(const char* scenario, const char* allocator, size_t parameter,
+                   const char* metric, double value) {
+    std::cout << scenario << "," << allocator << "," << parameter << ","
+              << metric << "," << value << "\n";
+}
+
+static int open_dtlb_counter() {
+    // dTLB load misses of this thread in user space, or -1 if the kernel
+    // or the (virtual) CPU does not expose the counter
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void touch(void* ptr, size_t size) {
+    // Write the first and last byte so the allocation is really used
+    char* bytes = (char*)ptr;
+    bytes[0] = 1;
+    bytes[size - 1] = 1;
+}
+
+// ============================================================================
+// SCENARIO 1: THROUGHPUT PER SIZE CLASS
+// ============================================================================
+
+static void bench_throughput(const BenchAllocator& allocator) {
+    // Allocate a batch, then free it, over and over: the batch is large
+    // enough to empty the thread caches and reach the shared pools
+
+    static const size_t sizes[] = {16, 32, 64, 128, 256, 512, 1024, 4096, 65536};
+    const size_t batch = 256;
+    std::vector<void*> ptrs(batch);
+
+    for (size_t size : sizes) {
+        size_t ops = throughput_ops;
+        if (size >= 4096) {
+            ops /= 8;  // Page-sized and larger requests are slower everywhere
+        }
+
+        bench_clock::time_point start = bench_clock::now();
+        for (size_t done = 0; done < ops; done += batch) {
+            for (size_t i = 0; i < batch; i++) {
+                ptrs[i] = allocator.alloc(size);
+                touch(ptrs[i], size);
+            }
+            for (size_t i = 0; i < batch; i++) {
+                allocator.release(ptrs[i]);
+            }
+        }
+        double ns = elapsed_ns(start);
+
+        report("throughput", allocator.name, size, "mops_per_sec", ops / ns * 1000.0);
+    }
+}
+
+// ============================================================================
+// SCENARIO 2: LATENCY PERCENTILES
+// ============================================================================
+
+static void bench_latency(const BenchAllocator& allocator) {
+    // Time single malloc and free calls under a mixed, randomly sized
+    // working set (the same sequence for every allocator)
+
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<size_t> size_dist(1, 8192);
+    const size_t live = 4096;
+    std::vector<void*> slots(live, nullptr);
+    std::vector<double> alloc_ns(latency_samples);
+    std::vector<double> free_ns(latency_samples);
+
+    for (size_t i = 0; i < latency_samples; i++) {
+        size_t slot = rng() % live;
+        size_t size = size_dist(rng);
+
+        bench_clock::time_point start = bench_clock::now();
+        allocator.release(slots[slot]);
+        free_ns[i] = elapsed_ns(start);
+
+        start = bench_clock::now();
+        slots[slot] = allocator.alloc(size);
+        alloc_ns[i] = elapsed_ns(start);
+        touch(slots[slot], size);
+    }
+    for (void* ptr : slots) {
+        allocator.release(ptr);
+    }
+
+    const struct { const char* name; std::vector<double>* samples; } series[] = {
+        {"malloc", &alloc_ns}, {"free", &free_ns},
+    };
+    for (const auto& entry : series) {
+        std::vector<double>& samples = *entry.samples;
+        std::sort(samples.begin(), samples.end());
+        std::string prefix = std::string(entry.name) + "_";
+        report("latency", allocator.name, 0, (prefix + "p50_ns").c_str(),
+               samples[samples.size() / 2]);
+        report("latency", allocator.name, 0, (prefix + "p99_ns").c_str(),
+               samples[samples.size() * 99 / 100]);
+        report("latency", allocator.name, 0, (prefix + "p999_ns").c_str(),
+               samples[samples.size() * 999 / 1000]);
+    }
+}
+
+// ============================================================================
+// SCENARIO 3: REALLOC GROWTH PATTERNS
+// ============================================================================
+
+static void bench_realloc(const BenchAllocator& allocator) {
+    // Grow a buffer from 16 bytes to 1 MB, the way a string builder
+    // (additive steps) or a vector (doubling) would, counting moves
+
+    const size_t limit = 1024 * 1024;
+    const struct { const char* name; size_t parameter; } patterns[] = {
+        {"additive_4k", 4096}, {"doubling", 2},
+    };
+
+    for (const auto& pattern : patterns) {
+        size_t rounds = pattern.parameter == 2 ? realloc_rounds * 16 : realloc_rounds / 4;
+        size_t moves = 0;
+        size_t steps = 0;
+
+        bench_clock::time_point start = bench_clock::now();
+        for (size_t round = 0; round < rounds; round++) {
+            size_t size = 16;
+            char* buffer = (char*)allocator.alloc(size);
+            buffer[0] = 1;
+            while (size < limit) {
+                size = pattern.parameter == 2 ? size * 2 : size + pattern.parameter;
+                char* grown = (char*)allocator.resize(buffer, size);
+                moves += (grown != buffer);
+                steps++;
+                buffer = grown;
+                buffer[size - 1] = 1;
+            }
+            allocator.release(buffer);
+        }
+        double ns = elapsed_ns(start);
+
+        std::string prefix = std::string(pattern.name) + "_";
+        report("realloc", allocator.name, pattern.parameter, (prefix + "ns_per_step").c_str(),
+               ns / steps);
+        report("realloc", allocator.name, pattern.parameter, (prefix + "moved_percent").c_str(),
+               100.0 * moves / steps);
+    }
+}
+
+// ============================================================================
+// SCENARIO 4: PRODUCER/CONSUMER CROSS-THREAD FREES
+// ============================================================================
+
+static void bench_transfer(const BenchAllocator& allocator) {
+    // One thread allocates, another frees what it receives through a
+    // single-producer/single-consumer ring
+
+    static const size_t sizes[] = {64, 512, 4096};
+    const size_t ring_size = 1024;  // Power of two
+
+    for (size_t size : sizes) {
+        std::vector<void*> ring(ring_size);
+        std::atomic<size_t> head(0);  // Next slot the producer fills
+        std::atomic<size_t> tail(0);  // Next slot the consumer drains
+
+        bench_clock::time_point start = bench_clock::now();
+
+        std::thread consumer([&]() {
+            for (size_t i = 0; i < transfer_ops; i++) {
+                while (tail.load(std::memory_order_relaxed) ==
+                       head.load(std::memory_order_acquire)) {
+                    std::this_thread::yield();
+                }
+                size_t slot = tail.load(std::memory_order_relaxed);
+                allocator.release(ring[slot & (ring_size - 1)]);
+                tail.store(slot + 1, std::memory_order_release);
+            }
+        });
+
+        for (size_t i = 0; i < transfer_ops; i++) {
+            void* ptr = allocator.alloc(size);
+            touch(ptr, size);
+            while (head.load(std::memory_order_relaxed) -
+                   tail.load(std::memory_order_acquire) == ring_size) {
+                std::this_thread::yield();
+            }
+            size_t slot = head.load(std::memory_order_relaxed);
+            ring[slot & (ring_size - 1)] = ptr;
+            head.store(slot + 1, std::memory_order_release);
+        }
+        consumer.join();
+        double ns = elapsed_ns(start);
+
+        report("transfer", allocator.name, size, "mops_per_sec", transfer_ops / ns * 1000.0);
+    }
+}
+
+// ============================================================================
+// SCENARIO 5: BATCH ALLOCATION
+// ============================================================================
+
+static void bench_batch(const BenchAllocator& allocator) {
+    // The throughput loop again, but each batch is one call each way
+
+    static const size_t sizes[] = {64, 512, 4096};
+    const size_t batch = 256;
+    std::vector<void*> ptrs(batch);
+
+    for (size_t size : sizes) {
+        bench_clock::time_point start = bench_clock::now();
+        for (size_t done = 0; done < throughput_ops; done += batch) {
+            allocator.alloc_batch(size, batch, ptrs.data());
+            for (size_t i = 0; i < batch; i++) {
+                touch(ptrs[i], size);
+            }
+            allocator.release_batch(ptrs.data(), batch);
+        }
+        double ns = elapsed_ns(start);
+
+        report("batch", allocator.name, size, "mops_per_sec", throughput_ops / ns * 1000.0);
+    }
+}
+
+// ============================================================================
+// SCENARIO 6: TLB MISSES WITH AND WITHOUT HUGE PAGES
+// ============================================================================
+
+static void run_tlb(const BenchAllocator& allocator, int huge_pages) {
+    // Chase pointers through 64 MB of 64-byte objects in random order: with
+    // 4 KB pages almost every step needs a new TLB entry
+
+    const size_t objects = 1 << 20;
+    std::vector<void*> ptrs(objects);
+    for (size_t i = 0; i < objects; i++) {
+        ptrs[i] = allocator.alloc(64);
+    }
+
+    std::vector<size_t> order(objects);
+    for (size_t i = 0; i < objects; i++) {
+        order[i] = i;
+    }
+    std::shuffle(order.begin(), order.end(), std::mt19937(7));
+    for (size_t i = 0; i < objects; i++) {
+        *(void**)ptrs[order[i]] = ptrs[order[(i + 1) % objects]];
+    }
+
+    int counter = open_dtlb_counter();
+    if (counter >= 0) {
+        ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+        ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    bench_clock::time_point start = bench_clock::now();
+    void* cursor = ptrs[order[0]];
+    for (size_t i = 0; i < tlb_accesses; i++) {
+        cursor = *(void* volatile*)cursor;
+    }
+    double ns = elapsed_ns(start);
+
+    uint64_t misses = 0;
+    if (counter >= 0) {
+        ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(counter, &misses, sizeof(misses)) != sizeof(misses)) {
+            counter = -1;
+        }
+    }
+
+    report("tlb", allocator.name, huge_pages, "ns_per_access", ns / tlb_accesses);
+    if (counter >= 0) {
+        report("tlb", allocator.name, huge_pages, "dtlb_misses_per_1k",
+               1000.0 * misses / tlb_accesses);
+        close(counter);
+    } else {
+        std::cerr << "tlb: dTLB counter unavailable (perf_event_open failed)\n";
+    }
+
+    for (void* ptr : ptrs) {
+        allocator.release(ptr);
+    }
+}
+
+static void bench_tlb(const BenchAllocator& allocator) {
+    // The parameter column is the HugePageMode. The mode only affects
+    // arenas mapped after it is set, so each my_malloc run gets a fresh
+    // child process.
+
+    if (allocator.alloc != my_malloc) {
+        run_tlb(allocator, HUGE_PAGES_OFF);
+        return;
+    }
+
+    for (HugePageMode mode : {HUGE_PAGES_OFF, HUGE_PAGES_THP}) {
+        std::cout.flush();
+        pid_t child = fork();
+        if (child == 0) {
+            allocator_set_huge_pages(mode);
+            run_tlb(allocator, mode);
+            std::cout.flush();
+            _exit(0);
+        }
+        if (child > 0) {
+            waitpid(child, nullptr, 0);
+        }
+    }
+}
+
+// ============================================================================
+// SCENARIO 7: FRAGMENTATION UNDER EACH FIT POLICY
+// ============================================================================
+
+static double external_fragmentation(MemoryPool* pool) {
+    // 1 - largest free block / free bytes, walking every block of every
+    // arena (0 when all free memory is one block)
+    size_t free_bytes = 0;
+    size_t largest = 0;
+    for (Arena* arena = pool->arenas; arena != nullptr; arena = arena->next) {
+        BlockHeader* block = (BlockHeader*)(arena->start + ALIGNMENT - sizeof(BlockHeader));
+        size_t size;
+        while ((size = block->size_and_flags & ~BLOCK_FLAG_MASK) != 0) {
+            if ((block->size_and_flags & BLOCK_FREE) != 0) {
+                free_bytes += size;
+                largest = std::max(largest, size);
+            }
+            block = (BlockHeader*)((char*)block + size);
+        }
+    }
+    return (free_bytes == 0) ? 0.0 : 1.0 - (double)largest / free_bytes;
+}
+
+static void bench_fit() {
+    // One churn of long- and short-lived variable-size blocks around a
+    // steady live set, replayed (same seed) on a fresh pool per FitPolicy.
+    // The parameter column is the policy. mapped_per_live is the memory the
+    // pool had to map over the most it ever held live (1.0 would be no
+    // waste); fragmentation is the mean external fragmentation sampled
+    // along the way.
+
+    for (FitPolicy policy : {FIT_GOOD, FIT_BEST, FIT_ADDRESS}) {
+        static MemoryPool pools[3];
+        MemoryPool* pool = &pools[policy];
+        allocator_set_fit_policy(policy);
+        init_pool(pool, LARGE_POOL_SIZE, SIZE_MAX);
+
+        std::mt19937 random(11);
+        std::vector<void*> live;
+        std::vector<size_t> live_sizes;
+        size_t live_bytes = 0;
+        size_t peak_live = 0;
+        double fragmentation = 0;
+        size_t samples = 0;
+
+        bench_clock::time_point start = bench_clock::now();
+        for (size_t i = 0; i < fit_ops; i++) {
+            size_t alloc_percent = (live.size() < 3000) ? 60 : 40;
+            if (live.empty() || random() % 100 < alloc_percent) {
+                // Mostly a few KB, now and then a large buffer
+                size_t size = (random() % 16 == 0) ? 16384 + random() % 100000
+                                                    : 1100 + random() % 8000;
+                void* ptr = allocate_from_pool(pool, size);
+                if (ptr == nullptr) {
+                    break;
+                }
+                touch(ptr, 64);
+                live.push_back(ptr);
+                live_sizes.push_back(size);
+                live_bytes += size;
+                peak_live = std::max(peak_live, live_bytes);
+            } else {
+                size_t victim = random() % live.size();
+                free_to_pool(pool, get_header(live[victim]));
+                live_bytes -= live_sizes[victim];
+                live[victim] = live.back();
+                live_sizes[victim] = live_sizes.back();
+                live.pop_back();
+                live_sizes.pop_back();
+            }
+            if (i % 1000 == 999 && i > fit_ops / 4) {
+                bench_clock::time_point paused = bench_clock::now();
+                fragmentation += external_fragmentation(pool);
+                samples++;
+                start += bench_clock::now() - paused;  // Not part of the timing
+            }
+        }
+        double ns = elapsed_ns(start);
+
+        report("fit", "my_malloc", policy, "ns_per_op", ns / fit_ops);
+        report("fit", "my_malloc", policy, "mapped_per_live", (double)pool->pool_size / peak_live);
+        report("fit", "my_malloc", policy, "fragmentation", samples ? fragmentation / samples : 0.0);
+
+        // The pool is private to this scenario; its arenas stay mapped
+        for (void* ptr : live) {
+            free_to_pool(pool, get_header(ptr));
+        }
+    }
+    allocator_set_fit_policy(FIT_GOOD);
+}
+
+// ============================================================================
+// MAIN
+// ============================================================================
+
+int main(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--quick") == 0) {
+            throughput_ops /= 20;
+            latency_samples /= 20;
+            realloc_rounds /= 20;
+            transfer_ops /= 20;
+            tlb_accesses /= 20;
+            fit_ops /= 20;
+        } else {
+            std::cerr << "usage: " << argv[0] << " [--quick]\n";
+            return 1;
+        }
+    }
+
+    allocator_init();
+
+    std::cout << "scenario,allocator,parameter,metric,value\n";
+    for (const BenchAllocator& allocator : allocators) {
+        bench_throughput(allocator);
+        bench_latency(allocator);
+        bench_realloc(allocator);
+        bench_transfer(allocator);
+        bench_batch(allocator);
+        bench_tlb(allocator);
+    }
+    bench_fit();
+
+    return 0;
+}
@@ -0,0 +1,221 @@
+#include "allocator.h"
+#include <cerrno>    // for ENOMEM, EINVAL
+#include <new>       // for std::bad_alloc, std::align_val_t, std::new_handler
+#include <unistd.h>  // for sysconf
+
+// ============================================================================
+// MALLOC INTERPOSITION
+// ============================================================================
+//
+// Exports the C allocation functions and the C++ operator new/delete families
+// on top of my_malloc/my_free, so unmodified programs can run on this
+// allocator:
+//
+//     make preload
+//     LD_PRELOAD=build/libmyalloc.so ls
+//
+// The first malloc() may come from the dynamic loader or libc before main();
+// my_malloc() initializes the allocator on demand and allocator_init() never
+// allocates, so this bootstraps without recursion.
+
+#define SHIM_EXPORT extern "C" __attribute__((visibility("default")))
+
+static size_t shim_page_size() {
+    static size_t page_size = 0;
+    if (page_size == 0) {
+        page_size = (size_t)sysconf(_SC_PAGESIZE);
+    }
+    return page_size;
+}
+
+static void* shim_malloc(size_t size) {
+    // C callers expect a unique, freeable pointer for malloc(0)
+    return my_malloc(size == 0 ? 1 : size);
+}
+
+// ============================================================================
+// C ALLOCATION FUNCTIONS
+// ============================================================================
+
+SHIM_EXPORT void* malloc(size_t size) noexcept {
+    void* ptr = shim_malloc(size);
+    if (ptr == nullptr) {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+SHIM_EXPORT void free(void* ptr) noexcept {
+    my_free(ptr);
+}
+
+SHIM_EXPORT void* calloc(size_t num, size_t size) noexcept {
+    if (num == 0 || size == 0) {
+        return shim_malloc(0);
+    }
+    void* ptr = my_calloc(num, size);
+    if (ptr == nullptr) {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+SHIM_EXPORT void* realloc(void* ptr, size_t size) noexcept {
+    void* new_ptr = my_realloc(ptr, size);
+    if (new_ptr == nullptr && size != 0) {
+        errno = ENOMEM;
+    }
+    return new_ptr;
+}
+
+SHIM_EXPORT void* reallocarray(void* ptr, size_t num, size_t size) noexcept {
+    size_t total_size = num * size;
+    if (num != 0 && total_size / num != size) {
+        errno = ENOMEM;
+        return nullptr;  // Overflow
+    }
+    return realloc(ptr, total_size);
+}
+
+SHIM_EXPORT int posix_memalign(void** memptr, size_t alignment, size_t size) noexcept {
+    return my_posix_memalign(memptr, alignment, size);
+}
+
+SHIM_EXPORT void* aligned_alloc(size_t alignment, size_t size) noexcept {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        errno = EINVAL;
+        return nullptr;
+    }
+    void* ptr = my_aligned_alloc(alignment, size == 0 ? 1 : size);
+    if (ptr == nullptr) {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+SHIM_EXPORT void* memalign(size_t alignment, size_t size) noexcept {
+    return aligned_alloc(alignment, size);
+}
+
+SHIM_EXPORT void* valloc(size_t size) noexcept {
+    return aligned_alloc(shim_page_size(), size);
+}
+
+SHIM_EXPORT void* pvalloc(size_t size) noexcept {
+    size_t page_size = shim_page_size();
+    return aligned_alloc(page_size, (size + page_size - 1) & ~(page_size - 1));
+}
+
+SHIM_EXPORT size_t malloc_usable_size(void* ptr) noexcept {
+    return my_malloc_usable_size(ptr);
+}
+
+// ============================================================================
+// C++ OPERATOR NEW / DELETE
+// ============================================================================
+
+static void* new_impl(size_t size, size_t alignment) {
+    // operator new never returns nullptr: retry through the new_handler
+    // until it frees something up, and throw once there is none. Plain new
+    // takes (and is traced as) malloc; only std::align_val_t needs more.
+    for (;;) {
+        void* ptr = (alignment <= ALIGNMENT) ? my_malloc(size == 0 ? 1 : size)
+                                             : my_aligned_alloc(alignment, size == 0 ? 1 : size);
+        if (ptr != nullptr) {
+            return ptr;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if (handler == nullptr) {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+static void* new_nothrow_impl(size_t size, size_t alignment) noexcept {
+    try {
+        return new_impl(size, alignment);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void* operator new(size_t size) {
+    return new_impl(size, ALIGNMENT);
+}
+
+void* operator new[](size_t size) {
+    return new_impl(size, ALIGNMENT);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return new_nothrow_impl(size, ALIGNMENT);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return new_nothrow_impl(size, ALIGNMENT);
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+    return new_impl(size, (size_t)alignment);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+    return new_impl(size, (size_t)alignment);
+}
+
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return new_nothrow_impl(size, (size_t)alignment);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return new_nothrow_impl(size, (size_t)alignment);
+}
+
+void operator delete(void* ptr) noexcept {
+    my_free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    my_free(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+    my_free(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+    my_free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    my_free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+    my_free(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept {
+    my_free(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t) noexcept {
+    my_free(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept {
+    my_free(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept {
+    my_free(ptr);
+}
+
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept {
+    my_free(ptr);
+}
+
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept {
+    my_free(ptr);
+}
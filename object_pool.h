@@ -0,0 +1,176 @@
+#ifndef OBJECT_POOL_H
+#define OBJECT_POOL_H
+
+#include "allocator.h"
+#include <cstddef>  // for size_t
+#include <memory>   // for std::shared_ptr, std::unique_ptr, std::allocate_shared
+#include <new>      // for std::bad_alloc
+#include <utility>  // for std::forward
+
+// ============================================================================
+// TYPED OBJECT POOLS
+// ============================================================================
+//
+// Allocation for objects whose size is known at compile time. The size
+// class is chosen with size_class_for when the template is instantiated, so
+// allocating skips select_pool and the class lookup and goes straight to
+// the class's cache bin:
+//
+//     Order* order = my_new<Order>(id, price);
+//     my_delete(order);
+//
+//     std::map<int, Order, std::less<int>,
+//              Allocator<std::pair<const int, Order>>> book;
+//     std::shared_ptr<Order> shared = my_make_shared<Order>(id, price);
+//
+// Everything allocated here is ordinary my_malloc memory: my_free releases
+// it, and so does any other thread.
+
+/**
+ * Allocation for objects of type T
+ * Types larger than LARGE_BLOCK_MAX or aligned beyond ALIGNMENT fall back
+ * to my_aligned_alloc.
+ */
+template <typename T>
+class ObjectPool {
+public:
+    // Whether T is served from a slab class, and which one
+    static constexpr bool uses_size_class =
+        sizeof(T) <= LARGE_BLOCK_MAX && alignof(T) <= ALIGNMENT;
+    static constexpr int class_index = uses_size_class ? size_class_for(sizeof(T)) : -1;
+
+    /**
+     * Allocate uninitialized storage for one T
+     *
+     * @return Storage for a T, or NULL if out of memory
+     */
+    static void* allocate() {
+        if constexpr (uses_size_class) {
+            return my_malloc_class(class_index);
+        } else {
+            return my_aligned_alloc(alignof(T) > ALIGNMENT ? alignof(T) : ALIGNMENT, sizeof(T));
+        }
+    }
+
+    static void deallocate(void* ptr) {
+        my_free(ptr);
+    }
+
+    /**
+     * Allocate and construct a T (throws std::bad_alloc if out of memory)
+     */
+    template <typename... Args>
+    static T* create(Args&&... args) {
+        void* memory = allocate();
+        if (memory == nullptr) {
+            throw std::bad_alloc();
+        }
+        try {
+            return new (memory) T(std::forward<Args>(args)...);
+        } catch (...) {
+            deallocate(memory);
+            throw;
+        }
+    }
+
+    /**
+     * Destroy and free a T made by create (NULL is ignored)
+     */
+    static void destroy(T* object) {
+        if (object != nullptr) {
+            object->~T();
+            deallocate(object);
+        }
+    }
+};
+
+template <typename T, typename... Args>
+T* my_new(Args&&... args) {
+    return ObjectPool<T>::create(std::forward<Args>(args)...);
+}
+
+template <typename T>
+void my_delete(T* object) {
+    ObjectPool<T>::destroy(object);
+}
+
+// ============================================================================
+// STL ALLOCATOR
+// ============================================================================
+
+/**
+ * Standard allocator on top of ObjectPool
+ * Single-object requests (every node of std::map, std::set, std::list, ...)
+ * take the compile-time size class; arrays go through my_malloc.
+ */
+template <typename T>
+struct Allocator {
+    typedef T value_type;
+
+    Allocator() noexcept {}
+
+    template <typename U>
+    Allocator(const Allocator<U>&) noexcept {}
+
+    T* allocate(size_t count) {
+        void* memory;
+        if (count == 1) {
+            memory = ObjectPool<T>::allocate();
+        } else if (count > (size_t)-1 / sizeof(T)) {
+            throw std::bad_alloc();  // Overflow
+        } else if (alignof(T) > ALIGNMENT) {
+            memory = my_aligned_alloc(alignof(T), count * sizeof(T));
+        } else {
+            memory = my_malloc(count * sizeof(T));
+        }
+        if (memory == nullptr) {
+            throw std::bad_alloc();
+        }
+        return (T*)memory;
+    }
+
+    void deallocate(T* ptr, size_t /* count */) noexcept {
+        my_free(ptr);
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const Allocator<T>&, const Allocator<U>&) noexcept {
+    return true;  // Stateless: any instance frees what another allocated
+}
+
+template <typename T, typename U>
+bool operator!=(const Allocator<T>&, const Allocator<U>&) noexcept {
+    return false;
+}
+
+// ============================================================================
+// SMART POINTER HELPERS
+// ============================================================================
+
+// Deleter for std::unique_ptr holding an object made by my_new
+template <typename T>
+struct ObjectDeleter {
+    void operator()(T* object) const {
+        my_delete(object);
+    }
+};
+
+template <typename T>
+using pool_ptr = std::unique_ptr<T, ObjectDeleter<T>>;
+
+template <typename T, typename... Args>
+pool_ptr<T> my_make_unique(Args&&... args) {
+    return pool_ptr<T>(my_new<T>(std::forward<Args>(args)...));
+}
+
+/**
+ * std::allocate_shared with Allocator: the object and its control block
+ * share one block of a compile-time size class
+ */
+template <typename T, typename... Args>
+std::shared_ptr<T> my_make_shared(Args&&... args) {
+    return std::allocate_shared<T>(Allocator<T>(), std::forward<Args>(args)...);
+}
+
+#endif // OBJECT_POOL_H
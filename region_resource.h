@@ -0,0 +1,74 @@
+#ifndef REGION_RESOURCE_H
+#define REGION_RESOURCE_H
+
+#include "allocator.h"
+#include <memory_resource>  // for std::pmr::memory_resource
+#include <new>              // for std::bad_alloc
+
+// ============================================================================
+// PMR ADAPTER FOR REGIONS
+// ============================================================================
+//
+// Lets standard containers allocate from a region:
+//
+//     RegionResource resource;
+//     std::pmr::vector<int> values(&resource);
+//     std::pmr::unordered_map<int, std::pmr::string> index(&resource);
+//
+// Deallocation is a no-op; the memory comes back all at once on release()
+// or when the resource is destroyed, so containers using it must not
+// outlive it.
+
+class RegionResource : public std::pmr::memory_resource {
+public:
+    /**
+     * @param chunk_size Bytes the region takes from the pool at a time
+     *                   (0 for REGION_CHUNK_SIZE)
+     */
+    explicit RegionResource(size_t chunk_size = 0)
+        : region_(region_create(chunk_size)) {
+        if (region_ == nullptr) {
+            throw std::bad_alloc();
+        }
+    }
+
+    ~RegionResource() override {
+        region_destroy(region_);
+    }
+
+    RegionResource(const RegionResource&) = delete;
+    RegionResource& operator=(const RegionResource&) = delete;
+
+    /**
+     * Free everything allocated through this resource at once
+     */
+    void release() {
+        region_reset(region_);
+    }
+
+    Region* region() const {
+        return region_;
+    }
+
+protected:
+    void* do_allocate(size_t bytes, size_t alignment) override {
+        void* ptr = region_alloc(region_, bytes == 0 ? 1 : bytes, alignment);
+        if (ptr == nullptr) {
+            throw std::bad_alloc();
+        }
+        return ptr;
+    }
+
+    void do_deallocate(void* /* ptr */, size_t /* bytes */, size_t /* alignment */) override {
+        // Memory is reclaimed by release() or the destructor
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+
+private:
+    Region* region_;
+};
+
+#endif // REGION_RESOURCE_H
@@ -0,0 +1,234 @@
+#include "allocator.h"
+#include <iostream>
+#include <fstream>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <unordered_map>
+#include <chrono>
+#include <algorithm>
+#include <unistd.h>
+
+// ============================================================================
+// TRACE REPLAY
+// ============================================================================
+//
+// Replays a trace recorded with MYALLOC_TRACE=<file> (or
+// allocator_trace_start) against my_malloc or glibc malloc:
+//
+//     ./build/replay trace.bin [--glibc]
+//
+// Calls are replayed on one thread in the order they were recorded, so two
+// runs over the same trace see identical inputs. Results are printed as
+// "metric,value" lines:
+//
+//     time_ns              Wall time spent inside the allocator calls
+//     peak_rss_kb          Highest resident set size sampled during the run
+//     peak_live_bytes      Most bytes the program had requested at once
+//     fragmentation        1 - peak_live_bytes / peak heap growth
+//
+// Heap growth is the RSS increase over a baseline taken before the first
+// call, so it counts everything the allocator keeps resident.
+
+struct ReplayAllocator {
+    const char* name;
+    void* (*alloc)(size_t);
+    void (*release)(void*);
+    void* (*zeroed)(size_t, size_t);
+    void* (*resize)(void*, size_t);
+    void* (*aligned)(size_t, size_t);
+};
+
+static const ReplayAllocator replay_allocators[] = {
+    {"my_malloc", my_malloc, my_free, my_calloc, my_realloc, my_aligned_alloc},
+    {"glibc", malloc, free, calloc, realloc, aligned_alloc},
+};
+
+// Sample RSS once every this many calls (reading /proc is not free), and
+// whenever live bytes pass the last sampled peak by this much
+#define RSS_SAMPLE_INTERVAL 1024
+#define RSS_SAMPLE_GROWTH   (64 * 1024)
+
+// Live allocation in the replay: its pointer and requested size
+struct LiveBlock {
+    void* ptr;
+    size_t size;
+};
+
+static size_t current_rss_kb() {
+    // Second field of /proc/self/statm is the resident page count
+    std::ifstream statm("/proc/self/statm");
+    size_t total_pages = 0;
+    size_t resident_pages = 0;
+    statm >> total_pages >> resident_pages;
+    return resident_pages * (size_t)sysconf(_SC_PAGESIZE) / 1024;
+}
+
+static bool load_trace(const char* path, std::vector<TraceRecord>& records) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        std::cerr << "replay: cannot open " << path << "\n";
+        return false;
+    }
+
+    TraceFileHeader header;
+    if (!file.read((char*)&header, sizeof(header)) ||
+        std::memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != TRACE_VERSION || header.record_size != sizeof(TraceRecord)) {
+        std::cerr << "replay: " << path << " is not a version " << TRACE_VERSION
+                  << " allocator trace\n";
+        return false;
+    }
+
+    TraceRecord record;
+    while (file.read((char*)&record, sizeof(record))) {
+        records.push_back(record);
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    const char* path = nullptr;
+    const ReplayAllocator* allocator = &replay_allocators[0];
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--glibc") == 0) {
+            allocator = &replay_allocators[1];
+        } else if (path == nullptr) {
+            path = argv[i];
+        } else {
+            path = nullptr;
+            break;
+        }
+    }
+    if (path == nullptr) {
+        std::cerr << "usage: " << argv[0] << " <trace file> [--glibc]\n";
+        return 1;
+    }
+
+    // Step 1: Load the whole trace up front so file I/O is not timed
+    std::vector<TraceRecord> records;
+    if (!load_trace(path, records)) {
+        return 1;
+    }
+
+    // Step 2: Replay, mapping each recorded address to our own block
+    std::unordered_map<uint64_t, LiveBlock> live;
+    live.reserve(records.size() / 2 + 1);
+
+    size_t live_bytes = 0;
+    size_t peak_live_bytes = 0;
+    size_t sampled_live_bytes = 0;
+    size_t baseline_rss_kb = current_rss_kb();
+    size_t peak_rss_kb = baseline_rss_kb;
+    size_t skipped = 0;
+    double time_ns = 0;
+
+    for (size_t i = 0; i < records.size(); i++) {
+        const TraceRecord& record = records[i];
+        void* result = nullptr;
+        bool allocates = true;
+
+        // A free or realloc of an address we never saw (allocated before
+        // tracing started) cannot be replayed
+        LiveBlock old_block = {nullptr, 0};
+        uint64_t old_key = (record.op == TRACE_FREE) ? record.ptr : record.arg;
+        if (record.op == TRACE_FREE || (record.op == TRACE_REALLOC && old_key != 0)) {
+            auto found = live.find(old_key);
+            if (found == live.end()) {
+                skipped++;
+                continue;
+            }
+            old_block = found->second;
+            live.erase(found);
+            live_bytes -= old_block.size;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        switch (record.op) {
+            case TRACE_MALLOC:
+                result = allocator->alloc(record.size);
+                break;
+            case TRACE_CALLOC:
+                result = allocator->zeroed(record.arg, record.arg ? record.size / record.arg : 0);
+                break;
+            case TRACE_ALIGNED_ALLOC:
+                result = allocator->aligned(record.arg, record.size);
+                break;
+            case TRACE_REALLOC:
+                result = allocator->resize(old_block.ptr, record.size);
+                break;
+            case TRACE_FREE:
+                allocator->release(old_block.ptr);
+                allocates = false;
+                break;
+            default:
+                allocates = false;
+                skipped++;
+                break;
+        }
+        time_ns += std::chrono::duration<double, std::nano>(
+            std::chrono::steady_clock::now() - start).count();
+
+        // Touch every requested byte (untimed) so RSS reflects what a real
+        // program would have made resident
+        if (allocates && result != nullptr) {
+            std::memset(result, 0xA5, record.size);
+        }
+
+        // Track the result under the address the traced program saw
+        if (allocates && result != nullptr && record.ptr != 0) {
+            LiveBlock& block = live[record.ptr];
+            if (block.ptr != nullptr) {
+                allocator->release(block.ptr);  // Out-of-order record: drop the stale block
+                live_bytes -= block.size;
+            }
+            block.ptr = result;
+            block.size = record.size;
+            live_bytes += record.size;
+        } else if (allocates && result != nullptr) {
+            allocator->release(result);  // Failed in the trace; keep the heap the same
+        } else if (record.op == TRACE_REALLOC && result == nullptr && record.size != 0) {
+            live[old_key] = old_block;  // Failed realloc leaves the old block
+            live_bytes += old_block.size;
+        }
+
+        // Step 3: Sample memory use
+        if (live_bytes > peak_live_bytes) {
+            peak_live_bytes = live_bytes;
+        }
+        if (i % RSS_SAMPLE_INTERVAL == 0 || live_bytes >= sampled_live_bytes + RSS_SAMPLE_GROWTH) {
+            sampled_live_bytes = std::max(sampled_live_bytes, live_bytes);
+            size_t rss_kb = current_rss_kb();
+            if (rss_kb > peak_rss_kb) {
+                peak_rss_kb = rss_kb;
+            }
+        }
+    }
+
+    size_t final_rss_kb = current_rss_kb();
+    if (final_rss_kb > peak_rss_kb) {
+        peak_rss_kb = final_rss_kb;
+    }
+
+    double heap_growth = (peak_rss_kb - baseline_rss_kb) * 1024.0;
+    double fragmentation = 0;
+    if (heap_growth > peak_live_bytes) {
+        fragmentation = 1.0 - peak_live_bytes / heap_growth;
+    }
+
+    // Step 4: Report
+    std::cout << "allocator," << allocator->name << "\n";
+    std::cout << "records," << records.size() << "\n";
+    std::cout << "skipped," << skipped << "\n";
+    std::cout << "time_ns," << (uint64_t)time_ns << "\n";
+    std::cout << "ns_per_op," << (records.empty() ? 0 : time_ns / records.size()) << "\n";
+    std::cout << "peak_rss_kb," << peak_rss_kb << "\n";
+    std::cout << "peak_live_bytes," << peak_live_bytes << "\n";
+    std::cout << "fragmentation," << fragmentation << "\n";
+
+    for (auto& entry : live) {
+        allocator->release(entry.second.ptr);
+    }
+    return 0;
+}
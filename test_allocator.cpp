@@ -1,8 +1,24 @@
 #include "allocator.h"
+#include "region_resource.h"
+#include "object_pool.h"
 #include <iostream>
 #include <cassert>
 #include <cstring>
+#include <cstdlib>
 #include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cerrno>
+#include <fstream>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <sched.h>
+#include <map>
+#include <list>
+#include <string>
+#include <cstdio>
 
 // ============================================================================
 // TEST HELPERS
@@ -158,66 +174,1471 @@ void test_realloc() {
     my_free(ptr3);
 }
 
+void test_realloc_in_place() {
+    std::cout << "\n=== Test: realloc in place ===\n";
+    
+    // Grow into the free space that follows the block
+    char* ptr = (char*)my_malloc(2000);
+    if (ptr == nullptr) {
+        test_failed("test_realloc_in_place", "Allocation failed");
+        return;
+    }
+    std::memset(ptr, 'x', 2000);
+    
+    char* grown = (char*)my_realloc(ptr, 6000);
+    if (grown == ptr && grown[1999] == 'x') {
+        test_passed("Grow absorbs the next free block");
+    } else {
+        test_failed("test_realloc_in_place", "Growth moved the block");
+    }
+    
+    // Shrink returns the tail; the next allocation lands in it
+    char* shrunk = (char*)my_realloc(grown, 2000);
+    void* neighbour = my_malloc(3000);
+    if (shrunk == ptr && neighbour == ptr + align_size(2000 + sizeof(BlockHeader))) {
+        test_passed("Shrink returns the tail to the pool");
+    } else {
+        test_failed("test_realloc_in_place", "Tail was not reused");
+    }
+    
+    // A grow blocked by an allocated neighbour still works by moving
+    char* moved = (char*)my_realloc(shrunk, 8000);
+    if (moved != nullptr && moved != shrunk && moved[0] == 'x') {
+        test_passed("Blocked grow falls back to copy");
+    } else {
+        test_failed("test_realloc_in_place", "Fallback copy failed");
+    }
+    
+    my_free(moved);
+    my_free(neighbour);
+}
+
+// ============================================================================
+// ALIGNMENT TESTS
+// ============================================================================
+
+void test_alignment() {
+    std::cout << "\n=== Test: Alignment ===\n";
+    
+    // Allocate various sizes and check alignment
+    for (size_t size = 1; size <= 100; size++) {
+        void* ptr = my_malloc(size);
+        if (ptr == nullptr) {
+            test_failed("test_alignment", "Allocation failed");
+            return;
+        }
+        
+        uintptr_t addr = (uintptr_t)ptr;
+        if (addr % ALIGNMENT != 0) {
+            test_failed("test_alignment", "Pointer not aligned");
+            my_free(ptr);
+            return;
+        }
+        
+        my_free(ptr);
+    }
+    
+    test_passed("All pointers are aligned");
+}
+
+static size_t count_mappings() {
+    // Lines of /proc/self/maps, one per mapping
+    std::ifstream maps("/proc/self/maps");
+    std::string line;
+    size_t count = 0;
+    while (std::getline(maps, line)) {
+        count++;
+    }
+    return count;
+}
+
+void test_aligned_alloc() {
+    std::cout << "\n=== Test: Aligned allocation ===\n";
+    
+    // Every alignment/size pair must come back aligned, usable and freeable
+    const size_t alignments[] = {16, 32, 64, 256, 4096, 65536};
+    const size_t sizes[] = {1, 24, 100, 1000, 5000, MMAP_THRESHOLD * 2};
+    bool all_aligned = true;
+    
+    for (size_t alignment : alignments) {
+        for (size_t size : sizes) {
+            char* ptr = (char*)my_aligned_alloc(alignment, size);
+            if (ptr == nullptr || (uintptr_t)ptr % alignment != 0 ||
+                my_malloc_usable_size(ptr) < size) {
+                all_aligned = false;
+            }
+            if (ptr != nullptr) {
+                memset(ptr, 0x5A, size);
+                my_free(ptr);
+            }
+        }
+    }
+    
+    if (all_aligned) {
+        test_passed("my_aligned_alloc honours 16..65536 byte alignment");
+    } else {
+        test_failed("test_aligned_alloc", "Pointer misaligned or too small");
+    }
+    
+    // Small aligned requests stay in slabs instead of taking a whole page
+    void* cache_line = my_aligned_alloc(64, 40);
+    PageMapEntry* entry = page_map_lookup(cache_line);
+    if (entry != nullptr && entry->kind == PAGE_SLAB && my_malloc_usable_size(cache_line) == 64) {
+        test_passed("Small aligned request served from a slab class");
+    } else {
+        test_failed("test_aligned_alloc", "Small aligned request not in a slab");
+    }
+    my_free(cache_line);
+    
+    // Mid-size aligned requests share the variable-size pool instead of
+    // mapping a region each
+    const int mid_count = 10000;
+    const int page_count = 1000;
+    std::vector<void*> mid(mid_count + page_count);
+    AllocatorStats before;
+    allocator_stats_snapshot(&before);
+    size_t maps_before = count_mappings();
+    bool mid_aligned = true;
+    for (int i = 0; i < mid_count + page_count; i++) {
+        size_t alignment = (i < mid_count) ? 64 : 4096;
+        size_t size = (i < mid_count) ? 2000 : 5000;
+        mid[i] = my_aligned_alloc(alignment, size);
+        if (mid[i] == nullptr || (uintptr_t)mid[i] % alignment != 0) {
+            mid_aligned = false;
+        } else {
+            memset(mid[i], 0x5A, size);
+        }
+    }
+    size_t maps_during = count_mappings();
+    AllocatorStats during;
+    allocator_stats_snapshot(&during);
+    size_t requested = (size_t)mid_count * 2000 + (size_t)page_count * 5000;
+    size_t mapped = during.total.mapped_bytes - before.total.mapped_bytes;
+    
+    if (mid_aligned &&
+        during.pools[STATS_POOL_HUGE].live_objects == before.pools[STATS_POOL_HUGE].live_objects &&
+        mapped < requested * 2 && maps_during < maps_before + 64) {
+        test_passed("Mid-size aligned requests packed into the variable-size pool");
+    } else {
+        test_failed("test_aligned_alloc", "Mid-size aligned requests misaligned or mapped apart");
+    }
+    for (void* block : mid) {
+        my_free(block);
+    }
+    
+    // posix_memalign validates the alignment and reports errors by value
+    void* ptr = nullptr;
+    if (my_posix_memalign(&ptr, 24, 100) == EINVAL &&
+        my_posix_memalign(&ptr, 4, 100) == EINVAL &&
+        my_posix_memalign(&ptr, 128, 100) == 0 && (uintptr_t)ptr % 128 == 0) {
+        test_passed("my_posix_memalign validates alignment");
+    } else {
+        test_failed("test_aligned_alloc", "my_posix_memalign misbehaved");
+    }
+    my_free(ptr);
+    
+    if (my_aligned_alloc(48, 100) == nullptr) {
+        test_passed("Non-power-of-two alignment rejected");
+    } else {
+        test_failed("test_aligned_alloc", "Accepted alignment 48");
+    }
+}
+
+// ============================================================================
+// FRAGMENTATION TESTS
+// ============================================================================
+
+void test_fragmentation() {
+    std::cout << "\n=== Test: Fragmentation ===\n";
+    
+    // Allocate and free in a pattern that causes fragmentation
+    void* ptrs[5];
+    
+    // Allocate 5 blocks
+    for (int i = 0; i < 5; i++) {
+        ptrs[i] = my_malloc(100);
+    }
+    
+    // Free middle blocks
+    my_free(ptrs[1]);
+    my_free(ptrs[3]);
+    
+    // Try to allocate a larger block (should coalesce)
+    void* large = my_malloc(200);
+    if (large != nullptr) {
+        test_passed("Coalescing works");
+        my_free(large);
+    } else {
+        test_failed("test_fragmentation", "Coalescing failed");
+    }
+    
+    // Free remaining blocks
+    my_free(ptrs[0]);
+    my_free(ptrs[2]);
+    my_free(ptrs[4]);
+}
+
+void test_coalescing() {
+    std::cout << "\n=== Test: Boundary-tag coalescing ===\n";
+    
+    // Fragment the variable-size pool with alternating frees
+    const int count = 8;
+    void* ptrs[count];
+    for (int i = 0; i < count; i++) {
+        ptrs[i] = my_malloc(4000);
+        if (ptrs[i] == nullptr) {
+            test_failed("test_coalescing", "Allocation failed");
+            return;
+        }
+    }
+    for (int i = 0; i < count; i += 2) {
+        my_free(ptrs[i]);
+    }
+    for (int i = 1; i < count; i += 2) {
+        my_free(ptrs[i]);
+    }
+    
+    // Every neighbour merged back, so the whole range is one block again
+    void* merged = my_malloc(count * 4000);
+    if (merged == ptrs[0]) {
+        test_passed("Neighbours on both sides merge into one block");
+    } else {
+        test_failed("test_coalescing", "Freed neighbours were not merged");
+    }
+    my_free(merged);
+    
+    // The largest pool-served block is available after everything is freed
+    void* whole = my_malloc(MMAP_THRESHOLD - 1024);
+    if (whole != nullptr) {
+        test_passed("Pool fully coalesced after fragmentation");
+        my_free(whole);
+    } else {
+        test_failed("test_coalescing", "Pool still fragmented");
+    }
+}
+
+void test_segregated_fit() {
+    std::cout << "\n=== Test: Segregated free lists ===\n";
+    
+    // Free blocks of three sizes, kept apart by live separators so they
+    // cannot merge. The most recently freed (largest) block is not the one
+    // a request just under the middle size should get.
+    void* blocks[3] = {my_malloc(3000), my_malloc(9000), my_malloc(20000)};
+    void* separators[3];
+    for (int i = 0; i < 3; i++) {
+        separators[i] = my_malloc(2000);
+    }
+    for (int i = 0; i < 3; i++) {
+        my_free(blocks[i]);
+    }
+    
+    void* fit = my_malloc(8000);
+    if (fit != blocks[2] && my_malloc_usable_size(fit) < 20000) {
+        test_passed("Request takes a block of its own size range");
+    } else {
+        test_failed("test_segregated_fit", "Request took the largest free block");
+    }
+    my_free(fit);
+    
+    // Every bitmap bit matches a non-empty list, and every block sits on
+    // the list for its size
+    MemoryPool* pool = select_pool(8000);
+    bool consistent = true;
+    for (int fl = 0; fl < TLSF_FL_COUNT; fl++) {
+        bool row_used = false;
+        for (int sl = 0; sl < TLSF_SL_COUNT; sl++) {
+            BlockHeader* head = pool->free_lists[fl][sl];
+            bool bit = (pool->sl_bitmap[fl] & (1u << sl)) != 0;
+            consistent &= bit == (head != nullptr);
+            row_used |= head != nullptr;
+            for (BlockHeader* block = head; block != nullptr;
+                 block = ((FreeBlockLinks*)(block + 1))->next_free) {
+                size_t size = block->size_and_flags & ~BLOCK_FLAG_MASK;
+                int log2 = 63 - __builtin_clzll(size);
+                bool in_range = (fl == 0) ?
+                    size / (TLSF_SMALL_SIZE / TLSF_SL_COUNT) == (size_t)sl :
+                    log2 == fl + TLSF_FL_SHIFT - 1 &&
+                    ((size >> (log2 - TLSF_SL_LOG2)) & (TLSF_SL_COUNT - 1)) == (size_t)sl;
+                consistent &= (block->size_and_flags & BLOCK_FREE) != 0 && in_range;
+            }
+        }
+        consistent &= row_used == ((pool->fl_bitmap & (1u << fl)) != 0);
+    }
+    if (consistent) {
+        test_passed("List bitmaps match the free lists");
+    } else {
+        test_failed("test_segregated_fit", "Bitmap and lists disagree");
+    }
+    
+    for (int i = 0; i < 3; i++) {
+        my_free(separators[i]);
+    }
+}
+
+static bool free_tree_valid(MemoryPool* pool, BlockHeader* root, int* height, size_t* max_size,
+                            BlockHeader** prev) {
+    // In-order walk checking order, AVL balance, heights and subtree maxima
+    if (root == nullptr) {
+        *height = 0;
+        *max_size = 0;
+        return true;
+    }
+    FreeTreeNode* node = (FreeTreeNode*)(root + 1);
+    int left_height;
+    int right_height;
+    size_t left_max;
+    size_t right_max;
+    if (!free_tree_valid(pool, node->left, &left_height, &left_max, prev)) {
+        return false;
+    }
+    
+    size_t size = root->size_and_flags & ~BLOCK_FLAG_MASK;
+    if (*prev != nullptr) {
+        size_t prev_size = (*prev)->size_and_flags & ~BLOCK_FLAG_MASK;
+        bool ordered = (pool->fit_policy == FIT_BEST && prev_size != size) ?
+                       prev_size < size : *prev < root;
+        if (!ordered) {
+            return false;
+        }
+    }
+    *prev = root;
+    
+    if (!free_tree_valid(pool, node->right, &right_height, &right_max, prev)) {
+        return false;
+    }
+    *height = 1 + std::max(left_height, right_height);
+    *max_size = std::max(size, std::max(left_max, right_max));
+    return std::abs(left_height - right_height) <= 1 && node->height == *height &&
+           node->max_size == *max_size;
+}
+
+void test_fit_policies() {
+    std::cout << "\n=== Test: Fit policies ===\n";
+    
+    // Pools of their own, set up with each tree policy (they stay mapped)
+    static MemoryPool best_pool;
+    static MemoryPool address_pool;
+    allocator_set_fit_policy(FIT_BEST);
+    init_pool(&best_pool, LARGE_POOL_SIZE, SIZE_MAX);
+    allocator_set_fit_policy(FIT_ADDRESS);
+    init_pool(&address_pool, LARGE_POOL_SIZE, SIZE_MAX);
+    allocator_set_fit_policy(FIT_GOOD);
+    
+    // Free blocks of 9000, 3000 and 20000 bytes in address order, kept
+    // apart by live separators
+    MemoryPool* pools[2] = {&best_pool, &address_pool};
+    void* blocks[2][3];
+    const size_t sizes[3] = {9000, 3000, 20000};
+    for (int p = 0; p < 2; p++) {
+        for (int i = 0; i < 3; i++) {
+            blocks[p][i] = allocate_from_pool(pools[p], sizes[i]);
+            allocate_from_pool(pools[p], 2000);
+        }
+        for (int i = 0; i < 3; i++) {
+            free_to_pool(pools[p], get_header(blocks[p][i]));
+        }
+    }
+    
+    // Best fit takes the smallest block that fits; address order the
+    // lowest-addressed one
+    if (allocate_from_pool(&best_pool, 2500) == blocks[0][1] &&
+        allocate_from_pool(&address_pool, 2500) == blocks[1][0]) {
+        test_passed("Best and address-ordered fit pick the expected blocks");
+    } else {
+        test_failed("test_fit_policies", "Wrong block for the policy");
+    }
+    
+    // Random churn keeps both trees ordered and balanced
+    bool valid = true;
+    unsigned seed = 12345;
+    for (int p = 0; p < 2; p++) {
+        std::vector<void*> live;
+        for (int i = 0; i < 4000; i++) {
+            seed = seed * 1103515245 + 12345;
+            if (live.empty() || (seed >> 16) % 3 != 0) {
+                live.push_back(allocate_from_pool(pools[p], 1100 + (seed >> 8) % 30000));
+            } else {
+                size_t victim = (seed >> 4) % live.size();
+                free_to_pool(pools[p], get_header(live[victim]));
+                live[victim] = live.back();
+                live.pop_back();
+            }
+            if (i % 100 == 0) {
+                int height;
+                size_t max_size;
+                BlockHeader* prev = nullptr;
+                valid &= free_tree_valid(pools[p], pools[p]->free_tree, &height, &max_size, &prev);
+            }
+        }
+        for (void* ptr : live) {
+            free_to_pool(pools[p], get_header(ptr));
+        }
+    }
+    if (valid) {
+        test_passed("Free trees stay ordered and balanced");
+    } else {
+        test_failed("test_fit_policies", "Free tree invariant broken");
+    }
+}
+
+static size_t measure_footprint(size_t size) {
+    // Footprint of one object: the smallest distance between neighbouring
+    // allocations of the same size (some of them come from one free run)
+    const int count = 16;
+    std::vector<uintptr_t> addrs;
+    for (int i = 0; i < count; i++) {
+        addrs.push_back((uintptr_t)my_malloc(size));
+    }
+    std::sort(addrs.begin(), addrs.end());
+    
+    size_t footprint = SIZE_MAX;
+    for (int i = 1; i < count; i++) {
+        footprint = std::min(footprint, (size_t)(addrs[i] - addrs[i - 1]));
+    }
+    
+    for (uintptr_t addr : addrs) {
+        my_free((void*)addr);
+    }
+    return footprint;
+}
+
+void test_header_overhead() {
+    std::cout << "\n=== Test: Per-object overhead ===\n";
+    
+    if (sizeof(BlockHeader) == 8) {
+        test_passed("BlockHeader is one word");
+    } else {
+        test_failed("test_header_overhead", "BlockHeader is larger than 8 bytes");
+    }
+    
+    // Variable-size blocks: compare with the old 40-byte header (size,
+    // prev_size, flag, two links) on 8-byte aligned payloads
+    const size_t sizes[] = {1032, 2008, 4000};
+    bool all_smaller = true;
+    
+    for (size_t size : sizes) {
+        size_t footprint = measure_footprint(size);
+        size_t old_footprint = ((size + 7) & ~(size_t)7) + 40;
+        std::cout << "  " << size << "-byte objects: " << footprint
+                  << " bytes each (was " << old_footprint << ", "
+                  << old_footprint - footprint << " saved)\n";
+        if (footprint >= old_footprint || footprint - size > ALIGNMENT + sizeof(BlockHeader)) {
+            all_smaller = false;
+        }
+    }
+    
+    if (all_smaller) {
+        test_passed("Variable-size blocks pay at most one word plus alignment");
+    } else {
+        test_failed("test_header_overhead", "Block footprint did not shrink");
+    }
+    
+    // Slab-served small objects pay no header at all
+    size_t small_footprint = measure_footprint(32);
+    std::cout << "  32-byte objects: " << small_footprint << " bytes each (slab slots)\n";
+    if (small_footprint == 32) {
+        test_passed("32-byte objects are packed with no overhead");
+    } else {
+        test_failed("test_header_overhead", "32-byte objects carry overhead");
+    }
+}
+
+// ============================================================================
+// SLAB TESTS
+// ============================================================================
+
+void test_slab_classes() {
+    std::cout << "\n=== Test: Slab size classes ===\n";
+    
+    // Requests map to the smallest class that fits
+    if (size_class_size(size_class_index(1)) != 16 ||
+        size_class_size(size_class_index(17)) != 32 ||
+        size_class_size(size_class_index(65)) != 80 ||
+        size_class_size(size_class_index(LARGE_BLOCK_MAX)) != LARGE_BLOCK_MAX) {
+        test_failed("test_slab_classes", "Wrong size class mapping");
+        return;
+    }
+    test_passed("Size class mapping");
+    
+    // 16-byte objects are packed back to back, with no header in between
+    const int count = 64;
+    std::vector<uintptr_t> addrs;
+    void* ptrs[count];
+    for (int i = 0; i < count; i++) {
+        ptrs[i] = my_malloc(16);
+        addrs.push_back((uintptr_t)ptrs[i]);
+    }
+    std::sort(addrs.begin(), addrs.end());
+    
+    int packed = 0;
+    for (int i = 1; i < count; i++) {
+        if (addrs[i] - addrs[i - 1] == 16) {
+            packed++;
+        }
+    }
+    
+    if (packed >= count / 2) {
+        test_passed("16-byte slots are packed without headers");
+    } else {
+        test_failed("test_slab_classes", "Slots are not contiguous");
+    }
+    
+    for (int i = 0; i < count; i++) {
+        my_free(ptrs[i]);
+    }
+    
+    // A freed slot is reused by the next allocation of its class
+    void* first = my_malloc(48);
+    my_free(first);
+    void* second = my_malloc(48);
+    if (first == second) {
+        test_passed("Freed slot is reused");
+    } else {
+        test_failed("test_slab_classes", "Freed slot was not reused");
+    }
+    my_free(second);
+}
+
+// ============================================================================
+// BATCH TESTS
+// ============================================================================
+
+void test_batch() {
+    std::cout << "\n=== Test: Batch allocation ===\n";
+    
+    // One call per size: slab (more than a magazine), variable-size, huge
+    const size_t sizes[] = {64, 2000, 256 * 1024};
+    const size_t counts[] = {300, 40, 3};
+    bool ok = true;
+    
+    for (int s = 0; s < 3; s++) {
+        std::vector<void*> ptrs(counts[s]);
+        size_t filled = my_malloc_batch(sizes[s], counts[s], ptrs.data());
+        if (filled != counts[s]) {
+            ok = false;
+            continue;
+        }
+        
+        for (size_t i = 0; i < filled; i++) {
+            memset(ptrs[i], (int)i, sizes[s]);
+            ok &= ((uintptr_t)ptrs[i] % ALIGNMENT == 0);
+            ok &= (my_malloc_usable_size(ptrs[i]) >= sizes[s]);
+        }
+        for (size_t i = 0; i < filled; i++) {
+            ok &= (((unsigned char*)ptrs[i])[sizes[s] - 1] == (unsigned char)i);
+        }
+        std::sort(ptrs.begin(), ptrs.end());
+        ok &= (std::adjacent_find(ptrs.begin(), ptrs.end()) == ptrs.end());
+        
+        my_free_batch(ptrs.data(), filled);
+    }
+    
+    if (ok) {
+        test_passed("my_malloc_batch returns distinct, usable blocks");
+    } else {
+        test_failed("test_batch", "Batch allocation returned bad blocks");
+    }
+    
+    // Freed blocks are handed out again, and NULL entries are skipped
+    void* first[8];
+    void* second[8];
+    my_malloc_batch(96, 8, first);
+    void* mixed[] = {first[0], nullptr, first[1], first[2], first[3],
+                     first[4], first[5], first[6], first[7]};
+    my_free_batch(mixed, 9);
+    my_malloc_batch(96, 8, second);
+    
+    std::sort(first, first + 8);
+    std::sort(second, second + 8);
+    if (std::equal(first, first + 8, second)) {
+        test_passed("my_free_batch returns blocks for reuse");
+    } else {
+        test_failed("test_batch", "Batch-freed blocks were not reused");
+    }
+    my_free_batch(second, 8);
+    
+    if (my_malloc_batch(0, 4, first) == 0 && my_malloc_batch(64, 0, first) == 0) {
+        test_passed("Empty batches allocate nothing");
+    } else {
+        test_failed("test_batch", "Empty batch allocated");
+    }
+}
+
+// ============================================================================
+// REGION TESTS
+// ============================================================================
+
+void test_region() {
+    std::cout << "\n=== Test: Regions ===\n";
+    
+    Region* region = region_create(16 * 1024);
+    if (region == nullptr) {
+        test_failed("test_region", "region_create failed");
+        return;
+    }
+    
+    // Consecutive small allocations are bumped back to back
+    char* first = (char*)region_alloc(region, 24);
+    char* second = (char*)region_alloc(region, 24);
+    if (first != nullptr && second == first + 32 && (uintptr_t)first % ALIGNMENT == 0) {
+        test_passed("Bump allocation is contiguous and aligned");
+    } else {
+        test_failed("test_region", "Unexpected bump layout");
+    }
+    
+    // Enough to span many chunks, plus oversized and over-aligned requests
+    bool ok = true;
+    std::vector<int*> values;
+    for (int i = 0; i < 5000; i++) {
+        int* value = (int*)region_alloc(region, sizeof(int) * 4);
+        ok &= (value != nullptr);
+        value[0] = i;
+        values.push_back(value);
+    }
+    char* big = (char*)region_alloc(region, 200 * 1024);
+    void* aligned = region_alloc(region, 100, 256);
+    ok &= (big != nullptr && aligned != nullptr && (uintptr_t)aligned % 256 == 0);
+    memset(big, 0x5A, 200 * 1024);
+    for (int i = 0; i < 5000; i++) {
+        ok &= (values[i][0] == i);
+    }
+    
+    if (ok) {
+        test_passed("Allocations span chunks, big and aligned requests");
+    } else {
+        test_failed("test_region", "Region allocation lost data");
+    }
+    
+    // Reset rewinds to the start of the first chunk
+    region_reset(region);
+    if (region_alloc(region, 24) == first && region->chunks->next == nullptr) {
+        test_passed("Reset keeps one chunk and rewinds");
+    } else {
+        test_failed("test_region", "Reset did not rewind the region");
+    }
+    region_destroy(region);
+    
+    // An alignment beyond the chunk size gets one chunk of its own per call
+    region = region_create(4096);
+    bool aligned_ok = (region != nullptr);
+    for (int i = 0; aligned_ok && i < 4; i++) {
+        void* ptr = region_alloc(region, 16, 65536);
+        aligned_ok = ptr != nullptr && (uintptr_t)ptr % 65536 == 0;
+    }
+    size_t chunk_count = 0;
+    for (RegionChunk* chunk = aligned_ok ? region->chunks : nullptr; chunk != nullptr;
+         chunk = chunk->next) {
+        chunk_count++;
+    }
+    if (aligned_ok && chunk_count == 5) {
+        test_passed("Over-aligned small requests take one chunk each");
+    } else {
+        test_failed("test_region", "Over-aligned requests leaked chunks");
+    }
+    region_destroy(region);
+    
+    // Standard containers on top of the pmr adapter
+    {
+        RegionResource resource;
+        std::pmr::vector<int> numbers(&resource);
+        std::pmr::map<int, int> squares(&resource);
+        for (int i = 0; i < 1000; i++) {
+            numbers.push_back(i);
+            squares[i] = i * i;
+        }
+        if (numbers[999] == 999 && squares[31] == 961 && squares.size() == 1000) {
+            test_passed("pmr containers allocate from a RegionResource");
+        } else {
+            test_failed("test_region", "pmr containers misbehaved");
+        }
+    }
+}
+
+// ============================================================================
+// OBJECT POOL TESTS
+// ============================================================================
+
+struct PoolObject {
+    static int live;
+    int id;
+    char payload[100];
+    
+    explicit PoolObject(int object_id) : id(object_id) { live++; }
+    ~PoolObject() { live--; }
+};
+int PoolObject::live = 0;
+
+struct alignas(64) AlignedObject {
+    char bytes[64];
+};
+
+static_assert(ObjectPool<PoolObject>::class_index == size_class_for(sizeof(PoolObject)),
+              "size class is chosen at compile time");
+
+void test_object_pool() {
+    std::cout << "\n=== Test: Object pools ===\n";
+    
+    // The compile-time class agrees with the runtime lookup for every size
+    bool classes_match = true;
+    for (size_t size = 1; size <= LARGE_BLOCK_MAX; size++) {
+        classes_match &= (size_class_for(size) == size_class_index(size));
+    }
+    if (classes_match) {
+        test_passed("size_class_for matches size_class_index");
+    } else {
+        test_failed("test_object_pool", "Compile-time size classes disagree");
+    }
+    
+    // my_new/my_delete construct and destroy, from the chosen class
+    PoolObject* object = my_new<PoolObject>(7);
+    AlignedObject* aligned = my_new<AlignedObject>();
+    bool ok = object->id == 7 && PoolObject::live == 1 &&
+              my_malloc_usable_size(object) ==
+                  size_class_size(ObjectPool<PoolObject>::class_index) &&
+              (uintptr_t)aligned % 64 == 0;
+    my_delete(object);
+    my_delete(aligned);
+    
+    if (ok && PoolObject::live == 0) {
+        test_passed("my_new/my_delete use the compile-time size class");
+    } else {
+        test_failed("test_object_pool", "my_new/my_delete misbehaved");
+    }
+    
+    // Node-based containers and smart pointers
+    {
+        std::map<int, int, std::less<int>, Allocator<std::pair<const int, int>>> squares;
+        std::list<int, Allocator<int>> numbers;
+        for (int i = 0; i < 1000; i++) {
+            squares[i] = i * i;
+            numbers.push_back(i);
+        }
+        std::vector<int, Allocator<int>> values(numbers.begin(), numbers.end());
+        
+        std::shared_ptr<PoolObject> shared = my_make_shared<PoolObject>(3);
+        pool_ptr<PoolObject> unique = my_make_unique<PoolObject>(4);
+        
+        ok = squares[31] == 961 && numbers.size() == 1000 && values[999] == 999 &&
+             shared->id == 3 && unique->id == 4 && PoolObject::live == 2;
+    }
+    
+    if (ok && PoolObject::live == 0) {
+        test_passed("Allocator<T> backs std::map, std::list and smart pointers");
+    } else {
+        test_failed("test_object_pool", "Containers or smart pointers misbehaved");
+    }
+}
+
+// ============================================================================
+// HUGE ALLOCATION TESTS
+// ============================================================================
+
+void test_huge_allocations() {
+    std::cout << "\n=== Test: Huge allocations ===\n";
+    
+    // Buffers far beyond any pool arena get their own page-aligned mapping
+    const size_t mb = 1024 * 1024;
+    unsigned char* ptr = (unsigned char*)my_malloc(8 * mb);
+    if (ptr == nullptr || (uintptr_t)ptr % 4096 != 0) {
+        test_failed("test_huge_allocations", "8 MB allocation failed or unaligned");
+        return;
+    }
+    test_passed("8 MB page-aligned allocation");
+    
+    ptr[0] = 1;
+    ptr[8 * mb - 1] = 2;
+    
+    // Grow with mremap; contents survive
+    unsigned char* grown = (unsigned char*)my_realloc(ptr, 64 * mb);
+    if (grown == nullptr || grown[0] != 1 || grown[8 * mb - 1] != 2) {
+        test_failed("test_huge_allocations", "Growing a huge block lost data");
+        return;
+    }
+    grown[64 * mb - 1] = 3;
+    test_passed("Grow 8 MB -> 64 MB with mremap");
+    
+    // Shrink in place
+    unsigned char* shrunk = (unsigned char*)my_realloc(grown, 2 * mb);
+    if (shrunk != grown || shrunk[0] != 1) {
+        test_failed("test_huge_allocations", "Shrinking a huge block moved it");
+        return;
+    }
+    test_passed("Shrink 64 MB -> 2 MB in place");
+    
+    // Dropping below the threshold moves the data into a pool block
+    unsigned char* small = (unsigned char*)my_realloc(shrunk, 1000);
+    if (small == nullptr || small[0] != 1) {
+        test_failed("test_huge_allocations", "Shrinking below threshold lost data");
+        return;
+    }
+    test_passed("Shrink below the mmap threshold");
+    my_free(small);
+    
+    // calloc of a huge block is zeroed by the kernel
+    int* zeros = (int*)my_calloc(1 << 20, sizeof(int));
+    if (zeros == nullptr || zeros[0] != 0 || zeros[(1 << 20) - 1] != 0) {
+        test_failed("test_huge_allocations", "Huge calloc not zeroed");
+        return;
+    }
+    my_free(zeros);
+    test_passed("Huge calloc is zeroed");
+    
+    // Many live huge blocks (forces the side table to grow), freed in a
+    // scrambled order
+    std::vector<void*> many;
+    for (int i = 0; i < 300; i++) {
+        many.push_back(my_malloc(MMAP_THRESHOLD + i * 4096));
+    }
+    for (int i = 0; i < 300; i++) {
+        std::swap(many[i], many[(i * 7919) % 300]);
+    }
+    bool sizes_ok = true;
+    for (void* block : many) {
+        if (block == nullptr || huge_usable_size(block) < MMAP_THRESHOLD) {
+            sizes_ok = false;
+        }
+        my_free(block);
+    }
+    if (sizes_ok) {
+        test_passed("Side table tracks 300 huge blocks");
+    } else {
+        test_failed("test_huge_allocations", "Side table lost a huge block");
+    }
+}
+
+// ============================================================================
+// PAGE MAP TESTS
+// ============================================================================
+
+void test_usable_size() {
+    std::cout << "\n=== Test: Page map and usable size ===\n";
+    
+    // Every kind of block reports at least the requested size
+    void* slab_ptr = my_malloc(20);
+    void* block_ptr = my_malloc(5000);
+    void* huge_ptr = my_malloc(MMAP_THRESHOLD * 2);
+    
+    if (my_malloc_usable_size(slab_ptr) == 32 &&
+        my_malloc_usable_size(block_ptr) >= 5000 &&
+        my_malloc_usable_size(huge_ptr) >= MMAP_THRESHOLD * 2) {
+        test_passed("Usable size for slab, block and huge pointers");
+    } else {
+        test_failed("test_usable_size", "Wrong usable size");
+    }
+    
+    // The page map classifies each pointer
+    PageMapEntry* entry = page_map_lookup(slab_ptr);
+    if (entry != nullptr && entry->kind == PAGE_SLAB &&
+        page_map_lookup(block_ptr)->kind == PAGE_BLOCK &&
+        page_map_lookup(huge_ptr)->kind == PAGE_HUGE) {
+        test_passed("Page map classifies pointers");
+    } else {
+        test_failed("test_usable_size", "Page map entry has the wrong kind");
+    }
+    
+    // Foreign pointers are not ours
+    int on_stack = 0;
+    if (my_malloc_usable_size(&on_stack) == 0 && my_malloc_usable_size(nullptr) == 0) {
+        test_passed("Foreign pointers report size 0");
+    } else {
+        test_failed("test_usable_size", "Foreign pointer claimed");
+    }
+    
+    my_free(slab_ptr);
+    my_free(block_ptr);
+    my_free(huge_ptr);
+}
+
+// ============================================================================
+// TRACE TESTS
+// ============================================================================
+
+void test_trace() {
+    std::cout << "\n=== Test: Trace capture ===\n";
+    
+    char path[] = "/tmp/allocator_trace_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        test_failed("test_trace", "Could not create a temporary file");
+        return;
+    }
+    close(fd);
+    
+    // Record one call of each kind; calloc/realloc must not also show up
+    // as the malloc/free they use internally
+    if (!allocator_trace_start(path)) {
+        test_failed("test_trace", "allocator_trace_start failed");
+        unlink(path);
+        return;
+    }
+    void* a = my_malloc(100);
+    void* b = my_calloc(4, 50);
+    void* c = my_realloc(a, 5000);
+    void* d = my_aligned_alloc(64, 40);
+    my_free(b);
+    my_free(c);
+    my_free(d);
+    allocator_trace_stop();
+    void* untraced = my_malloc(10);
+    my_free(untraced);
+    
+    std::ifstream file(path, std::ios::binary);
+    TraceFileHeader header;
+    std::vector<TraceRecord> records;
+    TraceRecord record;
+    bool header_ok = file.read((char*)&header, sizeof(header)) &&
+                     std::memcmp(header.magic, TRACE_MAGIC, 8) == 0 &&
+                     header.record_size == sizeof(TraceRecord);
+    while (file.read((char*)&record, sizeof(record))) {
+        records.push_back(record);
+    }
+    unlink(path);
+    
+    if (header_ok && records.size() == 7) {
+        test_passed("One record per public call");
+    } else {
+        test_failed("test_trace", "Wrong trace header or record count");
+        return;
+    }
+    
+    const uint8_t expected_ops[] = {TRACE_MALLOC, TRACE_CALLOC, TRACE_REALLOC, TRACE_ALIGNED_ALLOC,
+                                    TRACE_FREE, TRACE_FREE, TRACE_FREE};
+    bool ops_ok = true;
+    for (size_t i = 0; i < records.size(); i++) {
+        ops_ok = ops_ok && records[i].op == expected_ops[i] && records[i].thread == records[0].thread;
+        ops_ok = ops_ok && (i == 0 || records[i].timestamp >= records[i - 1].timestamp);
+    }
+    if (ops_ok &&
+        records[0].size == 100 && records[0].ptr == (uintptr_t)a &&
+        records[1].size == 200 && records[1].arg == 4 &&
+        records[2].arg == (uintptr_t)a && records[2].ptr == (uintptr_t)c &&
+        records[3].arg == 64 && records[6].ptr == (uintptr_t)d) {
+        test_passed("Records hold op, size, pointers and thread");
+    } else {
+        test_failed("test_trace", "Record contents do not match the calls");
+    }
+}
+
+// Allocation site the profile should find as one stack
+__attribute__((noinline)) static void* profiled_site(size_t size) {
+    return my_malloc(size);
+}
+
+static bool read_profile_header(const char* path, unsigned long long counts[4], size_t* interval,
+                                int* stacks) {
+    // Totals from the header line, and the number of stack lines
+    std::ifstream file(path);
+    std::string line;
+    if (!std::getline(file, line) ||
+        sscanf(line.c_str(), "heap profile: %llu: %llu [%llu: %llu] @ heap_v2/%zu", &counts[0],
+               &counts[1], &counts[2], &counts[3], interval) != 5) {
+        return false;
+    }
+    *stacks = 0;
+    while (std::getline(file, line) && !line.empty()) {
+        (*stacks)++;
+    }
+    return std::getline(file, line) && line == "MAPPED_LIBRARIES:";
+}
+
+void test_heap_profile() {
+    std::cout << "\n=== Test: Heap profile ===\n";
+    
+    char path[] = "/tmp/allocator_profile_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        test_failed("test_heap_profile", "Could not create a temporary file");
+        return;
+    }
+    close(fd);
+    
+    // A 1-byte interval samples every allocation. The thread's first
+    // countdown only arms sampling, so start over once it has run out.
+    allocator_profile_start(1);
+    my_free(my_malloc(64));
+    allocator_profile_start(0);
+    
+    void* blocks[100];
+    for (int i = 0; i < 100; i++) {
+        blocks[i] = profiled_site(1000);
+    }
+    for (int i = 0; i < 100; i += 2) {
+        my_free(blocks[i]);
+    }
+    
+    unsigned long long counts[4];
+    size_t interval = 0;
+    int stacks = 0;
+    if (allocator_profile_dump(path) && read_profile_header(path, counts, &interval, &stacks) &&
+        counts[0] == 50 && counts[1] == 50 * 1000 && counts[2] == 100 &&
+        counts[3] == 100 * 1000 && interval == 1 && stacks == 1) {
+        test_passed("Live and cumulative samples of one stack");
+    } else {
+        test_failed("test_heap_profile", "Wrong profile totals after sampling every allocation");
+    }
+    
+    // A failed realloc leaves the block live, and sampled
+    if (my_realloc(blocks[1], SIZE_MAX / 2) == nullptr && allocator_profile_dump(path) &&
+        read_profile_header(path, counts, &interval, &stacks) &&
+        counts[0] == 50 && counts[1] == 50 * 1000) {
+        test_passed("Failed realloc keeps its sample");
+    } else {
+        test_failed("test_heap_profile", "Failed realloc dropped the block from the profile");
+    }
+    
+    // Frees empty the live side only; nothing is sampled once stopped
+    for (int i = 1; i < 100; i += 2) {
+        my_free(blocks[i]);
+    }
+    allocator_profile_stop();
+    void* unsampled = my_malloc(1000);
+    if (allocator_profile_dump(path) && read_profile_header(path, counts, &interval, &stacks) &&
+        counts[0] == 0 && counts[1] == 0 && counts[2] == 100 && counts[3] == 100 * 1000) {
+        test_passed("Frees leave the profile, stopping keeps it");
+    } else {
+        test_failed("test_heap_profile", "Freed or unsampled blocks counted");
+    }
+    my_free(unsampled);
+    
+    // The same through the control interface
+    bool active = true;
+    size_t bool_length = sizeof(bool);
+    size_t length = sizeof(size_t);
+    size_t zero = 0;
+    size_t default_interval = PROFILE_SAMPLE_INTERVAL;
+    const char* dump_path = path;
+    const char* bad_path = "/nonexistent/allocator.heap";
+    if (my_allocctl("profile.active", &active, &bool_length, nullptr, 0) == 0 && !active &&
+        my_allocctl("profile.sample_interval", nullptr, nullptr, &zero, sizeof(zero)) == EINVAL &&
+        my_allocctl("profile.sample_interval", &interval, &length, &default_interval,
+                    sizeof(default_interval)) == 0 && interval == 1 &&
+        my_allocctl("profile.dump", nullptr, nullptr, &dump_path, sizeof(dump_path)) == 0 &&
+        my_allocctl("profile.dump", nullptr, nullptr, &bad_path, sizeof(bad_path)) == EIO) {
+        test_passed("Profile keys");
+    } else {
+        test_failed("test_heap_profile", "profile.* keys misbehave");
+    }
+    unlink(path);
+}
+
 // ============================================================================
-// ALIGNMENT TESTS
+// POOL GROWTH TESTS
 // ============================================================================
 
-void test_alignment() {
-    std::cout << "\n=== Test: Alignment ===\n";
+void test_stats() {
+    std::cout << "\n=== Test: Statistics snapshots ===\n";
     
-    // Allocate various sizes and check alignment
-    for (size_t size = 1; size <= 100; size++) {
-        void* ptr = my_malloc(size);
+    const int class_index = size_class_index(100);
+    AllocatorStats before;
+    allocator_stats_snapshot(&before);
+    
+    // Slab, xlarge and huge allocations each show up where they belong
+    void* slots[100];
+    for (int i = 0; i < 100; i++) {
+        slots[i] = my_malloc(100);
+    }
+    void* blocks[3];
+    for (int i = 0; i < 3; i++) {
+        blocks[i] = my_malloc(4000);
+    }
+    void* huge = my_malloc(MMAP_THRESHOLD * 2);
+    
+    AllocatorStats during;
+    allocator_stats_snapshot(&during);
+    const AllocStats& slot_class = during.classes[class_index];
+    if (slot_class.alloc_calls - before.classes[class_index].alloc_calls == 100 &&
+        slot_class.live_objects - before.classes[class_index].live_objects == 100 &&
+        slot_class.live_bytes == slot_class.live_objects * size_class_size(class_index) &&
+        during.pools[STATS_POOL_XLARGE].live_objects -
+            before.pools[STATS_POOL_XLARGE].live_objects == 3 &&
+        during.pools[STATS_POOL_HUGE].live_objects -
+            before.pools[STATS_POOL_HUGE].live_objects == 1 &&
+        during.pools[STATS_POOL_HUGE].live_bytes >= MMAP_THRESHOLD * 2) {
+        test_passed("Live objects and calls counted per class and pool");
+    } else {
+        test_failed("test_stats", "Live counts do not match the allocations");
+    }
+    
+    // Free space adds up: every extent fits in the free bytes, and slab
+    // slots of a class are either live or free
+    bool consistent = slot_class.free_bytes == slot_class.free_blocks * size_class_size(class_index) &&
+                      (slot_class.live_bytes + slot_class.free_bytes) <= slot_class.mapped_bytes;
+    for (int p = 0; p < STATS_POOL_COUNT; p++) {
+        const AllocStats& pool = during.pools[p];
+        consistent &= pool.largest_free <= pool.free_bytes &&
+                      pool.fragmentation >= 0.0 && pool.fragmentation <= 1.0 &&
+                      pool.live_bytes + pool.free_bytes <= pool.mapped_bytes;
+    }
+    if (consistent && get_allocated_bytes() == during.total.live_bytes &&
+        get_free_block_count() == during.total.free_blocks) {
+        test_passed("Free bytes, extents and fragmentation are consistent");
+    } else {
+        test_failed("test_stats", "Inconsistent free-space statistics");
+    }
+    
+    // Counts of a thread that has exited are kept
+    std::thread worker([&slots]() {
+        for (int i = 0; i < 50; i++) {
+            my_free(slots[i]);
+        }
+    });
+    worker.join();
+    for (int i = 50; i < 100; i++) {
+        my_free(slots[i]);
+    }
+    for (int i = 0; i < 3; i++) {
+        my_free(blocks[i]);
+    }
+    my_free(huge);
+    
+    AllocatorStats after;
+    allocator_stats_snapshot(&after);
+    if (after.classes[class_index].free_calls - before.classes[class_index].free_calls == 100 &&
+        after.classes[class_index].live_objects == before.classes[class_index].live_objects &&
+        after.pools[STATS_POOL_XLARGE].live_objects == before.pools[STATS_POOL_XLARGE].live_objects &&
+        after.pools[STATS_POOL_HUGE].live_objects == before.pools[STATS_POOL_HUGE].live_objects) {
+        test_passed("Frees from other threads folded in");
+    } else {
+        test_failed("test_stats", "Live counts did not return to where they started");
+    }
+    
+    // Resident bytes only when asked for, and never more than is mapped
+    void* touched = my_malloc(100);
+    std::memset(touched, 1, 100);
+    AllocatorStats resident;
+    allocator_stats_snapshot(&resident, true);
+    if (after.total.resident_bytes == 0 && resident.total.resident_bytes > 0 &&
+        resident.total.resident_bytes <= resident.total.mapped_bytes &&
+        resident.classes[class_index].resident_bytes > 0) {
+        test_passed("Resident bytes from mincore");
+    } else {
+        test_failed("test_stats", "Resident bytes missing or larger than mapped");
+    }
+    my_free(touched);
+}
+
+void test_allocctl() {
+    std::cout << "\n=== Test: Control interface ===\n";
+    
+    // Fixed settings read back; unknown keys, wrong lengths and writes to
+    // read-only keys are refused
+    size_t value = 0;
+    size_t length = sizeof(value);
+    bool bad_calls_refused = false;
+    if (my_allocctl("pools.small.max_size", &value, &length, nullptr, 0) == 0 &&
+        value == SMALL_BLOCK_MAX &&
+        my_allocctl("size_classes.3.size", &value, &length, nullptr, 0) == 0 &&
+        value == size_class_size(3)) {
+        int wrong_length = 0;
+        size_t small_length = sizeof(wrong_length);
+        bad_calls_refused =
+            my_allocctl("pools.tiny.max_size", &value, &length, nullptr, 0) == ENOENT &&
+            my_allocctl("pools.small.max_size", &wrong_length, &small_length, nullptr, 0) == EINVAL &&
+            my_allocctl("pools.small.max_size", nullptr, nullptr, &value, sizeof(value)) == EPERM &&
+            my_allocctl("scavenge", &value, &length, nullptr, 0) == EPERM;
+    }
+    if (bad_calls_refused) {
+        test_passed("Read-only keys, unknown keys and bad lengths");
+    } else {
+        test_failed("test_allocctl", "Key lookup or argument checks wrong");
+    }
+    
+    // A write returns the old value and takes effect
+    long old_decay = 0;
+    long new_decay = 2500;
+    long current_decay = 0;
+    size_t long_length = sizeof(long);
+    my_allocctl("decay_ms", &old_decay, &long_length, &new_decay, sizeof(new_decay));
+    my_allocctl("decay_ms", &current_decay, &long_length, &old_decay, sizeof(old_decay));
+    long restored_decay = 0;
+    my_allocctl("decay_ms", &restored_decay, &long_length, nullptr, 0);
+    const char* bogus = "bogus";
+    if (current_decay == 2500 && restored_decay == old_decay &&
+        my_allocctl("huge_pages", nullptr, nullptr, &bogus, sizeof(bogus)) == EINVAL) {
+        test_passed("Settings are read and written by name");
+    } else {
+        test_failed("test_allocctl", "decay_ms did not round-trip");
+    }
+    
+    // Magazines shrink to tcache.max (batch first, so batch <= max holds)
+    size_t batch = 4;
+    size_t limit = 8;
+    my_allocctl("tcache.batch", nullptr, nullptr, &batch, sizeof(batch));
+    my_allocctl("tcache.max", nullptr, nullptr, &limit, sizeof(limit));
+    const int class_index = size_class_index(48);
+    void* slots[100];
+    for (int i = 0; i < 100; i++) {
+        slots[i] = my_malloc(48);
+    }
+    for (int i = 0; i < 100; i++) {
+        my_free(slots[i]);
+    }
+    ThreadCache* cache = get_thread_cache();
+    bool limited = cache != nullptr && cache->bins[class_index].count <= 8;
+    batch = 2 * limit;  // More than max: refused
+    limited &= my_allocctl("tcache.batch", nullptr, nullptr, &batch, sizeof(batch)) == EINVAL;
+    limit = TCACHE_MAGAZINE_SIZE;
+    batch = TCACHE_BATCH_SIZE;
+    my_allocctl("tcache.max", nullptr, nullptr, &limit, sizeof(limit));
+    my_allocctl("tcache.batch", nullptr, nullptr, &batch, sizeof(batch));
+    if (limited) {
+        test_passed("tcache.max bounds the magazines");
+    } else {
+        test_failed("test_allocctl", "Magazine held more than tcache.max");
+    }
+    
+    // Changing the fit policy re-indexes the live pool's free blocks
+    void* blocks[16];
+    for (int i = 0; i < 16; i++) {
+        blocks[i] = my_malloc(2000 + i * 100);
+    }
+    for (int i = 0; i < 16; i += 2) {
+        my_free(blocks[i]);
+    }
+    size_t free_before = 0;
+    size_t free_after = 0;
+    const char* policy = "best";
+    const char* old_policy = nullptr;
+    size_t pointer_length = sizeof(const char*);
+    my_allocctl("stats.xlarge.free_blocks", &free_before, &length, nullptr, 0);
+    my_allocctl("fit_policy", &old_policy, &pointer_length, &policy, sizeof(policy));
+    my_allocctl("stats.xlarge.free_blocks", &free_after, &length, nullptr, 0);
+    void* reused = my_malloc(2000);
+    const char* current_policy = nullptr;
+    my_allocctl("fit_policy", &current_policy, &pointer_length, &old_policy, sizeof(old_policy));
+    if (free_before == free_after && reused != nullptr &&
+        strcmp(current_policy, "best") == 0) {
+        test_passed("fit_policy switches a live pool");
+    } else {
+        test_failed("test_allocctl", "Free blocks lost switching fit policy");
+    }
+    my_free(reused);
+    for (int i = 1; i < 16; i += 2) {
+        my_free(blocks[i]);
+    }
+    
+    // Every statistic is readable by name
+    size_t live_bytes = 0;
+    uint64_t allocs = 0;
+    double fragmentation = -1.0;
+    size_t uint64_length = sizeof(uint64_t);
+    size_t double_length = sizeof(double);
+    if (my_allocctl("stats.total.live_bytes", &live_bytes, &length, nullptr, 0) == 0 &&
+        live_bytes == get_allocated_bytes() &&
+        my_allocctl("stats.classes.2.alloc_calls", &allocs, &uint64_length, nullptr, 0) == 0 &&
+        my_allocctl("stats.huge.fragmentation", &fragmentation, &double_length, nullptr, 0) == 0 &&
+        fragmentation == 0.0) {
+        test_passed("Statistics readable by name");
+    } else {
+        test_failed("test_allocctl", "Statistic keys missing or wrong");
+    }
+}
+
+void test_pool_growth() {
+    std::cout << "\n=== Test: Pool growth ===\n";
+    
+    // Far more small objects than the initial 64 KB small pool can hold
+    const int small_count = 200000;
+    std::vector<void*> small;
+    for (int i = 0; i < small_count; i++) {
+        void* ptr = my_malloc(32);
         if (ptr == nullptr) {
-            test_failed("test_alignment", "Allocation failed");
-            return;
+            test_failed("test_pool_growth", "Small pool did not grow");
+            break;
         }
-        
-        uintptr_t addr = (uintptr_t)ptr;
-        if (addr % ALIGNMENT != 0) {
-            test_failed("test_alignment", "Pointer not aligned");
-            my_free(ptr);
-            return;
+        small.push_back(ptr);
+    }
+    if ((int)small.size() == small_count) {
+        test_passed("Slab pool grows past its first arena");
+    }
+    
+    // Variable-size blocks well beyond the initial 1 MB xlarge pool
+    const int big_count = 100;
+    std::vector<void*> big;
+    for (int i = 0; i < big_count; i++) {
+        void* ptr = my_malloc(100 * 1024);
+        if (ptr == nullptr) {
+            test_failed("test_pool_growth", "Xlarge pool did not grow");
+            break;
         }
-        
+        std::memset(ptr, i, 100 * 1024);
+        big.push_back(ptr);
+    }
+    if ((int)big.size() == big_count) {
+        test_passed("Variable-size pool grows past its first arena");
+    }
+    
+    // Pointers from every arena are found again on free
+    for (void* ptr : small) {
+        my_free(ptr);
+    }
+    for (void* ptr : big) {
+        my_free(ptr);
+    }
+    test_passed("Free across chained arenas");
+}
+
+// ============================================================================
+// SCAVENGER TESTS
+// ============================================================================
+
+static size_t resident_pages(void* start, size_t size) {
+    // Count pages of [start, start + size) that are in memory
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    uintptr_t first = (uintptr_t)start & ~(uintptr_t)(page - 1);
+    size_t count = ((uintptr_t)start + size - first + page - 1) / page;
+    std::vector<unsigned char> vec(count);
+    if (mincore((void*)first, count * page, vec.data()) != 0) {
+        return count;
+    }
+    size_t resident = 0;
+    for (unsigned char flags : vec) {
+        resident += flags & 1;
+    }
+    return resident;
+}
+
+void test_scavenger() {
+    std::cout << "\n=== Test: Scavenger ===\n";
+    
+    // Keep incremental passes out of the way while we measure
+    allocator_set_decay_ms(-1);
+    allocator_scavenge(true);
+    
+    // Free pool blocks: the first pass ages them, the second releases them
+    const size_t size = 20000;
+    std::vector<void*> blocks;
+    for (int i = 0; i < 32; i++) {
+        blocks.push_back(my_malloc(size));
+        memset(blocks.back(), 0x77, size);
+    }
+    void* probe = blocks[16];
+    for (void* ptr : blocks) {
         my_free(ptr);
     }
     
-    test_passed("All pointers are aligned");
+    size_t first_pass = allocator_scavenge(false);
+    size_t resident_before = resident_pages(probe, size);
+    size_t second_pass = allocator_scavenge(false);
+    size_t resident_after = resident_pages(probe, size);
+    
+    if (first_pass == 0 && second_pass >= 32 * size / 2 && resident_before >= 4 &&
+        resident_after <= 2) {
+        test_passed("Free blocks are released after one decay period");
+    } else {
+        test_failed("test_scavenger", "Free pool pages were not released");
+    }
+    
+    // Released memory is reused normally (the pages come back zeroed)
+    char* again = (char*)my_malloc(size);
+    memset(again, 0x11, size);
+    bool intact = again[0] == 0x11 && again[size - 1] == 0x11;
+    my_free(again);
+    
+    // Empty slabs go back whole
+    std::vector<void*> slots(4000);
+    size_t filled = my_malloc_batch(1024, slots.size(), slots.data());
+    for (size_t i = 0; i < filled; i++) {
+        memset(slots[i], 0x33, 1024);
+    }
+    
+    // Pools on huge pages (MYALLOC_HUGEPAGES) keep their slabs, since
+    // releasing one would split a huge page
+    PageMapEntry* entry = (filled > 0) ? page_map_lookup(slots[0]) : nullptr;
+    bool huge_backed = entry != nullptr && entry->pool->huge_pages;
+    allocator_scavenge(true);  // Only the slabs are left to release
+    my_free_batch(slots.data(), filled);
+    thread_cache_flush();
+    
+    size_t released = allocator_scavenge(true);
+    bool released_ok = huge_backed ? released == 0 : released >= 2 * 1024 * 1024;
+    if (intact && filled == slots.size() && released_ok && allocator_scavenge(true) == 0) {
+        test_passed("Empty slabs are released once");
+    } else {
+        test_failed("test_scavenger", "Slabs were not released");
+    }
+    
+    allocator_set_decay_ms(SCAVENGE_DECAY_MS);
+    
+    // The background thread starts and stops cleanly
+    if (allocator_start_scavenger() && allocator_start_scavenger()) {
+        test_passed("Background scavenger starts");
+    } else {
+        test_failed("test_scavenger", "Background scavenger did not start");
+    }
 }
 
 // ============================================================================
-// FRAGMENTATION TESTS
+// HUGE PAGE TESTS
 // ============================================================================
 
-void test_fragmentation() {
-    std::cout << "\n=== Test: Fragmentation ===\n";
+static std::vector<std::pair<uintptr_t, uintptr_t>> thp_mappings() {
+    // Address ranges of /proc/self/smaps mappings advised MADV_HUGEPAGE
+    std::vector<std::pair<uintptr_t, uintptr_t>> ranges;
+    std::ifstream smaps("/proc/self/smaps");
+    std::string line;
+    unsigned long low = 0;
+    unsigned long high = 0;
+    while (std::getline(smaps, line)) {
+        // Mapping lines start "low-high perms"; attribute lines "Name:"
+        if (line.find(':') > line.find(' ')) {
+            sscanf(line.c_str(), "%lx-%lx", &low, &high);
+            continue;
+        }
+        if (line.compare(0, 8, "VmFlags:") == 0 && line.find(" hg") != std::string::npos) {
+            ranges.push_back(std::make_pair((uintptr_t)low, (uintptr_t)high));
+        }
+    }
+    return ranges;
+}
+
+void test_huge_pages() {
+    std::cout << "\n=== Test: Huge page arenas ===\n";
     
-    // Allocate and free in a pattern that causes fragmentation
-    void* ptrs[5];
+    // Enough 16-byte objects (24 MB) to use up the slabs earlier tests left
+    // free and make the small pool map new arenas
+    allocator_set_huge_pages(HUGE_PAGES_THP);
+    std::vector<void*> objects(1500000);
+    size_t filled = my_malloc_batch(16, objects.size(), objects.data());
+    allocator_set_huge_pages(HUGE_PAGES_OFF);
     
-    // Allocate 5 blocks
-    for (int i = 0; i < 5; i++) {
-        ptrs[i] = my_malloc(100);
+    bool intact = filled == objects.size();
+    for (size_t i = 0; intact && i < filled; i++) {
+        *(size_t*)objects[i] = i;
+    }
+    for (size_t i = 0; intact && i < filled; i++) {
+        intact = (*(size_t*)objects[i] == i);
     }
     
-    // Free middle blocks
-    my_free(ptrs[1]);
-    my_free(ptrs[3]);
+    // The arenas mapped meanwhile are advised, and aligned to huge pages
+    bool thp_available = access("/sys/kernel/mm/transparent_hugepage/enabled", F_OK) == 0;
+    bool advised = false;
+    for (const auto& range : thp_mappings()) {
+        bool aligned = range.first % HUGE_PAGE_SIZE == 0 && range.second % HUGE_PAGE_SIZE == 0;
+        for (size_t i = 0; i < filled && aligned && !advised; i += 1000) {
+            advised = (uintptr_t)objects[i] >= range.first && (uintptr_t)objects[i] < range.second;
+        }
+    }
     
-    // Try to allocate a larger block (should coalesce)
-    void* large = my_malloc(200);
-    if (large != nullptr) {
-        test_passed("Coalescing works");
-        my_free(large);
+    if (intact && (!thp_available || advised)) {
+        test_passed("Slab arenas are 2 MB aligned and advised for THP");
     } else {
-        test_failed("test_fragmentation", "Coalescing failed");
+        test_failed("test_huge_pages", "THP arena not aligned, advised or usable");
     }
+    my_free_batch(objects.data(), filled);
     
-    // Free remaining blocks
-    my_free(ptrs[0]);
-    my_free(ptrs[2]);
-    my_free(ptrs[4]);
+    // Without reserved huge pages MAP_HUGETLB fails and we fall back
+    allocator_set_huge_pages(HUGE_PAGES_HUGETLB);
+    filled = my_malloc_batch(16, objects.size(), objects.data());
+    allocator_set_huge_pages(HUGE_PAGES_OFF);
+    
+    if (filled == objects.size()) {
+        memset(objects[filled - 1], 0, 16);
+        test_passed("MAP_HUGETLB falls back cleanly");
+    } else {
+        test_failed("test_huge_pages", "Allocation failed in hugetlb mode");
+    }
+    my_free_batch(objects.data(), filled);
 }
 
 // ============================================================================
@@ -289,6 +1710,332 @@ void test_write_read() {
     my_free(ptr);
 }
 
+// ============================================================================
+// THREAD CACHE TESTS
+// ============================================================================
+
+void test_threads() {
+    std::cout << "\n=== Test: Multi-threaded allocation ===\n";
+    
+    const int thread_count = 4;
+    const int iterations = 5000;
+    std::atomic<int> errors(0);
+    
+    // Each thread allocates, writes a pattern, verifies it and frees
+    std::vector<std::thread> threads;
+    for (int t = 0; t < thread_count; t++) {
+        threads.emplace_back([t, &errors]() {
+            std::vector<unsigned char*> live;
+            for (int i = 0; i < iterations; i++) {
+                size_t size = (i * 7 + t) % 512 + 1;
+                unsigned char* ptr = (unsigned char*)my_malloc(size);
+                if (ptr == nullptr) {
+                    errors++;
+                    continue;
+                }
+                std::memset(ptr, t + 1, size);
+                live.push_back(ptr);
+                
+                if (live.size() > 32) {
+                    unsigned char* victim = live.front();
+                    if (victim[0] != t + 1) {
+                        errors++;
+                    }
+                    my_free(victim);
+                    live.erase(live.begin());
+                }
+            }
+            for (unsigned char* ptr : live) {
+                my_free(ptr);
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    
+    if (errors == 0) {
+        test_passed("Concurrent alloc/free from 4 threads");
+    } else {
+        test_failed("test_threads", "Allocation failure or data corruption");
+    }
+    
+    // Producer/consumer: blocks allocated on one thread, freed on another
+    std::vector<void*> handoff;
+    std::thread producer([&handoff]() {
+        for (int i = 0; i < 1000; i++) {
+            handoff.push_back(my_malloc(48));
+        }
+    });
+    producer.join();
+    
+    std::thread consumer([&handoff]() {
+        for (void* ptr : handoff) {
+            my_free(ptr);
+        }
+    });
+    consumer.join();
+    
+    test_passed("Cross-thread free");
+}
+
+// ============================================================================
+// TEST: REMOTE FREES
+// ============================================================================
+
+void test_remote_free() {
+    std::cout << "\n=== Test: Remote frees ===\n";
+    
+    // Blocks freed by another thread land on the owner's remote list and
+    // are handed out again by the owner's next refill. Per-CPU caches
+    // (MYALLOC_PERCPU=1) would take them instead, so pin the mode off.
+    bool percpu = false;
+    bool percpu_off = false;
+    size_t bool_length = sizeof(bool);
+    my_allocctl("percpu.enabled", &percpu, &bool_length, &percpu_off, sizeof(percpu_off));
+    
+    const size_t size = 208;
+    int class_index = size_class_index(size);
+    ThreadCache* cache = get_thread_cache();
+    
+    std::vector<void*> blocks;
+    for (int i = 0; i < 16; i++) {
+        blocks.push_back(my_malloc(size));
+    }
+    thread_cache_flush_bin(cache, class_index, cache->bins[class_index].count);
+    
+    std::thread remote([&blocks]() {
+        for (void* ptr : blocks) {
+            my_free(ptr);
+        }
+    });
+    remote.join();
+    
+    bool queued = cache->remote_free[class_index].load() != nullptr;
+    void* reused = my_malloc(size);
+    bool drained = std::find(blocks.begin(), blocks.end(), reused) != blocks.end() &&
+                   cache->remote_free[class_index].load() == nullptr;
+    my_free(reused);
+    
+    if (queued && drained) {
+        test_passed("Remote frees are queued and drained by the owner");
+    } else {
+        test_failed("test_remote_free", "Remotely freed blocks were not reused");
+    }
+    
+    // An exiting thread hands back its full slabs too, so frees of their
+    // blocks go to the pool rather than to the dead thread's cache
+    std::vector<void*> orphans;
+    std::thread exiting([&orphans, size]() {
+        orphans.push_back(my_malloc(size));
+        uint32_t capacity = get_slab(orphans[0])->capacity;
+        for (uint32_t i = 0; i < capacity * 2; i++) {
+            orphans.push_back(my_malloc(size));
+        }
+    });
+    exiting.join();
+    
+    SlabHeader* first_slab = get_slab(orphans[0]);
+    bool disowned = first_slab->used == first_slab->capacity &&
+                    first_slab->owner.load() == nullptr;
+    for (void* ptr : orphans) {
+        my_free(ptr);
+    }
+    
+    if (disowned) {
+        test_passed("Exiting thread disowns its full slabs");
+    } else {
+        test_failed("test_remote_free", "Full slab still owned by an exited thread's cache");
+    }
+    my_allocctl("percpu.enabled", nullptr, nullptr, &percpu, sizeof(percpu));
+    
+    // Producer/consumer: one thread allocates and fills, another checks
+    // and frees, while the producer keeps draining what comes back
+    const size_t ring_size = 256;
+    const int transfers = 50000;
+    std::vector<unsigned char*> ring(ring_size);
+    std::atomic<size_t> head(0);
+    std::atomic<size_t> tail(0);
+    std::atomic<int> errors(0);
+    
+    std::thread consumer([&]() {
+        for (int i = 0; i < transfers; i++) {
+            while (tail.load(std::memory_order_relaxed) == head.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            size_t slot = tail.load(std::memory_order_relaxed);
+            unsigned char* ptr = ring[slot % ring_size];
+            if (ptr[0] != (unsigned char)slot || ptr[15] != (unsigned char)slot) {
+                errors++;
+            }
+            my_free(ptr);
+            tail.store(slot + 1, std::memory_order_release);
+        }
+    });
+    
+    std::thread producer([&]() {
+        for (int i = 0; i < transfers; i++) {
+            unsigned char* ptr = (unsigned char*)my_malloc(16 + (i % 8) * 64);
+            if (ptr == nullptr) {
+                errors++;
+                ptr = (unsigned char*)my_malloc(16);
+            }
+            memset(ptr, (unsigned char)i, 16);
+            while (head.load(std::memory_order_relaxed) - tail.load(std::memory_order_acquire) ==
+                   ring_size) {
+                std::this_thread::yield();
+            }
+            ring[i % ring_size] = ptr;
+            head.store(i + 1, std::memory_order_release);
+        }
+    });
+    
+    producer.join();
+    consumer.join();
+    
+    if (errors == 0) {
+        test_passed("Producer/consumer through remote lists");
+    } else {
+        test_failed("test_remote_free", "Corruption or failure passing blocks between threads");
+    }
+}
+
+// ============================================================================
+// TEST: NUMA NODES
+// ============================================================================
+
+void test_numa() {
+    std::cout << "\n=== Test: NUMA nodes ===\n";
+    
+    // Slab slots and variable-size blocks come from a node's pools; huge
+    // mappings belong to no pool
+    int node_count = allocator_numa_nodes();
+    void* slab_ptr = my_malloc(100);
+    void* block_ptr = my_malloc(2000);
+    void* huge_ptr = my_malloc(MMAP_THRESHOLD * 2);
+    int slab_node = my_malloc_node(slab_ptr);
+    int block_node = my_malloc_node(block_ptr);
+    
+    if (node_count >= 1 && node_count <= MAX_NUMA_NODES &&
+        slab_node >= 0 && slab_node < node_count &&
+        block_node >= 0 && block_node < node_count &&
+        my_malloc_node(huge_ptr) == -1) {
+        test_passed("Blocks report the node they were allocated on");
+    } else {
+        test_failed("test_numa", "Wrong node for a block");
+    }
+    
+    // A block freed on another thread goes back to the node it came from
+    std::thread remote([block_ptr]() {
+        my_free(block_ptr);
+    });
+    remote.join();
+    void* again = my_malloc(2000);
+    if (my_malloc_node(again) == block_node) {
+        test_passed("Remote frees return to the owning node");
+    } else {
+        test_failed("test_numa", "Block reused on the wrong node");
+    }
+    
+    my_free(again);
+    my_free(slab_ptr);
+    my_free(huge_ptr);
+}
+
+// ============================================================================
+// TEST: PER-CPU CACHES
+// ============================================================================
+
+static bool pin_to_cpu(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+void test_percpu() {
+    std::cout << "\n=== Test: Per-CPU caches ===\n";
+    
+    if (!allocator_set_percpu_cache(true)) {
+        test_passed("rseq unavailable, thread caches stay in use");
+        return;
+    }
+    
+    // A block freed on a CPU is handed to the next thread allocating on
+    // that CPU, not kept for the thread that freed it
+    cpu_set_t saved;
+    pthread_getaffinity_np(pthread_self(), sizeof(saved), &saved);
+    int cpu = sched_getcpu();
+    pin_to_cpu(cpu);
+    
+    void* freed = my_malloc(48);
+    my_free(freed);
+    void* reused = nullptr;
+    std::thread other([&reused, cpu]() {
+        pin_to_cpu(cpu);
+        reused = my_malloc(48);
+    });
+    other.join();
+    
+    if (reused == freed) {
+        test_passed("Threads on one CPU share its cache");
+    } else {
+        test_failed("test_percpu", "Block was not reused from the CPU's cache");
+    }
+    my_free(reused);
+    pthread_setaffinity_np(pthread_self(), sizeof(saved), &saved);
+    
+    // Overflowing a bin returns batches to the slabs
+    std::vector<void*> blocks;
+    for (int i = 0; i < PERCPU_SLOTS * 4; i++) {
+        blocks.push_back(my_malloc(16));
+    }
+    for (void* ptr : blocks) {
+        my_free(ptr);
+    }
+    
+    // Many threads allocating and freeing every cached class at once
+    std::atomic<int> errors(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 16; t++) {
+        threads.emplace_back([&errors, t]() {
+            std::vector<unsigned char*> held;
+            for (int i = 0; i < 20000; i++) {
+                size_t size = 16 + (size_t)((i + t) % 16) * 15;
+                unsigned char* ptr = (unsigned char*)my_malloc(size);
+                if (ptr == nullptr) {
+                    errors++;
+                    continue;
+                }
+                memset(ptr, (unsigned char)t, size);
+                held.push_back(ptr);
+                if (held.size() > 64 || i % 3 == 0) {
+                    unsigned char* old = held.front();
+                    if (old[0] != (unsigned char)t || old[15] != (unsigned char)t) {
+                        errors++;
+                    }
+                    my_free(old);
+                    held.erase(held.begin());
+                }
+            }
+            for (unsigned char* ptr : held) {
+                my_free(ptr);
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    
+    if (errors == 0) {
+        test_passed("Concurrent alloc/free through per-CPU caches");
+    } else {
+        test_failed("test_percpu", "Corruption or failure in per-CPU caches");
+    }
+    
+    allocator_set_percpu_cache(false);
+}
+
 // ============================================================================
 // MAIN TEST RUNNER
 // ============================================================================
@@ -298,7 +2045,8 @@ int main() {
     std::cout << "  Custom Memory Allocator Test Suite\n";
     std::cout << "========================================\n";
     
-    // Initialize allocator
+    // Initialize allocator (with progress messages)
+    allocator_set_verbose(true);
     allocator_init();
     
     // Run tests
@@ -308,10 +2056,33 @@ int main() {
     test_multiple_allocations();
     test_calloc();
     test_realloc();
+    test_realloc_in_place();
     test_alignment();
+    test_aligned_alloc();
     test_fragmentation();
+    test_coalescing();
+    test_segregated_fit();
+    test_fit_policies();
+    test_header_overhead();
+    test_slab_classes();
+    test_batch();
+    test_region();
+    test_object_pool();
     test_write_read();
     test_stress();
+    test_pool_growth();
+    test_scavenger();
+    test_huge_pages();
+    test_huge_allocations();
+    test_usable_size();
+    test_trace();
+    test_heap_profile();
+    test_stats();
+    test_allocctl();
+    test_threads();
+    test_remote_free();
+    test_numa();
+    test_percpu();
     
     // Print statistics
     std::cout << "\n=== Final Statistics ===\n";